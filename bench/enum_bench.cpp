@@ -0,0 +1,68 @@
+#include "../fileutils.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// Compare the runtime configured enumeration with the compile-time specialized one.
+
+static const char* BENCH_DIR = "bench_tree";
+static const int BENCH_DIRS = 200;
+static const int BENCH_FILES = 100;
+static const int BENCH_ROUNDS = 20;
+
+template<class Fun>
+static double measure(Fun fun) {
+	// The first round warms the dentry cache.
+	fun();
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_ROUNDS; i++) fun();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	return std::chrono::duration<double, std::milli>(elapsed).count() / BENCH_ROUNDS;
+}
+
+static void report(const char* name, double runtimeMs, double staticMs, size_t entries) {
+	printf("%-28s entries: %7zu  runtime: %8.3f ms  static: %8.3f ms  speedup: %.2fx\n",
+		name, entries, runtimeMs, staticMs, runtimeMs / staticMs);
+}
+
+int main() {
+	cx::remove_directories(BENCH_DIR);
+	for (int i = 0; i < BENCH_DIRS; i++) {
+		std::string dir = cx::combine_paths(BENCH_DIR, "d" + std::to_string(i / 10), "e" + std::to_string(i));
+		cx::create_directories(dir);
+		for (int k = 0; k < BENCH_FILES; k++) {
+			std::string filename = cx::combine_paths(dir, "file" + std::to_string(k) + (k % 10 ? ".txt" : ".log"));
+			cx::write_all_bytes(filename, std::vector<unsigned char>());
+		}
+	}
+
+	size_t count = 0;
+	auto counter = [&count](const std::string&, cx::EnumFileType, bool&) { count++; };
+	auto logs = [&count](const std::string& filename, cx::EnumFileType, bool&) {
+		if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".log") == 0) count++;
+	};
+	auto isLog = [](const char* name) {
+		size_t length = strlen(name);
+		return length >= 4 && memcmp(name + length - 4, ".log", 4) == 0;
+	};
+
+	double runtimeMs = measure([&]() { count = 0; cx::enum_all_files(BENCH_DIR, counter, cx::EFT_FILE); });
+	double staticMs = measure([&]() { count = 0; cx::enum_files<cx::EFT_FILE, 0>(BENCH_DIR, counter); });
+	report("files", runtimeMs, staticMs, count);
+
+	runtimeMs = measure([&]() { count = 0; cx::enum_all_files(BENCH_DIR, counter, cx::EFT_DIR); });
+	staticMs = measure([&]() { count = 0; cx::enum_files<cx::EFT_DIR, 0>(BENCH_DIR, counter); });
+	report("directories", runtimeMs, staticMs, count);
+
+	runtimeMs = measure([&]() { count = 0; cx::enum_files(BENCH_DIR, counter, cx::EFT_DIR | cx::EFT_FILE, 2); });
+	staticMs = measure([&]() { count = 0; cx::enum_files<cx::EFT_DIR | cx::EFT_FILE, 2>(BENCH_DIR, counter); });
+	report("depth 2", runtimeMs, staticMs, count);
+
+	runtimeMs = measure([&]() { count = 0; cx::enum_all_files(BENCH_DIR, logs, cx::EFT_FILE); });
+	staticMs = measure([&]() { count = 0; cx::enum_files<cx::EFT_FILE, 0>(BENCH_DIR, counter, isLog); });
+	report("files named *.log", runtimeMs, staticMs, count);
+
+	cx::remove_directories(BENCH_DIR);
+	return 0;
+}
@@ -24,16 +24,52 @@
 
 #include "fileutils.h"
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <errno.h>
+#include <stdint.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif // _MSC_VER
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
 #ifdef _WIN32
 #include <windows.h>
 #include <strsafe.h>
 #else
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#endif // __linux__
 #endif // _WIN32
 
 namespace cx {
@@ -45,6 +81,16 @@ namespace cx {
 	static char DIR_SEP = '/';
 #endif // _WIN32
 
+	static bool _is_separator(char ch) {
+#ifdef _WIN32
+		return ch == DIR_SEP || ch == DIR_SEP2;
+#else
+		return ch == DIR_SEP;
+#endif // _WIN32
+	}
+
+	static void _invalidate_metadata_caches(const std::string& path, bool tree);
+
 	std::string combine_paths(const std::string& path1, const std::string& path2) {
 		if (path1.empty()) return path2;
 		if (path2.empty()) return path1;
@@ -72,38 +118,33 @@ namespace cx {
 		return combine_paths(combine_paths(path1, path2), combine_paths(path3, path4));
 	}
 
-	bool is_file(const std::string& path) {
-		if (path.empty()) return false;
+	static int _get_path_type(const std::string& path) {
+		if (path.empty()) return 0;
 
+		int type = 0;
 #ifdef _WIN32
 		DWORD attr = GetFileAttributesA(path.c_str());
-		if (attr == INVALID_FILE_ATTRIBUTES) return false;
+		if (attr == INVALID_FILE_ATTRIBUTES) return 0;
 
-		return (attr & FILE_ATTRIBUTE_ARCHIVE);
+		if (attr & FILE_ATTRIBUTE_ARCHIVE) type |= EFT_FILE;
+		if (attr & FILE_ATTRIBUTE_DIRECTORY) type |= EFT_DIR;
 #else
 		struct stat st = { 0 };
 		if (stat(path.c_str(), &st) == -1)
-			return false;
+			return 0;
 
-		return (st.st_mode & S_IFREG);
+		if (st.st_mode & S_IFREG) type |= EFT_FILE;
+		if (st.st_mode & S_IFDIR) type |= EFT_DIR;
 #endif // _WIN32
+		return type;
 	}
 
-	bool is_directory(const std::string& path) {
-		if (path.empty()) return false;
-
-#ifdef _WIN32
-		DWORD attr = GetFileAttributesA(path.c_str());
-		if (attr == INVALID_FILE_ATTRIBUTES) return false;
-
-		return (attr & FILE_ATTRIBUTE_DIRECTORY);
-#else
-		struct stat st = { 0 };
-		if (stat(path.c_str(), &st) == -1)
-			return false;
+	bool is_file(const std::string& path) {
+		return (_get_path_type(path) & EFT_FILE) != 0;
+	}
 
-		return (st.st_mode & S_IFDIR);
-#endif // _WIN32
+	bool is_directory(const std::string& path) {
+		return (_get_path_type(path) & EFT_DIR) != 0;
 	}
 
 	std::string get_filename(const std::string& path) {
@@ -159,12 +200,13 @@ namespace cx {
 	bool create_directory(const std::string& path) {
 		if (path.empty()) throw std::invalid_argument("path");
 #ifdef _WIN32
-		if (!::CreateDirectoryA(path.c_str(), NULL))
-			return false;
-		return true;
+		bool r = ::CreateDirectoryA(path.c_str(), NULL) == TRUE;
 #else
-		return mkdir(path.c_str(), 0) == 0;
+		bool r = mkdir(path.c_str(), 0) == 0;
 #endif // _WIN32
+		// Invalidate after the change, so a concurrent lookup cannot cache the old type again.
+		if (r) _invalidate_metadata_caches(path, false);
+		return r;
 	}
 
 	static bool _do_create_directories(const std::string& path) {
@@ -188,10 +230,12 @@ namespace cx {
 	bool remove_directory(const std::string& path) {
 		if (path.empty()) throw std::invalid_argument("path");
 #ifdef _WIN32
-		return ::RemoveDirectoryA(path.c_str()) == TRUE;
+		bool r = ::RemoveDirectoryA(path.c_str()) == TRUE;
 #else
-		return ::rmdir(path.c_str()) == 0;
+		bool r = ::rmdir(path.c_str()) == 0;
 #endif // _WIN32
+		if (r) _invalidate_metadata_caches(path, false);
+		return r;
 	}
 
 	bool do_remove_directories(const std::string& path) {
@@ -211,129 +255,620 @@ namespace cx {
 
 	bool remove_directories(const std::string& path) {
 		if (path.empty()) throw std::invalid_argument("path");
-		return do_remove_directories(path);
+		bool r = do_remove_directories(path);
+		_invalidate_metadata_caches(path, true);
+		return r;
 	}
 
 	bool remove_file(const std::string& path) {
 		if (path.empty()) throw std::invalid_argument("path");
 
+		std::error_code ec;
+		bool r = remove_file(path, ec);
+		if (ec) throw io_exception(ec.value());
+		return r;
+	}
+
+	bool remove_file(const std::string& path, std::error_code& ec) noexcept {
+		ec.clear();
+		if (path.empty()) {
+			ec = std::make_error_code(std::errc::invalid_argument);
+			return false;
+		}
+
 #ifdef _WIN32
 		BOOL r = ::DeleteFileA(path.c_str());
-		if (r == true) return true;
+		if (r == TRUE) {
+			_invalidate_metadata_caches(path, false);
+			return true;
+		}
 		DWORD lastError = ::GetLastError();
 		if (lastError == ERROR_FILE_NOT_FOUND) return false;
+		ec.assign((int)lastError, std::system_category());
 #else
+		// A symbolic link is removed itself, whatever it refers to.
 		struct stat st = { 0 };
-		if (stat(path.c_str(), &st) == -1)
+		if (lstat(path.c_str(), &st) == -1)
 			return false;
 
-		if (st.st_mode & S_IFREG) {
-			int r = ::remove(path.c_str());
-			if (r == 0) return true;
+		if (!S_ISREG(st.st_mode) && !S_ISLNK(st.st_mode)) {
+			ec.assign(S_ISDIR(st.st_mode) ? EISDIR : EINVAL, std::system_category());
+			return false;
 		}
+		int r = ::remove(path.c_str());
+		if (r == 0) {
+			_invalidate_metadata_caches(path, false);
+			return true;
+		}
+		if (errno == ENOENT) return false;
+		ec.assign(errno, std::system_category());
 #endif // _WIN32
-		throw io_exception();
+		return false;
 	}
 
 	void rename(const std::string& oldName, const std::string& newName) {
 		if (oldName.empty()) throw std::invalid_argument("oldName");
 		if (newName.empty()) throw std::invalid_argument("newName");
 
+		std::error_code ec;
+		rename(oldName, newName, ec);
+		if (ec) throw io_exception(ec.value());
+	}
+
+	void rename(const std::string& oldName, const std::string& newName, std::error_code& ec) noexcept {
+		ec.clear();
+		if (oldName.empty() || newName.empty()) {
+			ec = std::make_error_code(std::errc::invalid_argument);
+			return;
+		}
 		int r = ::rename(oldName.c_str(), newName.c_str());
-		if (r == 0) return;
-		throw io_exception();
+		if (r == 0) {
+			_invalidate_metadata_caches(oldName, true);
+			_invalidate_metadata_caches(newName, true);
+			return;
+		}
+		ec.assign(errno, std::system_category());
 	}
 
-	file_enumerator::file_enumerator() {
-		started = false;
-		_Filters = EFT_DIR | EFT_FILE;
+	static const size_t METADATA_CACHE_SHARDS = 16;
+
+	struct _metadata_cache_entry {
+		std::string path;
+		int type;
+		std::chrono::steady_clock::time_point expireTime;
+	};
+
+	struct _metadata_cache_shard {
+		_metadata_cache_shard() : generation(0) { }
+
+		std::mutex mutex;
+		std::list<_metadata_cache_entry> lru;
+		std::unordered_map<std::string, std::list<_metadata_cache_entry>::iterator> index;
+		// Bumped by every invalidation, so a lookup does not cache what it read before a change.
+		unsigned long long generation;
+	};
+
+	struct _metadata_cache_impl {
+		_metadata_cache_shard shards[METADATA_CACHE_SHARDS];
+		size_t shardCapacity;
+		std::chrono::milliseconds ttl;
+		std::chrono::milliseconds negativeTtl;
+
+		std::mutex watchMutex;
+		std::map<int, std::string> watches;
+		std::thread watcher;
+		int watchFd;
+		int stopFds[2];
+
+		_metadata_cache_shard& shard(const std::string& path) {
+			return shards[std::hash<std::string>()(path) % METADATA_CACHE_SHARDS];
+		}
+
+		int get_type(const std::string& path) {
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			_metadata_cache_shard& sh = shard(path);
+			unsigned long long generation;
+			{
+				std::lock_guard<std::mutex> lock(sh.mutex);
+				generation = sh.generation;
+				auto i = sh.index.find(path);
+				if (i != sh.index.end()) {
+					if (now < i->second->expireTime) {
+						sh.lru.splice(sh.lru.begin(), sh.lru, i->second);
+						return i->second->type;
+					}
+					sh.lru.erase(i->second);
+					sh.index.erase(i);
+				}
+			}
+
+			// Query without holding the lock, concurrent misses on the same path both go to the file system.
+			int type = _get_path_type(path);
+			std::chrono::milliseconds life = type != 0 ? ttl : negativeTtl;
+
+			std::lock_guard<std::mutex> lock(sh.mutex);
+			// The path may have changed during the query, the type is returned but not cached.
+			if (sh.generation != generation) return type;
+			auto i = sh.index.find(path);
+			if (i != sh.index.end()) {
+				sh.lru.erase(i->second);
+				sh.index.erase(i);
+			}
+
+			_metadata_cache_entry entry;
+			entry.path = path;
+			entry.type = type;
+			entry.expireTime = life.count() == 0 ? std::chrono::steady_clock::time_point::max() : now + life;
+			sh.lru.push_front(entry);
+			sh.index[path] = sh.lru.begin();
+
+			while (sh.lru.size() > shardCapacity) {
+				sh.index.erase(sh.lru.back().path);
+				sh.lru.pop_back();
+			}
+			return type;
+		}
+
+		void invalidate(const std::string& path) {
+			_metadata_cache_shard& sh = shard(path);
+			std::lock_guard<std::mutex> lock(sh.mutex);
+			sh.generation++;
+			auto i = sh.index.find(path);
+			if (i == sh.index.end()) return;
+			sh.lru.erase(i->second);
+			sh.index.erase(i);
+		}
+
+		void invalidate_tree(const std::string& path) {
+			std::string dir = path;
+			while (!dir.empty() && _is_separator(dir[dir.size() - 1])) dir.erase(dir.size() - 1);
+			if (dir.empty()) {
+				clear();
+				return;
+			}
+
+			for (size_t s = 0; s < METADATA_CACHE_SHARDS; s++) {
+				_metadata_cache_shard& sh = shards[s];
+				std::lock_guard<std::mutex> lock(sh.mutex);
+				sh.generation++;
+				for (auto i = sh.lru.begin(); i != sh.lru.end();) {
+					const std::string& p = i->path;
+					if (p.compare(0, dir.size(), dir) == 0 && (p.size() == dir.size() || _is_separator(p[dir.size()]))) {
+						sh.index.erase(p);
+						i = sh.lru.erase(i);
+					} else {
+						++i;
+					}
+				}
+			}
+		}
+
+		void clear() {
+			for (size_t s = 0; s < METADATA_CACHE_SHARDS; s++) {
+				std::lock_guard<std::mutex> lock(shards[s].mutex);
+				shards[s].generation++;
+				shards[s].lru.clear();
+				shards[s].index.clear();
+			}
+		}
+
+#ifdef __linux__
+		void watch_loop() {
+			char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+			for (;;) {
+				pollfd fds[2] = { { watchFd, POLLIN, 0 }, { stopFds[0], POLLIN, 0 } };
+				if (poll(fds, 2, -1) == -1) {
+					if (errno == EINTR) continue;
+					return;
+				}
+				if (fds[1].revents) return;
+
+				ssize_t len = read(watchFd, buf, sizeof(buf));
+				if (len <= 0) continue;
+
+				for (char* p = buf; p < buf + len;) {
+					inotify_event* e = (inotify_event*)p;
+					p += sizeof(inotify_event) + e->len;
+
+					if (e->mask & IN_Q_OVERFLOW) {
+						clear();
+						continue;
+					}
+
+					std::string dir;
+					{
+						std::lock_guard<std::mutex> lock(watchMutex);
+						auto i = watches.find(e->wd);
+						if (i == watches.end()) continue;
+						dir = i->second;
+						if (e->mask & IN_IGNORED) watches.erase(i);
+					}
+
+					if (e->len > 0) invalidate_tree(combine_paths(dir, e->name));
+					else invalidate_tree(dir);
+				}
+			}
+		}
+#endif // __linux__
+	};
+
+	static std::mutex& _metadata_caches_mutex() {
+		static std::mutex m;
+		return m;
 	}
 
-	file_enumerator::file_enumerator(int filters) {
-		started = false;
-		this->_Filters = filters;
+	static std::vector<_metadata_cache_impl*>& _metadata_caches() {
+		static std::vector<_metadata_cache_impl*> caches;
+		return caches;
 	}
 
-	file_enumerator::~file_enumerator() {
-		end();
+	static std::atomic<int> _metadata_cache_count(0);
+
+	static void _invalidate_metadata_caches(const std::string& path, bool tree) {
+		if (_metadata_cache_count.load(std::memory_order_acquire) == 0) return;
+
+		std::lock_guard<std::mutex> lock(_metadata_caches_mutex());
+		std::vector<_metadata_cache_impl*>& caches = _metadata_caches();
+		for (size_t i = 0; i < caches.size(); i++) {
+			if (tree) caches[i]->invalidate_tree(path);
+			else caches[i]->invalidate(path);
+		}
 	}
 
-	bool file_enumerator::begin(const std::string& dirName) {
+	// Invalidate the metadata caches when leaving the scope, once the changes are made, even on errors.
+	struct _scoped_invalidation {
+		_scoped_invalidation(const std::string& path, bool tree) : path(path), tree(tree) { }
+		~_scoped_invalidation() { _invalidate_metadata_caches(path, tree); }
+
+		const std::string& path;
+		bool tree;
+	};
+
+	metadata_cache::metadata_cache(size_t capacity /*= 4096*/, unsigned int ttl /*= 1000*/, unsigned int negativeTtl /*= 100*/) {
+		impl = new _metadata_cache_impl();
+		impl->shardCapacity = (capacity + METADATA_CACHE_SHARDS - 1) / METADATA_CACHE_SHARDS;
+		if (impl->shardCapacity == 0) impl->shardCapacity = 1;
+		impl->ttl = std::chrono::milliseconds(ttl);
+		impl->negativeTtl = std::chrono::milliseconds(negativeTtl);
+		impl->watchFd = -1;
+		impl->stopFds[0] = impl->stopFds[1] = -1;
+
+		std::lock_guard<std::mutex> lock(_metadata_caches_mutex());
+		_metadata_caches().push_back(impl);
+		_metadata_cache_count++;
+	}
+
+	metadata_cache::~metadata_cache() {
+		{
+			std::lock_guard<std::mutex> lock(_metadata_caches_mutex());
+			std::vector<_metadata_cache_impl*>& caches = _metadata_caches();
+			caches.erase(std::find(caches.begin(), caches.end(), impl));
+			_metadata_cache_count--;
+		}
+
+#ifdef __linux__
+		if (impl->watcher.joinable()) {
+			char ch = 0;
+			while (::write(impl->stopFds[1], &ch, 1) == -1 && errno == EINTR);
+			impl->watcher.join();
+		}
+		if (impl->watchFd != -1) close(impl->watchFd);
+		if (impl->stopFds[0] != -1) close(impl->stopFds[0]);
+		if (impl->stopFds[1] != -1) close(impl->stopFds[1]);
+#endif // __linux__
+
+		delete impl;
+	}
+
+	bool metadata_cache::is_file(const std::string& path) {
+		if (path.empty()) return false;
+		return (impl->get_type(path) & EFT_FILE) != 0;
+	}
+
+	bool metadata_cache::is_directory(const std::string& path) {
+		if (path.empty()) return false;
+		return (impl->get_type(path) & EFT_DIR) != 0;
+	}
+
+	void metadata_cache::invalidate(const std::string& path) {
+		impl->invalidate(path);
+	}
+
+	void metadata_cache::invalidate_tree(const std::string& path) {
+		impl->invalidate_tree(path);
+	}
+
+	void metadata_cache::clear() {
+		impl->clear();
+	}
+
+	size_t metadata_cache::size() const {
+		size_t count = 0;
+		for (size_t s = 0; s < METADATA_CACHE_SHARDS; s++) {
+			std::lock_guard<std::mutex> lock(impl->shards[s].mutex);
+			count += impl->shards[s].lru.size();
+		}
+		return count;
+	}
+
+	bool metadata_cache::watch(const std::string& dirName) {
 		if (dirName.empty()) throw std::invalid_argument("dirName");
-		if (started) return false;
 
-		this->dname = dirName;
+#ifdef __linux__
+		std::lock_guard<std::mutex> lock(impl->watchMutex);
+		if (impl->watchFd == -1) {
+			impl->watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (impl->watchFd == -1) return false;
+		}
+
+		int wd = inotify_add_watch(impl->watchFd, dirName.c_str(),
+			IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+		if (wd == -1) return false;
+		impl->watches[wd] = dirName;
+
+		if (!impl->watcher.joinable()) {
+			if (pipe(impl->stopFds) == -1) return false;
+			impl->watcher = std::thread(&_metadata_cache_impl::watch_loop, impl);
+		}
+		return true;
+#else
+		return false;
+#endif // __linux__
+	}
+
+#ifdef _WIN32
+	static long long _filetime_to_seconds(const FILETIME& ft) {
+		unsigned long long t = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+		return (long long)((t - 116444736000000000ULL) / 10000000ULL);
+	}
+#else
+	static bool _fill_file_status(const struct stat& st, file_status& status) {
+		if (S_ISDIR(st.st_mode)) status.type = EFT_DIR;
+		else if (S_ISREG(st.st_mode)) status.type = EFT_FILE;
+		else return false;
+
+		status.inode = (unsigned long long)st.st_ino;
+		status.device = (unsigned long long)st.st_dev;
+		status.size = (unsigned long long)st.st_size;
+		status.mtime = (long long)st.st_mtime;
+		return true;
+	}
+#endif // _WIN32
+
+	bool get_file_status(const std::string& path, file_status& status) {
+		if (path.empty()) return false;
+
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA fad;
+		if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &fad)) return false;
+
+		if (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) status.type = EFT_DIR;
+		else if (fad.dwFileAttributes & FILE_ATTRIBUTE_ARCHIVE) status.type = EFT_FILE;
+		else return false;
+
+		status.filename = path;
+		status.inode = 0;
+		status.device = 0;
+		status.size = ((unsigned long long)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+		status.mtime = _filetime_to_seconds(fad.ftLastWriteTime);
+		return true;
+#else
+		struct stat st;
+		if (stat(path.c_str(), &st) == -1) return false;
+		if (!_fill_file_status(st, status)) return false;
+
+		status.filename = path;
+		return true;
+#endif // _WIN32
+	}
+
+	void stat_directory(const std::string& dirName, std::vector<file_status>& entries, int filters /*= EFT_DIR | EFT_FILE*/) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		entries.clear();
+
 #ifdef _WIN32
+		// FindFirstFile returns the metadata together with the names, no extra I/O is needed.
 		WIN32_FIND_DATAA ffd;
 		char szDir[MAX_PATH];
 
-		if (StringCchCopyA(szDir, MAX_PATH, dirName.c_str()) != S_OK) return false;
-		if (StringCchCatA(szDir, MAX_PATH, "\\*") != S_OK) return false;
+		if (StringCchCopyA(szDir, MAX_PATH, dirName.c_str()) != S_OK) return;
+		if (StringCchCatA(szDir, MAX_PATH, "\\*") != S_OK) return;
 
 		HANDLE hDir = FindFirstFileA(szDir, &ffd);
-		if (hDir == INVALID_HANDLE_VALUE)
-			throw io_exception();
-		
-		bool bFound = false;
+		if (hDir == INVALID_HANDLE_VALUE) throw io_exception((int)::GetLastError());
+
 		do {
-			if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-				if ((_Filters & EFT_DIR) == 0) continue;
+			file_status status;
+			if (ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+				continue;
+			} else if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+				if ((filters & EFT_DIR) == 0) continue;
 				if (strcmp(ffd.cFileName, ".") == 0 || strcmp(ffd.cFileName, "..") == 0) continue;
-
-				ftype = EFT_DIR;
-				bFound = true;
-				break;
+				status.type = EFT_DIR;
 			} else if (ffd.dwFileAttributes & FILE_ATTRIBUTE_ARCHIVE) {
-				if ((_Filters & EFT_FILE) == 0) continue;
-				ftype = EFT_FILE;
-				bFound = true;
-				break;
+				if ((filters & EFT_FILE) == 0) continue;
+				status.type = EFT_FILE;
+			} else {
+				continue;
 			}
-		} while (FindNextFileA(hDir, &ffd));
 
-		if (bFound) {
-			fname = combine_paths(dname, ffd.cFileName);
+			status.filename = combine_paths(dirName, ffd.cFileName);
+			status.inode = 0;
+			status.device = 0;
+			status.size = ((unsigned long long)ffd.nFileSizeHigh << 32) | ffd.nFileSizeLow;
+			status.mtime = _filetime_to_seconds(ffd.ftLastWriteTime);
+			entries.push_back(status);
+		} while (FindNextFileA(hDir, &ffd));
 
-			nativeEnumerator = hDir;
-			started = true;
-			return true;
-		} else {
-			FindClose(hDir);
-			return false;
-		}
+		FindClose(hDir);
 #else
 		DIR* hDir = opendir(dirName.c_str());
 		if (hDir == NULL)
 			throw io_exception();
 
-		bool bFound = false;
+		// Collect the whole batch first, readdir returns the entries in hash order.
+		std::vector<std::pair<ino_t, std::string> > names;
 		dirent* d = NULL;
 		while ((d = readdir(hDir)) != NULL) {
-			if (d->d_type & DT_DIR) {
-				if ((_Filters & EFT_DIR) == 0) continue;
+			if (d->d_type == DT_DIR) {
+				if ((filters & EFT_DIR) == 0) continue;
 				if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
-
-				ftype = EFT_DIR;
-				bFound = true;
-				break;
-			} else if (d->d_type & DT_REG) {
-				if ((_Filters & EFT_FILE) == 0) continue;
-				ftype = EFT_FILE;
-				bFound = true;
-				break;
+			} else if (d->d_type == DT_REG) {
+				if ((filters & EFT_FILE) == 0) continue;
+			} else if (d->d_type != DT_UNKNOWN) {
+				continue;
 			}
+			names.push_back(std::make_pair(d->d_ino, std::string(d->d_name)));
+		}
+
+		// Inode numbers map to the position in the inode table, so stating in
+		// inode order turns the random inode table reads into a sequential scan.
+		std::sort(names.begin(), names.end());
+
+		int fd = dirfd(hDir);
+		entries.reserve(names.size());
+		for (size_t i = 0; i < names.size(); i++) {
+			struct stat st;
+			// never follow links, a link to a parent directory would recurse forever.
+			if (fstatat(fd, names[i].second.c_str(), &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+
+			file_status status;
+			if (!_fill_file_status(st, status)) continue;
+			if ((status.type & filters) == 0) continue;
+
+			status.filename = combine_paths(dirName, names[i].second);
+			entries.push_back(status);
+		}
+
+		closedir(hDir);
+#endif // _WIN32
+	}
+
+#ifndef _WIN32
+	// Map a directory entry to EFT_DIR or EFT_FILE, or 0 for "." and "..", devices, pipes and sockets.
+	// Symbolic links are files. Entries without d_type (DT_UNKNOWN on some file systems) are stated.
+	static int _dirent_file_type(DIR* hDir, const dirent* d, bool& symlink) {
+		const char* name = d->d_name;
+		if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) return 0;
+
+		unsigned char type = d->d_type;
+		if (type == DT_UNKNOWN) {
+			struct stat st;
+			if (fstatat(dirfd(hDir), name, &st, AT_SYMLINK_NOFOLLOW) == -1) return 0;
+			if (S_ISDIR(st.st_mode)) type = DT_DIR;
+			else if (S_ISREG(st.st_mode)) type = DT_REG;
+			else if (S_ISLNK(st.st_mode)) type = DT_LNK;
+		}
+
+		symlink = type == DT_LNK;
+		if (type == DT_DIR) return EFT_DIR;
+		if (type == DT_REG || type == DT_LNK) return EFT_FILE;
+		return 0;
+	}
+#endif // _WIN32
+
+	file_enumerator::file_enumerator() {
+		started = false;
+		symlink = false;
+		position = 0;
+		_Filters = EFT_DIR | EFT_FILE;
+	}
+
+	file_enumerator::file_enumerator(int filters) {
+		started = false;
+		symlink = false;
+		position = 0;
+		this->_Filters = filters;
+	}
+
+	file_enumerator::~file_enumerator() {
+		end();
+	}
+
+	bool file_enumerator::begin(const std::string& dirName) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+
+		std::error_code ec;
+		bool r = begin(dirName, ec);
+		if (ec) throw io_exception(ec.value());
+		return r;
+	}
+
+	bool file_enumerator::begin(const std::string& dirName, std::error_code& ec) noexcept {
+		return begin_at(dirName, 0, ec);
+	}
+
+	bool file_enumerator::begin(const std::string& dirName, unsigned long long cursor) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+
+		std::error_code ec;
+		bool r = begin_at(dirName, cursor, ec);
+		if (ec) throw io_exception(ec.value());
+		return r;
+	}
+
+#ifdef _WIN32
+	// Map a find result to EFT_DIR or EFT_FILE, or 0 for "." and ".." and other entries.
+	static int _find_data_type(const WIN32_FIND_DATAA& ffd) {
+		if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			if (strcmp(ffd.cFileName, ".") == 0 || strcmp(ffd.cFileName, "..") == 0) return 0;
+			return EFT_DIR;
+		}
+		if (ffd.dwFileAttributes & FILE_ATTRIBUTE_ARCHIVE) return EFT_FILE;
+		return 0;
+	}
+#endif // _WIN32
+
+	bool file_enumerator::begin_at(const std::string& dirName, unsigned long long cursor, std::error_code& ec) noexcept {
+		ec.clear();
+		if (dirName.empty()) {
+			ec = std::make_error_code(std::errc::invalid_argument);
+			return false;
+		}
+		if (started) return false;
+
+		this->dname = dirName;
+#ifdef _WIN32
+		WIN32_FIND_DATAA ffd;
+		char szDir[MAX_PATH];
+
+		if (StringCchCopyA(szDir, MAX_PATH, dirName.c_str()) != S_OK) return false;
+		if (StringCchCatA(szDir, MAX_PATH, "\\*") != S_OK) return false;
+
+		HANDLE hDir = FindFirstFileA(szDir, &ffd);
+		if (hDir == INVALID_HANDLE_VALUE) {
+			ec.assign((int)::GetLastError(), std::system_category());
+			return false;
 		}
+		nativeEnumerator = hDir;
+		started = true;
 
+		// Without seekdir, the cursor is the count of entries to skip.
+		bool bFound = true;
+		for (position = 0; position < cursor && bFound; position++) bFound = FindNextFileA(hDir, &ffd) != 0;
 		if (bFound) {
-			fname = combine_paths(dname, d->d_name);
-			nativeEnumerator = hDir;
-			started = true;
-			return true;
-		} else {
-			closedir(hDir);
+			int fileType = _find_data_type(ffd);
+			if (fileType & _Filters) {
+				ftype = (EnumFileType)fileType;
+				fname = combine_paths(dname, ffd.cFileName);
+				symlink = (ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+				return true;
+			}
+			if (next()) return true;
+		}
+#else
+		DIR* hDir = opendir(dirName.c_str());
+		if (hDir == NULL) {
+			ec.assign(errno, std::system_category());
 			return false;
 		}
+		if (cursor != 0) seekdir(hDir, (long)cursor);
+		nativeEnumerator = hDir;
+		started = true;
+		if (next()) return true;
 #endif // _WIN32
+		end();
+		return false;
 	}
 
 	void file_enumerator::end() {
@@ -357,55 +892,72 @@ namespace cx {
 		HANDLE hDir = (HANDLE)nativeEnumerator;
 
 		WIN32_FIND_DATAA ffd;
-		bool bFound = false;
-		while (FindNextFileA(hDir, &ffd)) {
-			if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-				if (strcmp(ffd.cFileName, ".") == 0 || strcmp(ffd.cFileName, "..") == 0) continue;
+		for (;;) {
+			position++;
+			if (!FindNextFileA(hDir, &ffd)) return false;
 
-				ftype = EFT_DIR;
-				bFound = true;
-				break;
-			} else if (ffd.dwFileAttributes & FILE_ATTRIBUTE_ARCHIVE) {
-				ftype = EFT_FILE;
-				bFound = true;
-				break;
-			}
-		}
-
-		if (bFound) {
+			int fileType = _find_data_type(ffd);
+			if ((fileType & _Filters) == 0) continue;
+			ftype = (EnumFileType)fileType;
 			fname = combine_paths(dname, ffd.cFileName);
+			symlink = (ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
 			return true;
-		} else {
-			return false;
 		}
 #else 
 		DIR* hDir = (DIR*)nativeEnumerator;
 
-		bool bFound = false;
-		dirent* d = NULL;
-		while ((d = readdir(hDir)) != NULL) {
-			if (d->d_type & DT_DIR) {
-				if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
-
-				ftype = EFT_DIR;
-				bFound = true;
-				break;
-			} else if (d->d_type & DT_REG) {
-				ftype = EFT_FILE;
-				bFound = true;
-				break;
+		for (;;) {
+			// The position before the entry is read, so seekdir returns to it.
+			long pos = telldir(hDir);
+			dirent* d = readdir(hDir);
+			if (d == NULL) {
+				position = (unsigned long long)pos;
+				return false;
 			}
-		}
 
-		if (bFound) {
+			int fileType = _dirent_file_type(hDir, d, symlink);
+			if ((fileType & _Filters) == 0) continue;
+			ftype = (EnumFileType)fileType;
 			fname = combine_paths(dname, d->d_name);
+			position = (unsigned long long)pos;
 			return true;
-		} else {
-			return false;
 		}
 #endif // _WIN32
 	}
 
+	bool file_enumerator::next_entries(std::vector<directory_entry>& entries, size_t count) {
+		if (!started) return false;
+
+		directory_entry entry;
+		entry.depth = 1;
+		for (size_t i = 0; i < count; i++) {
+			entry.filename = fname;
+			entry.type = ftype;
+			entry.symlink = symlink;
+			entries.push_back(entry);
+			if (!next()) {
+				end();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	unsigned long long file_enumerator::cursor() const {
+		return position;
+	}
+
+	bool read_directory_page(const std::string& dirName, unsigned long long& cursor, size_t count, std::vector<directory_entry>& entries, int filters /*= EFT_DIR | EFT_FILE*/) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		if (count == 0) throw std::invalid_argument("count");
+		entries.clear();
+
+		file_enumerator fe(filters);
+		bool more = fe.begin(dirName, cursor) && fe.next_entries(entries, count);
+		cursor = fe.cursor();
+		return more;
+	}
+
 	const std::string& file_enumerator::filename() const {
 		return fname;
 	}
@@ -414,6 +966,10 @@ namespace cx {
 		return ftype;
 	}
 
+	bool file_enumerator::is_symlink() const {
+		return symlink;
+	}
+
 	int file_enumerator::filters() const {
 		return this->_Filters;
 	}
@@ -422,6 +978,376 @@ namespace cx {
 		this->_Filters = newFilters;
 	}
 
+	_dir_reader::_dir_reader() {
+		nativeHandle = NULL;
+		findData = NULL;
+		first = false;
+	}
+
+	_dir_reader::~_dir_reader() {
+#ifdef _WIN32
+		if (nativeHandle != NULL) FindClose((HANDLE)nativeHandle);
+		delete (WIN32_FIND_DATAA*)findData;
+#else
+		if (nativeHandle != NULL) closedir((DIR*)nativeHandle);
+#endif // _WIN32
+	}
+
+	void _dir_reader::open(std::string& path) {
+		if (path.empty()) throw std::invalid_argument("path");
+#ifdef _WIN32
+		if (!_is_separator(path[path.size() - 1])) path += DIR_SEP;
+		WIN32_FIND_DATAA* ffd = new WIN32_FIND_DATAA;
+		findData = ffd;
+		HANDLE hDir = FindFirstFileA((path + "*").c_str(), ffd);
+		if (hDir == INVALID_HANDLE_VALUE) throw io_exception();
+		nativeHandle = hDir;
+		first = true;
+#else
+		DIR* hDir = opendir(path.c_str());
+		if (hDir == NULL) throw io_exception(errno);
+		nativeHandle = hDir;
+		if (!_is_separator(path[path.size() - 1])) path += DIR_SEP;
+#endif // _WIN32
+	}
+
+	const char* _dir_reader::next(EnumFileType& fileType) {
+		if (nativeHandle == NULL) return NULL;
+#ifdef _WIN32
+		WIN32_FIND_DATAA* ffd = (WIN32_FIND_DATAA*)findData;
+		for (;;) {
+			if (first) first = false;
+			else if (!FindNextFileA((HANDLE)nativeHandle, ffd)) return NULL;
+
+			if (ffd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+				if (strcmp(ffd->cFileName, ".") == 0 || strcmp(ffd->cFileName, "..") == 0) continue;
+				fileType = EFT_DIR;
+				return ffd->cFileName;
+			}
+			if (ffd->dwFileAttributes & FILE_ATTRIBUTE_ARCHIVE) {
+				fileType = EFT_FILE;
+				return ffd->cFileName;
+			}
+		}
+#else
+		DIR* hDir = (DIR*)nativeHandle;
+		dirent* d;
+		while ((d = readdir(hDir)) != NULL) {
+			bool symlink;
+			int type = _dirent_file_type(hDir, d, symlink);
+			if (type == 0) continue;
+			fileType = (EnumFileType)type;
+			return d->d_name;
+		}
+		return NULL;
+#endif // _WIN32
+	}
+
+	walk_options::walk_options() {
+		filters = EFT_DIR | EFT_FILE;
+		depth = 0;
+		oneFileSystem = false;
+		followSymlinks = false;
+		skipErrors = true;
+		order = TO_DEPTH_FIRST;
+		maxFrontier = 65536;
+		checkpointInterval = 10000;
+	}
+
+	struct _walk_frontier_item {
+		std::string filename;
+		int depth;
+		double score;
+		unsigned long long seq;
+	};
+
+	// Directories waiting to be walked into, in breadth first or priority order.
+	struct _walk_frontier {
+		TraversalOrder order;
+		std::deque<_walk_frontier_item> queue;
+		std::vector<_walk_frontier_item> heap;
+		unsigned long long seq;
+
+		explicit _walk_frontier(TraversalOrder order) : order(order), seq(0) { }
+
+		// Higher scores first, then first come first.
+		static bool lower(const _walk_frontier_item& a, const _walk_frontier_item& b) {
+			if (a.score != b.score) return a.score < b.score;
+			return a.seq > b.seq;
+		}
+
+		size_t size() const {
+			return order == TO_PRIORITY ? heap.size() : queue.size();
+		}
+
+		void push(const std::string& filename, int depth, double score) {
+			_walk_frontier_item item;
+			item.filename = filename;
+			item.depth = depth;
+			item.score = score;
+			item.seq = seq++;
+			if (order == TO_PRIORITY) {
+				heap.push_back(item);
+				std::push_heap(heap.begin(), heap.end(), lower);
+			}
+			else {
+				queue.push_back(item);
+			}
+		}
+
+		bool pop(_walk_frontier_item& item) {
+			if (order == TO_PRIORITY) {
+				if (heap.empty()) return false;
+				std::pop_heap(heap.begin(), heap.end(), lower);
+				item = heap.back();
+				heap.pop_back();
+			}
+			else {
+				if (queue.empty()) return false;
+				item = queue.front();
+				queue.pop_front();
+			}
+			return true;
+		}
+	};
+
+	// Set of (device, inode) with open addressing, inode 0 marks empty slots.
+	struct _inode_set {
+		std::vector<std::pair<unsigned long long, unsigned long long> > slots;
+		size_t count;
+
+		_inode_set() : slots(64), count(0) { }
+
+		// Return false if it was already in the set.
+		bool insert(unsigned long long device, unsigned long long inode) {
+			if (inode == 0) return true;
+			if ((count + 1) * 2 > slots.size()) grow();
+			if (!place(slots, device, inode)) return false;
+			count++;
+			return true;
+		}
+
+		static bool place(std::vector<std::pair<unsigned long long, unsigned long long> >& table, unsigned long long device, unsigned long long inode) {
+			size_t mask = table.size() - 1;
+			size_t i = (size_t)((inode * 0x9E3779B97F4A7C15ULL) ^ (device * 0xC2B2AE3D27D4EB4FULL) ^ (inode >> 29)) & mask;
+			while (table[i].second != 0) {
+				if (table[i].first == device && table[i].second == inode) return false;
+				i = (i + 1) & mask;
+			}
+			table[i] = std::make_pair(device, inode);
+			return true;
+		}
+
+		void grow() {
+			std::vector<std::pair<unsigned long long, unsigned long long> > table(slots.size() * 2);
+			for (size_t i = 0; i < slots.size(); i++) {
+				if (slots[i].second != 0) place(table, slots[i].first, slots[i].second);
+			}
+			slots.swap(table);
+		}
+	};
+
+	recursive_directory_range::recursive_directory_range(const std::string& dirName, int filters /*= EFT_DIR | EFT_FILE*/, int depth /*= 0*/) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		if (depth < 0) throw std::invalid_argument("depth");
+
+		dname = dirName;
+		_Options.filters = filters;
+		_Options.depth = depth;
+		_Options.skipErrors = false;
+		rootDevice = 0;
+		visitedSaved = 0;
+		baseDepth = 0;
+		pulled = 0;
+		started = false;
+		positioned = false;
+		_Finished = false;
+	}
+
+	recursive_directory_range::recursive_directory_range(const std::string& dirName, const walk_options& options) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		if (options.depth < 0) throw std::invalid_argument("depth");
+		if (options.order == TO_PRIORITY && !options.priority) throw std::invalid_argument("priority");
+
+		dname = dirName;
+		_Options = options;
+		if (options.order != TO_DEPTH_FIRST) frontier.reset(new _walk_frontier(options.order));
+		rootDevice = 0;
+		visitedSaved = 0;
+		baseDepth = 0;
+		pulled = 0;
+		started = false;
+		positioned = false;
+		_Finished = false;
+		if (!options.checkpointFile.empty() && _get_path_type(options.checkpointFile) == EFT_FILE) load_checkpoint(options.checkpointFile);
+	}
+
+	recursive_directory_range::~recursive_directory_range() {
+	}
+
+	recursive_directory_range::iterator recursive_directory_range::begin() {
+		if (!positioned) {
+			if (!advance(current)) return iterator();
+			positioned = true;
+		}
+		return iterator(this);
+	}
+
+	recursive_directory_range::iterator recursive_directory_range::end() {
+		return iterator();
+	}
+
+	bool recursive_directory_range::next(directory_entry& entry) {
+		if (positioned) {
+			positioned = false;
+			entry = current;
+			return true;
+		}
+		return advance(entry);
+	}
+
+	bool recursive_directory_range::advance(directory_entry& entry) {
+		if (_Finished) return false;
+
+		// The entries pulled before were processed, now that the next one is asked for.
+		if (!_Options.checkpointFile.empty() && pulled > 0 && pulled % std::max<size_t>(_Options.checkpointInterval, 1) == 0) {
+			write_checkpoint(_Options.checkpointFile, false);
+		}
+
+		bool checkDevices = false;
+#ifndef _WIN32
+		checkDevices = _Options.oneFileSystem || _Options.followSymlinks;
+#endif // _WIN32
+		if (!started) {
+			started = true;
+			pendingDir = dname;
+#ifndef _WIN32
+			if (checkDevices) {
+				struct stat st;
+				if (stat(dname.c_str(), &st) == -1) throw io_exception(errno);
+				rootDevice = (unsigned long long)st.st_dev;
+				visited.reset(new _inode_set());
+				mark_visited(rootDevice, (unsigned long long)st.st_ino);
+			}
+#endif // _WIN32
+		}
+
+		for (;;) {
+			// Open the directory output by the previous call lazily,
+			// so the caller sees a directory before it is walked into.
+			if (!pendingDir.empty()) {
+				std::unique_ptr<file_enumerator> fe(new file_enumerator());
+				if (_Options.filters == EFT_DIR) fe->filters(_Options.filters);
+				std::string dirName;
+				dirName.swap(pendingDir);
+				std::error_code ec;
+				if (fe->begin(dirName, ec)) {
+					stack.push_back(std::move(fe));
+					consumed.push_back(false);
+					stackDirs.push_back(dirName);
+					positions.push_back(0);
+				}
+				else if (ec && ((stack.empty() && baseDepth == 0) || !_Options.skipErrors)) {
+					throw io_exception(ec.value());
+				}
+			}
+
+			if (stack.empty()) {
+				_walk_frontier_item item;
+				if (frontier && frontier->pop(item)) {
+					pendingDir.swap(item.filename);
+					baseDepth = item.depth;
+					continue;
+				}
+				_Finished = true;
+				if (!_Options.checkpointFile.empty()) {
+					remove_file(_Options.checkpointFile);
+					remove_file(_Options.checkpointFile + ".visited");
+				}
+				return false;
+			}
+
+			file_enumerator& fe = *stack.back();
+			if (consumed.back()) {
+				if (!fe.next()) {
+					stack.pop_back();
+					consumed.pop_back();
+					stackDirs.pop_back();
+					positions.pop_back();
+					continue;
+				}
+			}
+			consumed.back() = true;
+			positions.back()++;
+
+			EnumFileType fileType = fe.file_type();
+			bool symlink = fe.is_symlink();
+			int entryDepth = baseDepth + (int)stack.size();
+#ifndef _WIN32
+			if (symlink && _Options.followSymlinks) {
+				// Links to directories are output as directories.
+				struct stat st;
+				if (stat(fe.filename().c_str(), &st) == 0 && S_ISDIR(st.st_mode)) fileType = EFT_DIR;
+			}
+#endif // _WIN32
+			if (_Options.depth == 0 || entryDepth + 1 <= _Options.depth) {
+				bool walkInto = fileType == EFT_DIR && (!symlink || _Options.followSymlinks);
+#ifndef _WIN32
+				if (walkInto && checkDevices) {
+					struct stat st;
+					if (stat(fe.filename().c_str(), &st) == -1) {
+						walkInto = false;
+					}
+					else {
+						if (_Options.oneFileSystem && (unsigned long long)st.st_dev != rootDevice) walkInto = false;
+						if (walkInto && _Options.followSymlinks && !mark_visited((unsigned long long)st.st_dev, (unsigned long long)st.st_ino)) walkInto = false;
+					}
+				}
+#endif // _WIN32
+				if (walkInto) {
+					// Directories wait in the frontier, or are walked into now when it is full.
+					if (frontier && frontier->size() < _Options.maxFrontier) {
+						double score = 0;
+						if (_Options.order == TO_PRIORITY) {
+							directory_entry dir;
+							dir.filename = fe.filename();
+							dir.type = EFT_DIR;
+							dir.depth = entryDepth;
+							dir.symlink = symlink;
+							score = _Options.priority(dir);
+						}
+						frontier->push(fe.filename(), entryDepth, score);
+					}
+					else {
+						pendingDir = fe.filename();
+					}
+				}
+			}
+
+			if (fileType & _Options.filters) {
+				entry.filename = fe.filename();
+				entry.type = fileType;
+				entry.depth = entryDepth;
+				entry.symlink = symlink;
+				pulled++;
+				return true;
+			}
+		}
+	}
+
+	size_t recursive_directory_range::next(std::vector<directory_entry>& entries, size_t count) {
+		entries.clear();
+		directory_entry entry;
+		while (entries.size() < count && next(entry)) {
+			entries.push_back(entry);
+		}
+		return entries.size();
+	}
+
+	bool recursive_directory_range::finished() const {
+		return _Finished && !positioned;
+	}
+
 	static void _get_file_count_by_depth(const std::string& dirName, int filters, int depth, int& currentDepth, int& counter) {
 		if (dirName.empty()) throw std::invalid_argument("dirName");
 		if (depth < 0) throw std::invalid_argument("depth");
@@ -484,18 +1410,108 @@ namespace cx {
 #endif // _WIN32
 	}
 
+#ifndef _WIN32
+	// Read an opened file from its current offset to its end.
+	static void _read_all_fd(int fd, std::vector<unsigned char>& data, std::error_code& ec) noexcept {
+		struct stat st;
+		if (fstat(fd, &st) == -1) {
+			ec.assign(errno, std::system_category());
+			return;
+		}
+		try {
+			data.resize((size_t)st.st_size);
+		}
+		catch (...) {
+			ec = std::make_error_code(std::errc::not_enough_memory);
+			return;
+		}
+		size_t pos = 0;
+		while (pos < data.size()) {
+			ssize_t n = ::read(fd, data.data() + pos, data.size() - pos);
+			if (n == -1 && errno == EINTR) continue;
+			if (n == -1) {
+				ec.assign(errno, std::system_category());
+				break;
+			}
+			if (n == 0) break;
+			pos += (size_t)n;
+		}
+		data.resize(pos);
+	}
+
+	// Write all bytes to an opened file.
+	static void _write_all_fd(int fd, const unsigned char* data, size_t length, std::error_code& ec) noexcept {
+		while (length > 0) {
+			ssize_t n = ::write(fd, data, length);
+			if (n == -1 && errno == EINTR) continue;
+			if (n <= 0) {
+				ec.assign(n == -1 ? errno : EIO, std::system_category());
+				break;
+			}
+			data += n;
+			length -= (size_t)n;
+		}
+	}
+#endif // _WIN32
+
 	void read_all_bytes(const std::string& filename, std::vector<unsigned char>& data) {
 		if (filename.empty()) throw std::invalid_argument("filename");
 
-		std::ifstream ifs;
-		// ifs.exceptions(std::ios::failbit);
-		ifs.open(filename, std::ios::binary | std::ios::ate);
-		if (!ifs.is_open()) throw io_exception();
+		std::error_code ec;
+		read_all_bytes(filename, data, ec);
+		if (ec == std::errc::not_enough_memory) throw std::bad_alloc();
+		if (ec) throw io_exception(ec.value());
+	}
+
+	void read_all_bytes(const std::string& filename, std::vector<unsigned char>& data, std::error_code& ec) noexcept {
+		ec.clear();
+		if (filename.empty()) {
+			ec = std::make_error_code(std::errc::invalid_argument);
+			return;
+		}
 
-		std::ifstream::pos_type pos = ifs.tellg();
-		data.resize((size_t)pos);
-		ifs.seekg(0, std::ios::beg);
-		ifs.read((char*)data.data(), (size_t)pos);
+#ifdef _WIN32
+		HANDLE hFile = ::CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile == INVALID_HANDLE_VALUE) {
+			ec.assign((int)::GetLastError(), std::system_category());
+			return;
+		}
+		LARGE_INTEGER size;
+		if (!::GetFileSizeEx(hFile, &size)) {
+			ec.assign((int)::GetLastError(), std::system_category());
+			::CloseHandle(hFile);
+			return;
+		}
+		try {
+			data.resize((size_t)size.QuadPart);
+		}
+		catch (...) {
+			ec = std::make_error_code(std::errc::not_enough_memory);
+			::CloseHandle(hFile);
+			return;
+		}
+		size_t pos = 0;
+		while (pos < data.size()) {
+			DWORD n = 0;
+			if (!::ReadFile(hFile, data.data() + pos, (DWORD)std::min<size_t>(data.size() - pos, 0x40000000), &n, NULL)) {
+				ec.assign((int)::GetLastError(), std::system_category());
+				break;
+			}
+			if (n == 0) break;
+			pos += n;
+		}
+		::CloseHandle(hFile);
+		data.resize(pos);
+#else
+		int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			ec.assign(errno, std::system_category());
+			return;
+		}
+		_read_all_fd(fd, data, ec);
+		::close(fd);
+#endif // _WIN32
 	}
 
 	void write_all_bytes(const std::string& filename, const std::vector<unsigned char>& data, bool bAppend /*= false*/) {
@@ -506,16 +1522,4326 @@ namespace cx {
 
 	void write_all_bytes(const std::string& filename, const unsigned char* data, size_t length, bool bAppend /*= false*/) {
 		if (filename.empty()) throw std::invalid_argument("filename");
-		 
-		std::ofstream ofs;
-		// ofs.exceptions(std::ios::failbit);
-		if (bAppend)
-			ofs.open(filename, std::ios::binary | std::ios::ate | std::ios::app);
-		else
-			ofs.open(filename, std::ios::binary | std::ios::ate | std::ios::out);
 
-		if (!ofs.is_open()) throw io_exception();
-		ofs.write((char*)data, length);
+		std::error_code ec;
+		write_all_bytes(filename, data, length, bAppend, ec);
+		if (ec) throw io_exception(ec.value());
+	}
+
+	void write_all_bytes(const std::string& filename, const std::vector<unsigned char>& data, bool bAppend, std::error_code& ec) noexcept {
+		write_all_bytes(filename, data.data(), data.size(), bAppend, ec);
+	}
+
+	void write_all_bytes(const std::string& filename, const unsigned char* data, size_t length, bool bAppend, std::error_code& ec) noexcept {
+		ec.clear();
+		if (filename.empty()) {
+			ec = std::make_error_code(std::errc::invalid_argument);
+			return;
+		}
+
+#ifdef _WIN32
+		HANDLE hFile = ::CreateFileA(filename.c_str(), bAppend ? FILE_APPEND_DATA : GENERIC_WRITE, FILE_SHARE_READ,
+			NULL, bAppend ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE) {
+			ec.assign((int)::GetLastError(), std::system_category());
+			return;
+		}
+		_invalidate_metadata_caches(filename, false);
+		while (length > 0) {
+			DWORD n = 0;
+			if (!::WriteFile(hFile, data, (DWORD)std::min<size_t>(length, 0x40000000), &n, NULL)) {
+				ec.assign((int)::GetLastError(), std::system_category());
+				break;
+			}
+			data += n;
+			length -= n;
+		}
+		::CloseHandle(hFile);
+#else
+		int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (bAppend ? O_APPEND : O_TRUNC), 0666);
+		if (fd == -1) {
+			ec.assign(errno, std::system_category());
+			return;
+		}
+		_invalidate_metadata_caches(filename, false);
+		_write_all_fd(fd, data, length, ec);
+		if (::close(fd) == -1 && !ec) ec.assign(errno, std::system_category());
+#endif // _WIN32
+	}
+
+	template<class T>
+	class _blocking_queue {
+	public:
+		_blocking_queue(size_t capacity) : capacity(capacity), closed(false) { }
+
+		bool push(const T& item) {
+			std::unique_lock<std::mutex> lock(mutex);
+			notFull.wait(lock, [this]() { return closed || items.size() < capacity; });
+			if (closed) return false;
+			items.push_back(item);
+			notEmpty.notify_one();
+			return true;
+		}
+
+		bool pop(T& item) {
+			std::unique_lock<std::mutex> lock(mutex);
+			notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+			if (items.empty()) return false;
+			item = items.front();
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		// Stop accepting items, the queued items can still be popped.
+		void close() {
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			notFull.notify_all();
+			notEmpty.notify_all();
+		}
+
+		// Stop accepting items and drop the queued items.
+		void abort() {
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			items.clear();
+			notFull.notify_all();
+			notEmpty.notify_all();
+		}
+	private:
+		std::mutex mutex;
+		std::condition_variable notFull;
+		std::condition_variable notEmpty;
+		std::deque<T> items;
+		size_t capacity;
+		bool closed;
+	};
+
+	// A fixed set of reusable buffers, acquire blocks until one is returned.
+	class _buffer_recycler {
+	public:
+		_buffer_recycler(size_t count) : buffers(count), aborted(false) {
+			for (size_t i = 0; i < count; i++) freeList.push_back(&buffers[i]);
+		}
+
+		std::vector<unsigned char>* acquire() {
+			std::unique_lock<std::mutex> lock(mutex);
+			available.wait(lock, [this]() { return aborted || !freeList.empty(); });
+			if (aborted) return NULL;
+			std::vector<unsigned char>* buffer = freeList.back();
+			freeList.pop_back();
+			return buffer;
+		}
+
+		void release(std::vector<unsigned char>* buffer) {
+			std::lock_guard<std::mutex> lock(mutex);
+			freeList.push_back(buffer);
+			available.notify_one();
+		}
+
+		void abort() {
+			std::lock_guard<std::mutex> lock(mutex);
+			aborted = true;
+			available.notify_all();
+		}
+	private:
+		std::vector<std::vector<unsigned char> > buffers;
+		std::vector<std::vector<unsigned char>*> freeList;
+		std::mutex mutex;
+		std::condition_variable available;
+		bool aborted;
+	};
+
+	pipeline_options::pipeline_options() {
+		readThreads = 2;
+		processThreads = (int)std::thread::hardware_concurrency();
+		if (processThreads < 1) processThreads = 1;
+		queueSize = 64;
+		bufferCount = 0;
+	}
+
+	struct _pipeline_item {
+		std::string filename;
+		std::vector<unsigned char>* buffer;
+	};
+
+	class _file_pipeline {
+	public:
+		_file_pipeline(process_files_callback callbackFun, const pipeline_options& options)
+			: callbackFun(callbackFun),
+			readThreads(options.readThreads < 1 ? 1 : options.readThreads),
+			processThreads(options.processThreads < 1 ? 1 : options.processThreads),
+			queueSize(options.queueSize < 1 ? 1 : options.queueSize),
+			names(queueSize),
+			contents(queueSize),
+			buffers(options.bufferCount > 0 ? options.bufferCount : readThreads + processThreads + queueSize),
+			cancelled(false),
+			runningReaders(readThreads) {
+		}
+
+		void start() {
+			for (int i = 0; i < readThreads; i++) threads.push_back(std::thread(&_file_pipeline::read_loop, this));
+			for (int i = 0; i < processThreads; i++) threads.push_back(std::thread(&_file_pipeline::process_loop, this));
+		}
+
+		// Feed a file name to the read stage, blocks when the queue is full.
+		bool feed(const std::string& filename) {
+			if (cancelled) return false;
+			return names.push(filename);
+		}
+
+		// Wait for all stages to finish, and rethrow the first error.
+		void finish() {
+			names.close();
+			for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+			threads.clear();
+			if (error) std::rethrow_exception(error);
+		}
+
+		void fail(std::exception_ptr e) {
+			{
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error) error = e;
+			}
+			cancel();
+		}
+
+		void cancel() {
+			cancelled = true;
+			names.abort();
+			contents.abort();
+			buffers.abort();
+		}
+	private:
+		void read_loop() {
+			std::string filename;
+			while (names.pop(filename)) {
+				std::vector<unsigned char>* buffer = buffers.acquire();
+				if (buffer == NULL) break;
+
+				try {
+					read_all_bytes(filename, *buffer);
+				} catch (...) {
+					buffers.release(buffer);
+					fail(std::current_exception());
+					break;
+				}
+
+				_pipeline_item item;
+				item.filename = filename;
+				item.buffer = buffer;
+				if (!contents.push(item)) {
+					buffers.release(buffer);
+					break;
+				}
+			}
+
+			if (--runningReaders == 0) contents.close();
+		}
+
+		void process_loop() {
+			_pipeline_item item;
+			while (contents.pop(item)) {
+				bool cancelEnum = false;
+				try {
+					callbackFun(item.filename, item.buffer->data(), item.buffer->size(), cancelEnum);
+				} catch (...) {
+					buffers.release(item.buffer);
+					fail(std::current_exception());
+					break;
+				}
+
+				// Do not keep huge buffers around for the following small files.
+				if (item.buffer->capacity() > MAX_RECYCLED_BUFFER_SIZE) std::vector<unsigned char>().swap(*item.buffer);
+				buffers.release(item.buffer);
+
+				if (cancelEnum) {
+					cancel();
+					break;
+				}
+			}
+		}
+
+		static const size_t MAX_RECYCLED_BUFFER_SIZE = 64 * 1024 * 1024;
+
+		process_files_callback callbackFun;
+		int readThreads;
+		int processThreads;
+		size_t queueSize;
+		_blocking_queue<std::string> names;
+		_blocking_queue<_pipeline_item> contents;
+		_buffer_recycler buffers;
+		std::atomic<bool> cancelled;
+		std::atomic<int> runningReaders;
+		std::vector<std::thread> threads;
+		std::mutex errorMutex;
+		std::exception_ptr error;
+	};
+
+	void process_files(const std::vector<std::string>& files, process_files_callback callbackFun, const pipeline_options& options /*= pipeline_options()*/) {
+		_file_pipeline pipeline(callbackFun, options);
+		pipeline.start();
+		for (size_t i = 0; i < files.size(); i++) {
+			if (!pipeline.feed(files[i])) break;
+		}
+		pipeline.finish();
+	}
+
+	void process_all_files(const std::string& dirName, process_files_callback callbackFun, const pipeline_options& options /*= pipeline_options()*/) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+
+		_file_pipeline pipeline(callbackFun, options);
+		pipeline.start();
+		try {
+			recursive_directory_range range(dirName, EFT_FILE);
+			directory_entry entry;
+			while (range.next(entry)) {
+				if (!pipeline.feed(entry.filename)) break;
+			}
+		} catch (...) {
+			pipeline.fail(std::current_exception());
+		}
+		pipeline.finish();
+	}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CX_TARGET(features) __attribute__((target(features)))
+#else
+#define CX_TARGET(features)
+#endif
+
+	static bool _cpu_has_crc32c() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 20)) != 0;
+#else
+		unsigned int eax, ebx, ecx, edx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+		return (ecx & bit_SSE4_2) != 0;
+#endif // _MSC_VER
+#elif defined(__aarch64__) && defined(__linux__)
+		return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+		return false;
+#endif
+	}
+
+	static bool _cpu_has_sha() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 9)) == 0 || (info[2] & (1 << 19)) == 0) return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 29)) != 0;
+#else
+		unsigned int eax, ebx, ecx, edx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+		if ((ecx & bit_SSSE3) == 0 || (ecx & bit_SSE4_1) == 0) return false;
+		if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+		return (ebx & (1 << 29)) != 0;
+#endif // _MSC_VER
+#else
+		return false;
+#endif
+	}
+
+	static const uint32_t CRC32C_POLY = 0x82F63B78;
+
+	struct _crc32c_tables {
+		uint32_t t[8][256];
+
+		_crc32c_tables() {
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; k++) c = (c >> 1) ^ (CRC32C_POLY & (0 - (c & 1)));
+				t[0][i] = c;
+			}
+			for (uint32_t i = 0; i < 256; i++) {
+				for (int k = 1; k < 8; k++) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+			}
+		}
+	};
+
+	static uint32_t _crc32c_sw(uint32_t crc, const unsigned char* p, size_t n) {
+		static const _crc32c_tables tables;
+		const uint32_t (*t)[256] = tables.t;
+
+		// slicing-by-8
+		while (n >= 8) {
+			uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+			uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+			crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+				t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+			p += 8;
+			n -= 8;
+		}
+		while (n-- > 0) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+		return crc;
+	}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	CX_TARGET("sse4.2")
+	static uint32_t _crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+#if defined(__x86_64__) || defined(_M_X64)
+		uint64_t c = crc;
+		while (n >= 8) {
+			uint64_t v;
+			memcpy(&v, p, 8);
+			c = _mm_crc32_u64(c, v);
+			p += 8;
+			n -= 8;
+		}
+		crc = (uint32_t)c;
+#endif
+		while (n >= 4) {
+			uint32_t v;
+			memcpy(&v, p, 4);
+			crc = _mm_crc32_u32(crc, v);
+			p += 4;
+			n -= 4;
+		}
+		while (n-- > 0) crc = _mm_crc32_u8(crc, *p++);
+		return crc;
+	}
+#elif defined(__aarch64__) && defined(__linux__)
+	CX_TARGET("+crc")
+	static uint32_t _crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+		while (n >= 8) {
+			uint64_t v;
+			memcpy(&v, p, 8);
+			crc = __crc32cd(crc, v);
+			p += 8;
+			n -= 8;
+		}
+		while (n-- > 0) crc = __crc32cb(crc, *p++);
+		return crc;
+	}
+#else
+	static uint32_t _crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+		return _crc32c_sw(crc, p, n);
+	}
+#endif
+
+	typedef uint32_t (*_crc32c_function)(uint32_t crc, const unsigned char* p, size_t n);
+
+	static uint32_t _crc32c(uint32_t crc, const unsigned char* p, size_t n) {
+		static const _crc32c_function f = _cpu_has_crc32c() ? _crc32c_hw : _crc32c_sw;
+		return ~f(~crc, p, n);
+	}
+
+	static const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+	static const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+	static const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+	static const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+	static const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+	static inline uint64_t _rotl64(uint64_t x, int r) {
+		return (x << r) | (x >> (64 - r));
+	}
+
+	static inline uint64_t _read64le(const unsigned char* p) {
+		uint64_t v = 0;
+		for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+		return v;
+	}
+
+	static inline uint32_t _read32le(const unsigned char* p) {
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	static inline uint64_t _xxh64_round(uint64_t acc, uint64_t input) {
+		acc += input * XXH_PRIME64_2;
+		acc = _rotl64(acc, 31);
+		return acc * XXH_PRIME64_1;
+	}
+
+	static inline uint64_t _xxh64_merge_round(uint64_t acc, uint64_t val) {
+		acc ^= _xxh64_round(0, val);
+		return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+
+	struct _xxh64_state {
+		uint64_t v[4];
+		uint64_t totalLength;
+		unsigned char mem[32];
+		size_t memSize;
+
+		void reset() {
+			v[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+			v[1] = XXH_PRIME64_2;
+			v[2] = 0;
+			v[3] = 0 - XXH_PRIME64_1;
+			totalLength = 0;
+			memSize = 0;
+		}
+
+		void stripe(const unsigned char* p) {
+			for (int i = 0; i < 4; i++) v[i] = _xxh64_round(v[i], _read64le(p + i * 8));
+		}
+
+		void update(const unsigned char* p, size_t n) {
+			totalLength += n;
+			if (memSize + n < 32) {
+				memcpy(mem + memSize, p, n);
+				memSize += n;
+				return;
+			}
+			if (memSize > 0) {
+				size_t fill = 32 - memSize;
+				memcpy(mem + memSize, p, fill);
+				stripe(mem);
+				p += fill;
+				n -= fill;
+				memSize = 0;
+			}
+			while (n >= 32) {
+				stripe(p);
+				p += 32;
+				n -= 32;
+			}
+			memcpy(mem, p, n);
+			memSize = n;
+		}
+
+		uint64_t digest() const {
+			uint64_t h;
+			if (totalLength >= 32) {
+				h = _rotl64(v[0], 1) + _rotl64(v[1], 7) + _rotl64(v[2], 12) + _rotl64(v[3], 18);
+				for (int i = 0; i < 4; i++) h = _xxh64_merge_round(h, v[i]);
+			} else {
+				h = v[2] + XXH_PRIME64_5;
+			}
+			h += totalLength;
+
+			const unsigned char* p = mem;
+			size_t n = memSize;
+			while (n >= 8) {
+				h ^= _xxh64_round(0, _read64le(p));
+				h = _rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+				p += 8;
+				n -= 8;
+			}
+			if (n >= 4) {
+				h ^= (uint64_t)_read32le(p) * XXH_PRIME64_1;
+				h = _rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+				p += 4;
+				n -= 4;
+			}
+			while (n-- > 0) {
+				h ^= (*p++) * XXH_PRIME64_5;
+				h = _rotl64(h, 11) * XXH_PRIME64_1;
+			}
+
+			h ^= h >> 33;
+			h *= XXH_PRIME64_2;
+			h ^= h >> 29;
+			h *= XXH_PRIME64_3;
+			h ^= h >> 32;
+			return h;
+		}
+	};
+
+	static const uint32_t SHA256_K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	static inline uint32_t _rotr32(uint32_t x, int r) {
+		return (x >> r) | (x << (32 - r));
+	}
+
+	static void _sha256_blocks_sw(uint32_t state[8], const unsigned char* p, size_t blocks) {
+		for (; blocks > 0; blocks--, p += 64) {
+			uint32_t w[64];
+			for (int i = 0; i < 16; i++) {
+				w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) | ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+			}
+			for (int i = 16; i < 64; i++) {
+				uint32_t s0 = _rotr32(w[i - 15], 7) ^ _rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				uint32_t s1 = _rotr32(w[i - 2], 17) ^ _rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+			for (int i = 0; i < 64; i++) {
+				uint32_t s1 = _rotr32(e, 6) ^ _rotr32(e, 11) ^ _rotr32(e, 25);
+				uint32_t ch = (e & f) ^ (~e & g);
+				uint32_t t1 = h + s1 + ch + SHA256_K[i] + w[i];
+				uint32_t s0 = _rotr32(a, 2) ^ _rotr32(a, 13) ^ _rotr32(a, 22);
+				uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+				uint32_t t2 = s0 + maj;
+				h = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+			state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+			state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		}
+	}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	CX_TARGET("sha,sse4.1,ssse3")
+	static void _sha256_blocks_hw(uint32_t state[8], const unsigned char* p, size_t blocks) {
+		const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+		// The SHA-NI rounds work on the ABEF and CDGH halves of the state.
+		__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+		__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+		__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+		state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+		for (; blocks > 0; blocks--, p += 64) {
+			__m128i abefSave = state0;
+			__m128i cdghSave = state1;
+			__m128i msg[4];
+
+			for (int i = 0; i < 16; i++) {
+				__m128i m;
+				if (i < 4) {
+					m = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + i * 16)), mask);
+				} else {
+					m = _mm_sha256msg1_epu32(msg[i & 3], msg[(i + 1) & 3]);
+					m = _mm_add_epi32(m, _mm_alignr_epi8(msg[(i + 3) & 3], msg[(i + 2) & 3], 4));
+					m = _mm_sha256msg2_epu32(m, msg[(i + 3) & 3]);
+				}
+				msg[i & 3] = m;
+
+				tmp = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)&SHA256_K[i * 4]));
+				state1 = _mm_sha256rnds2_epu32(state1, state0, tmp);
+				tmp = _mm_shuffle_epi32(tmp, 0x0E);
+				state0 = _mm_sha256rnds2_epu32(state0, state1, tmp);
+			}
+
+			state0 = _mm_add_epi32(state0, abefSave);
+			state1 = _mm_add_epi32(state1, cdghSave);
+		}
+
+		tmp = _mm_shuffle_epi32(state0, 0x1B);
+		state1 = _mm_shuffle_epi32(state1, 0xB1);
+		state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+		state1 = _mm_alignr_epi8(state1, tmp, 8);
+		_mm_storeu_si128((__m128i*)&state[0], state0);
+		_mm_storeu_si128((__m128i*)&state[4], state1);
+	}
+#else
+	static void _sha256_blocks_hw(uint32_t state[8], const unsigned char* p, size_t blocks) {
+		_sha256_blocks_sw(state, p, blocks);
+	}
+#endif
+
+	typedef void (*_sha256_blocks_function)(uint32_t state[8], const unsigned char* p, size_t blocks);
+
+	static void _sha256_blocks(uint32_t state[8], const unsigned char* p, size_t blocks) {
+		static const _sha256_blocks_function f = _cpu_has_sha() ? _sha256_blocks_hw : _sha256_blocks_sw;
+		f(state, p, blocks);
+	}
+
+	struct _sha256_state {
+		uint32_t h[8];
+		uint64_t totalLength;
+		unsigned char mem[64];
+		size_t memSize;
+
+		void reset() {
+			static const uint32_t init[8] = {
+				0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+			};
+			memcpy(h, init, sizeof(h));
+			totalLength = 0;
+			memSize = 0;
+		}
+
+		void update(const unsigned char* p, size_t n) {
+			totalLength += n;
+			if (memSize > 0) {
+				size_t fill = 64 - memSize;
+				if (n < fill) {
+					memcpy(mem + memSize, p, n);
+					memSize += n;
+					return;
+				}
+				memcpy(mem + memSize, p, fill);
+				_sha256_blocks(h, mem, 1);
+				p += fill;
+				n -= fill;
+				memSize = 0;
+			}
+			if (n >= 64) {
+				_sha256_blocks(h, p, n / 64);
+				p += n / 64 * 64;
+				n %= 64;
+			}
+			memcpy(mem, p, n);
+			memSize = n;
+		}
+
+		void digest(unsigned char out[32]) const {
+			_sha256_state s = *this;
+			uint64_t bits = totalLength * 8;
+			unsigned char pad[72] = { 0x80 };
+			size_t padLength = (memSize < 56 ? 56 : 120) - memSize;
+			for (int i = 0; i < 8; i++) pad[padLength + i] = (unsigned char)(bits >> (56 - i * 8));
+			s.update(pad, padLength + 8);
+			for (int i = 0; i < 8; i++) {
+				out[i * 4] = (unsigned char)(s.h[i] >> 24);
+				out[i * 4 + 1] = (unsigned char)(s.h[i] >> 16);
+				out[i * 4 + 2] = (unsigned char)(s.h[i] >> 8);
+				out[i * 4 + 3] = (unsigned char)s.h[i];
+			}
+		}
+	};
+
+	struct _hasher_impl {
+		HashAlgorithm algorithm;
+		uint32_t crc;
+		_xxh64_state xxh;
+		_sha256_state sha;
+	};
+
+	static std::string _to_hex(const unsigned char* p, size_t n) {
+		static const char digits[] = "0123456789abcdef";
+		std::string s(n * 2, '0');
+		for (size_t i = 0; i < n; i++) {
+			s[i * 2] = digits[p[i] >> 4];
+			s[i * 2 + 1] = digits[p[i] & 0xF];
+		}
+		return s;
+	}
+
+	hasher::hasher(HashAlgorithm algorithm) {
+		if (algorithm != HA_CRC32C && algorithm != HA_XXH64 && algorithm != HA_SHA256) throw std::invalid_argument("algorithm");
+		impl = new _hasher_impl();
+		impl->algorithm = algorithm;
+		reset();
+	}
+
+	hasher::~hasher() {
+		delete impl;
+	}
+
+	void hasher::update(const unsigned char* data, size_t length) {
+		switch (impl->algorithm) {
+		case HA_CRC32C: impl->crc = _crc32c(impl->crc, data, length); break;
+		case HA_XXH64: impl->xxh.update(data, length); break;
+		case HA_SHA256: impl->sha.update(data, length); break;
+		}
+	}
+
+	std::string hasher::digest() const {
+		unsigned char out[32];
+		switch (impl->algorithm) {
+		case HA_CRC32C:
+			for (int i = 0; i < 4; i++) out[i] = (unsigned char)(impl->crc >> (24 - i * 8));
+			return _to_hex(out, 4);
+		case HA_XXH64: {
+			uint64_t h = impl->xxh.digest();
+			for (int i = 0; i < 8; i++) out[i] = (unsigned char)(h >> (56 - i * 8));
+			return _to_hex(out, 8);
+		}
+		default:
+			impl->sha.digest(out);
+			return _to_hex(out, 32);
+		}
+	}
+
+	void hasher::reset() {
+		impl->crc = 0;
+		impl->xxh.reset();
+		impl->sha.reset();
+	}
+
+	std::string hash_bytes(const unsigned char* data, size_t length, HashAlgorithm algorithm /*= HA_SHA256*/) {
+		hasher h(algorithm);
+		h.update(data, length);
+		return h.digest();
+	}
+
+	static const size_t HASH_CHUNK_SIZE = 1024 * 1024;
+
+	static void _hash_file(const std::string& filename, hasher& h, std::vector<unsigned char>& buffer) {
+		std::ifstream ifs;
+		ifs.open(filename, std::ios::binary);
+		if (!ifs.is_open()) throw io_exception();
+
+		buffer.resize(HASH_CHUNK_SIZE);
+		while (ifs) {
+			ifs.read((char*)buffer.data(), buffer.size());
+			std::streamsize n = ifs.gcount();
+			if (n <= 0) break;
+			h.update(buffer.data(), (size_t)n);
+		}
+		if (ifs.bad()) throw io_exception();
+	}
+
+	std::string hash_file(const std::string& filename, HashAlgorithm algorithm /*= HA_SHA256*/) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+
+		hasher h(algorithm);
+		std::vector<unsigned char> buffer;
+		_hash_file(filename, h, buffer);
+		return h.digest();
+	}
+
+	void hash_tree(const std::string& dirName, std::vector<file_hash>& hashes, HashAlgorithm algorithm /*= HA_SHA256*/, int threads /*= 0*/) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		hasher check(algorithm);
+
+		if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+		if (threads <= 0) threads = 1;
+
+		hashes.clear();
+		std::mutex mutex;
+		std::exception_ptr error;
+		_blocking_queue<std::string> names(threads * 16);
+
+		std::vector<std::thread> workers;
+		for (int i = 0; i < threads; i++) {
+			workers.push_back(std::thread([&]() {
+				hasher h(algorithm);
+				std::vector<unsigned char> buffer;
+				file_hash result;
+				while (names.pop(result.filename)) {
+					try {
+						h.reset();
+						_hash_file(result.filename, h, buffer);
+						result.digest = h.digest();
+						std::lock_guard<std::mutex> lock(mutex);
+						hashes.push_back(result);
+					} catch (...) {
+						std::lock_guard<std::mutex> lock(mutex);
+						if (!error) error = std::current_exception();
+						names.abort();
+						break;
+					}
+				}
+			}));
+		}
+
+		try {
+			recursive_directory_range range(dirName, EFT_FILE);
+			directory_entry entry;
+			while (range.next(entry)) {
+				if (!names.push(entry.filename)) break;
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error) error = std::current_exception();
+			names.abort();
+		}
+		names.close();
+		for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+		if (error) std::rethrow_exception(error);
+
+		std::sort(hashes.begin(), hashes.end(), [](const file_hash& a, const file_hash& b) { return a.filename < b.filename; });
+	}
+
+	// Run task(0) .. task(count - 1) on worker threads, the first exception is rethrown.
+	static void _parallel_for(size_t count, int threads, const std::function<void(size_t)>& task) {
+		if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+		if (threads <= 0) threads = 1;
+		if ((size_t)threads > count) threads = (int)count;
+
+		std::atomic<size_t> index(0);
+		std::mutex mutex;
+		std::exception_ptr error;
+		auto work = [&]() {
+			for (;;) {
+				size_t i = index++;
+				if (i >= count) return;
+				try {
+					task(i);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(mutex);
+					if (!error) error = std::current_exception();
+					index = count;
+					return;
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (int i = 1; i < threads; i++) workers.push_back(std::thread(work));
+		work();
+		for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+		if (error) std::rethrow_exception(error);
+	}
+
+	static const size_t DUPLICATE_PROBE_SIZE = 4096;
+
+	struct _duplicate_candidate {
+		std::vector<std::string> names;
+		unsigned long long size;
+		std::string digest;
+		bool failed;
+	};
+
+	// Hash the first and last DUPLICATE_PROBE_SIZE bytes, which is the whole file for small files.
+	// XXH64 only sorts out the large files which differ, the whole content of the small ones is hashed
+	// with SHA-256 at once, as the second pass would do, since a XXH64 collision can be crafted.
+	static bool _hash_file_ends(const std::string& filename, unsigned long long size, std::string& digest, unsigned long long& bytesRead) {
+		std::ifstream ifs;
+		ifs.open(filename, std::ios::binary);
+		if (!ifs.is_open()) return false;
+
+		unsigned char buffer[DUPLICATE_PROBE_SIZE];
+		hasher h(size <= DUPLICATE_PROBE_SIZE * 2 ? HA_SHA256 : HA_XXH64);
+		size_t head = (size_t)std::min<unsigned long long>(size, DUPLICATE_PROBE_SIZE);
+		ifs.read((char*)buffer, head);
+		if ((size_t)ifs.gcount() != head) return false;
+		h.update(buffer, head);
+		bytesRead += head;
+
+		if (size > DUPLICATE_PROBE_SIZE) {
+			unsigned long long tailStart = std::max<unsigned long long>(size - DUPLICATE_PROBE_SIZE, DUPLICATE_PROBE_SIZE);
+			size_t tail = (size_t)(size - tailStart);
+			ifs.seekg((std::streamoff)tailStart, std::ios::beg);
+			ifs.read((char*)buffer, tail);
+			if ((size_t)ifs.gcount() != tail) return false;
+			h.update(buffer, tail);
+			bytesRead += tail;
+		}
+
+		digest = h.digest();
+		return true;
+	}
+
+	// Split the candidates into groups with equal digest, groups of one are dropped.
+	static void _regroup_by_digest(std::vector<std::vector<_duplicate_candidate> >& groups) {
+		std::vector<std::vector<_duplicate_candidate> > output;
+		for (size_t g = 0; g < groups.size(); g++) {
+			std::map<std::string, std::vector<_duplicate_candidate> > byDigest;
+			for (size_t i = 0; i < groups[g].size(); i++) {
+				if (groups[g][i].failed) continue;
+				byDigest[groups[g][i].digest].push_back(groups[g][i]);
+			}
+			for (auto i = byDigest.begin(); i != byDigest.end(); ++i) {
+				size_t names = 0;
+				for (size_t k = 0; k < i->second.size(); k++) names += i->second[k].names.size();
+				if (names > 1) output.push_back(i->second);
+			}
+		}
+		groups.swap(output);
+	}
+
+	unsigned long long find_duplicates(const std::string& dirName, std::vector<std::vector<std::string> >& groups, int threads /*= 0*/) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		groups.clear();
+
+		// group by size, and hard links by inode.
+		std::map<unsigned long long, std::map<std::pair<unsigned long long, unsigned long long>, std::vector<std::string> > > bySize;
+		enum_all_files_status(dirName, [&bySize](const file_status& status, bool& cancelEnum) {
+				std::pair<unsigned long long, unsigned long long> id(status.device, status.inode);
+#ifdef _WIN32
+				// no inode on Windows, keep every file apart.
+				id.second = bySize[status.size].size();
+#endif // _WIN32
+				bySize[status.size][id].push_back(status.filename);
+			}, EFT_FILE
+		);
+
+		std::vector<std::vector<_duplicate_candidate> > candidateGroups;
+		for (auto i = bySize.begin(); i != bySize.end(); ++i) {
+			std::vector<_duplicate_candidate> group;
+			size_t names = 0;
+			for (auto k = i->second.begin(); k != i->second.end(); ++k) {
+				_duplicate_candidate c;
+				c.names = k->second;
+				c.size = i->first;
+				c.failed = false;
+				names += c.names.size();
+				group.push_back(c);
+			}
+			if (names > 1) candidateGroups.push_back(group);
+		}
+
+		std::atomic<unsigned long long> totalRead(0);
+		for (int pass = 0; pass < 2; pass++) {
+			std::vector<_duplicate_candidate*> tasks;
+			for (size_t g = 0; g < candidateGroups.size(); g++) {
+				std::vector<_duplicate_candidate>& group = candidateGroups[g];
+				// a single inode, or empty files, need no reading.
+				if (group.size() == 1 || group[0].size == 0) continue;
+				// the first pass already hashed the whole content of small files with SHA-256.
+				if (pass == 1 && group[0].size <= DUPLICATE_PROBE_SIZE * 2) continue;
+				for (size_t i = 0; i < group.size(); i++) tasks.push_back(&group[i]);
+			}
+
+			_parallel_for(tasks.size(), threads, [&](size_t i) {
+				_duplicate_candidate& c = *tasks[i];
+				unsigned long long bytesRead = 0;
+				if (pass == 0) {
+					c.failed = !_hash_file_ends(c.names[0], c.size, c.digest, bytesRead);
+				} else {
+					try {
+						hasher h(HA_SHA256);
+						std::vector<unsigned char> buffer;
+						_hash_file(c.names[0], h, buffer);
+						c.digest = h.digest();
+						bytesRead = c.size;
+					} catch (const io_exception&) {
+						c.failed = true;
+					}
+				}
+				totalRead += bytesRead;
+			});
+
+			_regroup_by_digest(candidateGroups);
+		}
+
+		for (size_t g = 0; g < candidateGroups.size(); g++) {
+			std::vector<std::string> names;
+			for (size_t i = 0; i < candidateGroups[g].size(); i++) {
+				names.insert(names.end(), candidateGroups[g][i].names.begin(), candidateGroups[g][i].names.end());
+			}
+			std::sort(names.begin(), names.end());
+			groups.push_back(names);
+		}
+		std::sort(groups.begin(), groups.end());
+		return totalRead;
+	}
+
+	// A read-only view of a whole file, memory mapped when possible.
+	class _mapped_file {
+	public:
+		_mapped_file() : view(NULL), length(0), mapped(false) { }
+
+		~_mapped_file() {
+			close();
+		}
+
+		bool open(const std::string& filename) {
+			close();
+#ifdef _WIN32
+			HANDLE hFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (hFile == INVALID_HANDLE_VALUE) return false;
+
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(hFile, &size)) {
+				CloseHandle(hFile);
+				return false;
+			}
+			length = (size_t)size.QuadPart;
+			if (length > 0) {
+				HANDLE hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+				if (hMap != NULL) {
+					view = (const unsigned char*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+					CloseHandle(hMap);
+				}
+				mapped = view != NULL;
+			}
+			CloseHandle(hFile);
+#else
+			int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd == -1) return false;
+
+			struct stat st;
+			if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+				::close(fd);
+				return false;
+			}
+			length = (size_t)st.st_size;
+			if (length > 0) {
+				void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p != MAP_FAILED) {
+					view = (const unsigned char*)p;
+					mapped = true;
+				}
+			}
+			::close(fd);
+#endif // _WIN32
+
+			if (length > 0 && !mapped) {
+				// Some files cannot be mapped, read them instead.
+				try {
+					read_all_bytes(filename, buffer);
+				} catch (const io_exception&) {
+					return false;
+				}
+				view = buffer.data();
+				length = buffer.size();
+			}
+			return true;
+		}
+
+		void close() {
+			if (mapped) {
+#ifdef _WIN32
+				UnmapViewOfFile(view);
+#else
+				munmap((void*)view, length);
+#endif // _WIN32
+			}
+			std::vector<unsigned char>().swap(buffer);
+			view = NULL;
+			length = 0;
+			mapped = false;
+		}
+
+		const unsigned char* data() const {
+			return view;
+		}
+
+		size_t size() const {
+			return length;
+		}
+	private:
+		const unsigned char* view;
+		size_t length;
+		bool mapped;
+		std::vector<unsigned char> buffer;
+	public:
+		_mapped_file(const _mapped_file&) = delete;
+		_mapped_file& operator=(const _mapped_file&) = delete;
+	};
+
+	// Literal matcher: memchr on the rarest byte for one pattern, Aho-Corasick for several.
+	class _literal_matcher {
+	public:
+		_literal_matcher(const std::vector<std::string>& patterns) : patterns(patterns) {
+			if (patterns.size() == 1) {
+				const std::string& p = patterns[0];
+				rareIndex = 0;
+				for (size_t i = 1; i < p.size(); i++) {
+					if (_byte_rank((unsigned char)p[i]) < _byte_rank((unsigned char)p[rareIndex])) rareIndex = i;
+				}
+			} else {
+				build();
+			}
+		}
+
+		// Call found(offset, patternIndex) for every occurrence.
+		template<class Found>
+		void search(const unsigned char* data, size_t length, Found found) const {
+			if (patterns.size() == 1) {
+				const std::string& p = patterns[0];
+				if (length < p.size()) return;
+				unsigned char rare = (unsigned char)p[rareIndex];
+				const unsigned char* start = data + rareIndex;
+				const unsigned char* end = data + length - (p.size() - rareIndex - 1);
+				while (start < end) {
+					const unsigned char* hit = (const unsigned char*)memchr(start, rare, end - start);
+					if (hit == NULL) break;
+					const unsigned char* candidate = hit - rareIndex;
+					if (memcmp(candidate, p.data(), p.size()) == 0) found((size_t)(candidate - data), 0);
+					start = hit + 1;
+				}
+				return;
+			}
+
+			int state = 0;
+			for (size_t i = 0; i < length; i++) {
+				if (state == 0) {
+					// Skip to the next byte which can start a match.
+					if (singleStart >= 0) {
+						const unsigned char* hit = (const unsigned char*)memchr(data + i, singleStart, length - i);
+						if (hit == NULL) return;
+						i = hit - data;
+					} else {
+						while (i < length && !startBytes[data[i]]) i++;
+						if (i == length) return;
+					}
+				}
+
+				state = transitions[state * 256 + data[i]];
+				const std::vector<int>& out = outputs[state];
+				for (size_t k = 0; k < out.size(); k++) {
+					found(i + 1 - patterns[out[k]].size(), (size_t)out[k]);
+				}
+			}
+		}
+	private:
+		static int _byte_rank(unsigned char ch) {
+			// A rough frequency rank of bytes in text, lower is rarer.
+			static const char* common = "\n etaoinsrhldcumfpgwybvkxjqzETAOINSRHLDCUMFPGWYBVKXJQZ0123456789_.,;:()=\"'-/{}<>";
+			const char* p = strchr(common, ch);
+			if (ch == 0 || p == NULL) return 0;
+			return (int)(strlen(common) - (p - common));
+		}
+
+		void build() {
+			transitions.assign(256, 0);
+			outputs.resize(1);
+			memset(startBytes, 0, sizeof(startBytes));
+
+			for (size_t k = 0; k < patterns.size(); k++) {
+				int state = 0;
+				for (size_t i = 0; i < patterns[k].size(); i++) {
+					unsigned char ch = (unsigned char)patterns[k][i];
+					if (transitions[state * 256 + ch] == 0) {
+						transitions[state * 256 + ch] = (int)outputs.size();
+						transitions.resize(transitions.size() + 256, 0);
+						outputs.resize(outputs.size() + 1);
+					}
+					state = transitions[state * 256 + ch];
+				}
+				outputs[state].push_back((int)k);
+				startBytes[(unsigned char)patterns[k][0]] = true;
+			}
+
+			// Turn the trie into a DFA, breadth first, following the failure links.
+			std::vector<int> fail(outputs.size(), 0);
+			std::deque<int> queue;
+			for (int ch = 0; ch < 256; ch++) {
+				if (transitions[ch] != 0) queue.push_back(transitions[ch]);
+			}
+			while (!queue.empty()) {
+				int state = queue.front();
+				queue.pop_front();
+				const std::vector<int>& inherited = outputs[fail[state]];
+				outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+
+				for (int ch = 0; ch < 256; ch++) {
+					int& next = transitions[state * 256 + ch];
+					if (next != 0) {
+						fail[next] = transitions[fail[state] * 256 + ch];
+						queue.push_back(next);
+					} else {
+						next = transitions[fail[state] * 256 + ch];
+					}
+				}
+			}
+
+			singleStart = -1;
+			int count = 0;
+			for (int ch = 0; ch < 256; ch++) {
+				if (startBytes[ch]) {
+					singleStart = ch;
+					count++;
+				}
+			}
+			if (count != 1) singleStart = -1;
+		}
+
+		std::vector<std::string> patterns;
+		size_t rareIndex;
+		std::vector<int> transitions;
+		std::vector<std::vector<int> > outputs;
+		bool startBytes[256];
+		int singleStart;
+	};
+
+	static const size_t BINARY_PROBE_SIZE = 8192;
+
+	static void _search_file(const std::string& filename, const _literal_matcher& matcher, std::vector<search_match>& matches) {
+		_mapped_file file;
+		if (!file.open(filename)) return;
+
+		const unsigned char* data = file.data();
+		size_t length = file.size();
+		if (memchr(data, 0, std::min(length, BINARY_PROBE_SIZE)) != NULL) return;
+
+		size_t lineNumber = 1;
+		size_t countedTo = 0;
+		matcher.search(data, length, [&](size_t offset, size_t patternIndex) {
+			// Matches of different patterns may end in order but start out of order.
+			if (offset >= countedTo) {
+				for (const unsigned char* p = data + countedTo; (p = (const unsigned char*)memchr(p, '\n', data + offset - p)) != NULL; p++) lineNumber++;
+			} else {
+				for (size_t i = offset; i < countedTo; i++) {
+					if (data[i] == '\n') lineNumber--;
+				}
+			}
+			countedTo = offset;
+
+			size_t lineStart = offset;
+			while (lineStart > 0 && data[lineStart - 1] != '\n') lineStart--;
+			const unsigned char* lineEnd = (const unsigned char*)memchr(data + offset, '\n', length - offset);
+			size_t lineLength = (lineEnd == NULL ? length : lineEnd - data) - lineStart;
+			if (lineLength > 0 && data[lineStart + lineLength - 1] == '\r') lineLength--;
+
+			search_match match;
+			match.filename = filename;
+			match.offset = offset;
+			match.lineNumber = lineNumber;
+			match.line.assign((const char*)data + lineStart, lineLength);
+			match.patternIndex = patternIndex;
+			matches.push_back(match);
+		});
+	}
+
+	void search_tree(const std::string& dirName, const std::vector<std::string>& patterns, std::vector<search_match>& matches, int threads /*= 0*/) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		if (patterns.empty()) throw std::invalid_argument("patterns");
+		for (size_t i = 0; i < patterns.size(); i++) {
+			if (patterns[i].empty()) throw std::invalid_argument("patterns");
+		}
+
+		if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+		if (threads <= 0) threads = 1;
+
+		_literal_matcher matcher(patterns);
+		matches.clear();
+		std::mutex mutex;
+		_blocking_queue<std::string> names(threads * 16);
+		std::exception_ptr error;
+
+		// The first error stops the search, it is thrown once the workers are joined.
+		auto fail = [&](std::exception_ptr e) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error) error = e;
+			}
+			names.abort();
+		};
+
+		std::vector<std::thread> workers;
+		for (int i = 0; i < threads; i++) {
+			workers.push_back(std::thread([&]() {
+				try {
+					std::string filename;
+					std::vector<search_match> found;
+					while (names.pop(filename)) {
+						_search_file(filename, matcher, found);
+						if (found.empty()) continue;
+						std::lock_guard<std::mutex> lock(mutex);
+						matches.insert(matches.end(), found.begin(), found.end());
+						found.clear();
+					}
+				} catch (...) {
+					fail(std::current_exception());
+				}
+			}));
+		}
+
+		try {
+			recursive_directory_range range(dirName, EFT_FILE);
+			directory_entry entry;
+			while (range.next(entry)) {
+				if (!names.push(entry.filename)) break;
+			}
+		} catch (...) {
+			fail(std::current_exception());
+		}
+		names.close();
+		for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+		if (error) std::rethrow_exception(error);
+
+		std::sort(matches.begin(), matches.end(), [](const search_match& a, const search_match& b) {
+			if (a.filename != b.filename) return a.filename < b.filename;
+			if (a.offset != b.offset) return a.offset < b.offset;
+			return a.patternIndex < b.patternIndex;
+		});
+	}
+
+	void search_tree(const std::string& dirName, const std::string& pattern, std::vector<search_match>& matches, int threads /*= 0*/) {
+		search_tree(dirName, std::vector<std::string>(1, pattern), matches, threads);
+	}
+
+	// Frame: magic, block size, blocks, end mark, CRC32C of the content.
+	// Block: stored size with the raw flag, original size, payload.
+	static const unsigned char COMPRESSED_FRAME_MAGIC[4] = { 'C', 'X', 'Z', '1' };
+	static const uint32_t COMPRESSED_BLOCK_RAW = 0x80000000u;
+	static const size_t MAX_COMPRESSED_BLOCK_SIZE = 64 * 1024 * 1024;
+
+	static const int LZ4_MIN_MATCH = 4;
+	static const size_t LZ4_LAST_LITERALS = 5;
+	static const size_t LZ4_MATCH_LIMIT = 12;
+	static const int LZ4_HASH_BITS = 14;
+
+	static inline void _write32le(unsigned char* p, uint32_t v) {
+		p[0] = (unsigned char)v;
+		p[1] = (unsigned char)(v >> 8);
+		p[2] = (unsigned char)(v >> 16);
+		p[3] = (unsigned char)(v >> 24);
+	}
+
+	static size_t _lz4_bound(size_t n) {
+		return n + n / 255 + 16;
+	}
+
+	static unsigned char* _lz4_write_length(unsigned char* op, size_t length) {
+		while (length >= 255) {
+			*op++ = 255;
+			length -= 255;
+		}
+		*op++ = (unsigned char)length;
+		return op;
+	}
+
+	static unsigned char* _lz4_write_sequence(unsigned char* op, const unsigned char* literals, size_t literalLength, size_t offset, size_t matchLength) {
+		unsigned char* token = op++;
+		*token = (unsigned char)((literalLength >= 15 ? 15 : literalLength) << 4);
+		if (literalLength >= 15) op = _lz4_write_length(op, literalLength - 15);
+		memcpy(op, literals, literalLength);
+		op += literalLength;
+
+		if (matchLength == 0) return op;
+
+		*op++ = (unsigned char)offset;
+		*op++ = (unsigned char)(offset >> 8);
+		size_t ml = matchLength - LZ4_MIN_MATCH;
+		*token |= (unsigned char)(ml >= 15 ? 15 : ml);
+		if (ml >= 15) op = _lz4_write_length(op, ml - 15);
+		return op;
+	}
+
+	// Greedy LZ4 block compression, dst must hold _lz4_bound(n) bytes.
+	static size_t _lz4_compress(const unsigned char* src, size_t n, unsigned char* dst, std::vector<uint32_t>& table) {
+		unsigned char* op = dst;
+		size_t anchor = 0;
+
+		if (n > LZ4_MATCH_LIMIT) {
+			table.assign((size_t)1 << LZ4_HASH_BITS, 0);
+			size_t matchStartLimit = n - LZ4_MATCH_LIMIT;
+			size_t matchEndLimit = n - LZ4_LAST_LITERALS;
+			size_t ip = 0;
+			while (ip < matchStartLimit) {
+				uint32_t seq = _read32le(src + ip);
+				uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+				size_t ref = table[h];
+				table[h] = (uint32_t)ip;
+
+				if (ref < ip && ip - ref <= 65535 && _read32le(src + ref) == seq) {
+					size_t ml = LZ4_MIN_MATCH;
+					while (ip + ml < matchEndLimit && src[ref + ml] == src[ip + ml]) ml++;
+					op = _lz4_write_sequence(op, src + anchor, ip - anchor, ip - ref, ml);
+					ip += ml;
+					anchor = ip;
+				} else {
+					// Step faster through data which does not compress.
+					ip += 1 + ((ip - anchor) >> 6);
+				}
+			}
+		}
+
+		op = _lz4_write_sequence(op, src + anchor, n - anchor, 0, 0);
+		return op - dst;
+	}
+
+	// LZ4 block decompression into exactly n bytes, returns false on corrupted input.
+	static bool _lz4_decompress(const unsigned char* src, size_t srcLength, unsigned char* dst, size_t n) {
+		const unsigned char* ip = src;
+		const unsigned char* ipEnd = src + srcLength;
+		unsigned char* op = dst;
+		unsigned char* opEnd = dst + n;
+
+		for (;;) {
+			if (ip >= ipEnd) return false;
+			unsigned int token = *ip++;
+
+			size_t literalLength = token >> 4;
+			if (literalLength == 15) {
+				unsigned char b;
+				do {
+					if (ip >= ipEnd) return false;
+					b = *ip++;
+					literalLength += b;
+				} while (b == 255);
+			}
+			if ((size_t)(ipEnd - ip) < literalLength || (size_t)(opEnd - op) < literalLength) return false;
+			memcpy(op, ip, literalLength);
+			ip += literalLength;
+			op += literalLength;
+
+			if (ip == ipEnd) return op == opEnd;
+
+			if (ipEnd - ip < 2) return false;
+			size_t offset = ip[0] | ((size_t)ip[1] << 8);
+			ip += 2;
+			if (offset == 0 || offset > (size_t)(op - dst)) return false;
+
+			size_t matchLength = token & 15;
+			if (matchLength == 15) {
+				unsigned char b;
+				do {
+					if (ip >= ipEnd) return false;
+					b = *ip++;
+					matchLength += b;
+				} while (b == 255);
+			}
+			matchLength += LZ4_MIN_MATCH;
+			if ((size_t)(opEnd - op) < matchLength) return false;
+
+			// Byte by byte, the match may overlap the output.
+			const unsigned char* match = op - offset;
+			for (size_t i = 0; i < matchLength; i++) op[i] = match[i];
+			op += matchLength;
+		}
+	}
+
+	compression_options::compression_options() {
+		blockSize = 1024 * 1024;
+		threads = (int)std::thread::hardware_concurrency();
+		if (threads < 1) threads = 1;
+	}
+
+	// Error of the data which does not match its format or its checksum.
+#ifdef _WIN32
+	static const int CORRUPTED_DATA_ERROR = ERROR_INVALID_DATA;
+#else
+	static const int CORRUPTED_DATA_ERROR = EBADMSG;
+#endif // _WIN32
+
+	// A file opened with the system calls, the errors carry errno, or GetLastError on Windows.
+	class _raw_file {
+	public:
+#ifdef _WIN32
+		_raw_file() : handle(INVALID_HANDLE_VALUE) { }
+#else
+		_raw_file() : fd(-1) { }
+#endif // _WIN32
+		~_raw_file() { close(); }
+
+		// Open for reading, return 0 if successful, or the error.
+		int open_read(const std::string& filename) {
+#ifdef _WIN32
+			handle = ::CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			return handle == INVALID_HANDLE_VALUE ? (int)::GetLastError() : 0;
+#else
+			fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+			return fd == -1 ? errno : 0;
+#endif // _WIN32
+		}
+
+		void open_write(const std::string& filename, bool bAppend) {
+#ifdef _WIN32
+			handle = ::CreateFileA(filename.c_str(), bAppend ? FILE_APPEND_DATA : GENERIC_WRITE, FILE_SHARE_READ,
+				NULL, bAppend ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (handle == INVALID_HANDLE_VALUE) throw io_exception((int)::GetLastError());
+#else
+			fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (bAppend ? O_APPEND : O_TRUNC), 0666);
+			if (fd == -1) throw io_exception(errno);
+#endif // _WIN32
+		}
+
+		// Read n bytes, or less at the end of the file.
+		size_t read(unsigned char* p, size_t n) {
+			size_t total = 0;
+			while (total < n) {
+#ifdef _WIN32
+				DWORD k = 0;
+				if (!::ReadFile(handle, p + total, (DWORD)std::min<size_t>(n - total, 0x40000000), &k, NULL)) throw io_exception((int)::GetLastError());
+#else
+				ssize_t k = ::read(fd, p + total, n - total);
+				if (k == -1 && errno == EINTR) continue;
+				if (k == -1) throw io_exception(errno);
+#endif // _WIN32
+				if (k == 0) break;
+				total += (size_t)k;
+			}
+			return total;
+		}
+
+		// Read exactly n bytes, return false at the end of the file.
+		bool read_exactly(unsigned char* p, size_t n) {
+			return read(p, n) == n;
+		}
+
+		void write(const unsigned char* p, size_t n) {
+#ifdef _WIN32
+			while (n > 0) {
+				DWORD k = 0;
+				if (!::WriteFile(handle, p, (DWORD)std::min<size_t>(n, 0x40000000), &k, NULL)) throw io_exception((int)::GetLastError());
+				p += k;
+				n -= k;
+			}
+#else
+			std::error_code ec;
+			_write_all_fd(fd, p, n, ec);
+			if (ec) throw io_exception(ec.value());
+#endif // _WIN32
+		}
+
+		void sync() {
+#ifdef _WIN32
+			if (!::FlushFileBuffers(handle)) throw io_exception((int)::GetLastError());
+#else
+			if (fsync(fd) == -1) throw io_exception(errno);
+#endif // _WIN32
+		}
+
+		// Get the identity of the file, return false if it is not a regular file.
+		bool identify(unsigned long long& device, unsigned long long& inode) {
+#ifdef _WIN32
+			BY_HANDLE_FILE_INFORMATION info;
+			if (!::GetFileInformationByHandle(handle, &info)) throw io_exception((int)::GetLastError());
+			device = info.dwVolumeSerialNumber;
+			inode = ((unsigned long long)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+			return (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0;
+#else
+			struct stat st;
+			if (fstat(fd, &st) == -1) throw io_exception(errno);
+			device = (unsigned long long)st.st_dev;
+			inode = (unsigned long long)st.st_ino;
+			return S_ISREG(st.st_mode);
+#endif // _WIN32
+		}
+
+		void close() {
+#ifdef _WIN32
+			if (handle != INVALID_HANDLE_VALUE) ::CloseHandle(handle);
+			handle = INVALID_HANDLE_VALUE;
+#else
+			if (fd != -1) ::close(fd);
+			fd = -1;
+#endif // _WIN32
+		}
+	private:
+#ifdef _WIN32
+		HANDLE handle;
+#else
+		int fd;
+#endif // _WIN32
+	public:
+		_raw_file(const _raw_file&) = delete;
+		_raw_file& operator=(const _raw_file&) = delete;
+	};
+
+	void write_compressed_bytes(const std::string& filename, const unsigned char* data, size_t length, bool bAppend /*= false*/, const compression_options& options /*= compression_options()*/) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+		if (options.blockSize == 0 || options.blockSize > MAX_COMPRESSED_BLOCK_SIZE) throw std::invalid_argument("options");
+
+		_raw_file file;
+		file.open_write(filename, bAppend);
+		_invalidate_metadata_caches(filename, false);
+
+		unsigned char header[8];
+		memcpy(header, COMPRESSED_FRAME_MAGIC, 4);
+		_write32le(header + 4, (uint32_t)options.blockSize);
+		file.write(header, 8);
+
+		size_t blockCount = (length + options.blockSize - 1) / options.blockSize;
+		size_t batchSize = options.threads < 1 ? 1 : (size_t)options.threads;
+		std::vector<std::vector<unsigned char> > outputs(std::min(batchSize, std::max<size_t>(blockCount, 1)));
+		std::vector<std::vector<uint32_t> > tables(outputs.size());
+
+		for (size_t first = 0; first < blockCount; first += outputs.size()) {
+			size_t count = std::min(outputs.size(), blockCount - first);
+			_parallel_for(count, (int)count, [&](size_t i) {
+				size_t offset = (first + i) * options.blockSize;
+				size_t n = std::min(options.blockSize, length - offset);
+				std::vector<unsigned char>& out = outputs[i];
+				out.resize(8 + _lz4_bound(n));
+				size_t compressed = _lz4_compress(data + offset, n, out.data() + 8, tables[i]);
+				if (compressed >= n) {
+					memcpy(out.data() + 8, data + offset, n);
+					_write32le(out.data(), (uint32_t)n | COMPRESSED_BLOCK_RAW);
+					compressed = n;
+				} else {
+					_write32le(out.data(), (uint32_t)compressed);
+				}
+				_write32le(out.data() + 4, (uint32_t)n);
+				out.resize(8 + compressed);
+			});
+
+			for (size_t i = 0; i < count; i++) file.write(outputs[i].data(), outputs[i].size());
+		}
+
+		unsigned char trailer[8];
+		_write32le(trailer, 0);
+		_write32le(trailer + 4, _crc32c(0, data, length));
+		file.write(trailer, 8);
+	}
+
+	void write_compressed_bytes(const std::string& filename, const std::vector<unsigned char>& data, bool bAppend /*= false*/, const compression_options& options /*= compression_options()*/) {
+		write_compressed_bytes(filename, data.data(), data.size(), bAppend, options);
+	}
+
+	void read_compressed_bytes(const std::string& filename, std::vector<unsigned char>& data) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+
+		_raw_file file;
+		int error = file.open_read(filename);
+		if (error != 0) throw io_exception(error);
+
+		data.clear();
+		std::vector<unsigned char> payload;
+		unsigned char header[8];
+		for (;;) {
+			size_t got = file.read(header, 8);
+			if (got == 0) break;
+
+			if (got < 4 || memcmp(header, COMPRESSED_FRAME_MAGIC, 4) != 0) {
+				if (data.empty()) {
+					// Not a frame, the file is read as it is.
+					file.close();
+					read_all_bytes(filename, data);
+					return;
+				}
+				throw io_exception(CORRUPTED_DATA_ERROR);
+			}
+			if (got < 8) throw io_exception(CORRUPTED_DATA_ERROR);
+
+			size_t blockSize = _read32le(header + 4);
+			if (blockSize == 0 || blockSize > MAX_COMPRESSED_BLOCK_SIZE) throw io_exception(CORRUPTED_DATA_ERROR);
+
+			size_t frameStart = data.size();
+			for (;;) {
+				unsigned char blockHeader[8];
+				if (!file.read_exactly(blockHeader, 4)) throw io_exception(CORRUPTED_DATA_ERROR);
+				uint32_t stored = _read32le(blockHeader);
+				if (stored == 0) break;
+				if (!file.read_exactly(blockHeader + 4, 4)) throw io_exception(CORRUPTED_DATA_ERROR);
+
+				size_t storedSize = stored & ~COMPRESSED_BLOCK_RAW;
+				size_t rawSize = _read32le(blockHeader + 4);
+				if (rawSize > blockSize || storedSize > _lz4_bound(blockSize)) throw io_exception(CORRUPTED_DATA_ERROR);
+
+				size_t offset = data.size();
+				data.resize(offset + rawSize);
+				if (stored & COMPRESSED_BLOCK_RAW) {
+					if (storedSize != rawSize || !file.read_exactly(data.data() + offset, rawSize)) throw io_exception(CORRUPTED_DATA_ERROR);
+				} else {
+					payload.resize(storedSize);
+					if (!file.read_exactly(payload.data(), storedSize)) throw io_exception(CORRUPTED_DATA_ERROR);
+					if (!_lz4_decompress(payload.data(), storedSize, data.data() + offset, rawSize)) throw io_exception(CORRUPTED_DATA_ERROR);
+				}
+			}
+
+			unsigned char checksum[4];
+			if (!file.read_exactly(checksum, 4)) throw io_exception(CORRUPTED_DATA_ERROR);
+			if (_read32le(checksum) != _crc32c(0, data.data() + frameStart, data.size() - frameStart)) throw io_exception(CORRUPTED_DATA_ERROR);
+		}
+	}
+
+	bool is_compressed_file(const std::string& filename) {
+		if (filename.empty()) return false;
+
+		_raw_file file;
+		if (file.open_read(filename) != 0) return false;
+
+		unsigned char header[4];
+		try {
+			return file.read_exactly(header, 4) && memcmp(header, COMPRESSED_FRAME_MAGIC, 4) == 0;
+		}
+		catch (const io_exception&) {
+			return false;
+		}
+	}
+
+	// Pack: header, file contents, entry table, names, hash slots, footer.
+	// Entry: data offset, size, name offset, name length (u32), reserved (u32).
+	// Footer: magic, reserved, entries offset, entry count, names offset, names size, slots offset, slot count.
+	static const unsigned char PACK_MAGIC[4] = { 'C', 'X', 'P', 'K' };
+	static const unsigned char PACK_INDEX_MAGIC[4] = { 'C', 'X', 'P', 'I' };
+	static const size_t PACK_HEADER_SIZE = 16;
+	static const size_t PACK_ENTRY_SIZE = 32;
+	static const size_t PACK_FOOTER_SIZE = 56;
+	static const size_t PACK_ALIGNMENT = 16;
+
+	static inline void _write64le(unsigned char* p, uint64_t v) {
+		for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (i * 8));
+	}
+
+	static uint64_t _hash_pack_path(const char* path, size_t length) {
+		_xxh64_state xxh;
+		xxh.reset();
+		xxh.update((const unsigned char*)path, length);
+		return xxh.digest();
+	}
+
+	static std::string _pack_path(const std::string& path) {
+		std::string p = path;
+#ifdef _WIN32
+		std::replace(p.begin(), p.end(), '\\', '/');
+#endif // _WIN32
+		return p;
+	}
+
+	size_t build_pack(const std::string& dirName, const std::string& packFile) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		if (packFile.empty()) throw std::invalid_argument("packFile");
+
+		// Build under a temporary name, the previous pack is only replaced by a complete one.
+		std::string tempFile = packFile + ".tmp";
+		_raw_file out;
+		out.open_write(tempFile, false);
+
+		size_t entryCount = 0;
+		try {
+			// The pack may be inside the tree, it is recognized by its identity and not packed.
+			unsigned long long outDevice = 0, outInode = 0, oldDevice = 0, oldInode = 0;
+			out.identify(outDevice, outInode);
+			bool hasOld = false;
+			{
+				_raw_file old;
+				if (old.open_read(packFile) == 0) hasOld = old.identify(oldDevice, oldInode);
+			}
+
+			unsigned char header[PACK_HEADER_SIZE] = { 0 };
+			memcpy(header, PACK_MAGIC, 4);
+			_write32le(header + 4, 1);
+			out.write(header, PACK_HEADER_SIZE);
+
+			std::vector<unsigned char> entryTable;
+			std::string names;
+			std::vector<uint64_t> hashes;
+			std::vector<unsigned char> buffer(HASH_CHUNK_SIZE);
+			uint64_t offset = PACK_HEADER_SIZE;
+
+			std::string prefix = dirName;
+			if (!_is_separator(prefix[prefix.size() - 1])) prefix += DIR_SEP;
+
+			recursive_directory_range range(dirName, EFT_FILE);
+			directory_entry entry;
+			while (range.next(entry)) {
+				_raw_file in;
+				int error = in.open_read(entry.filename);
+				if (error != 0) {
+					// A dangling link has nothing to pack.
+#ifdef _WIN32
+					if (entry.symlink && (error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND)) continue;
+#else
+					if (entry.symlink && error == ENOENT) continue;
+#endif // _WIN32
+					throw io_exception(error);
+				}
+				unsigned long long device = 0, inode = 0;
+				if (!in.identify(device, inode)) continue;
+				if (device == outDevice && inode == outInode) continue;
+				if (hasOld && device == oldDevice && inode == oldInode) continue;
+
+				static const unsigned char zeros[PACK_ALIGNMENT] = { 0 };
+				size_t padding = (size_t)((PACK_ALIGNMENT - offset % PACK_ALIGNMENT) % PACK_ALIGNMENT);
+				out.write(zeros, padding);
+				offset += padding;
+
+				uint64_t size = 0;
+				for (;;) {
+					size_t n = in.read(buffer.data(), buffer.size());
+					if (n == 0) break;
+					out.write(buffer.data(), n);
+					size += n;
+				}
+
+				std::string name = _pack_path(entry.filename.compare(0, prefix.size(), prefix) == 0 ? entry.filename.substr(prefix.size()) : entry.filename);
+				unsigned char e[PACK_ENTRY_SIZE] = { 0 };
+				_write64le(e, offset);
+				_write64le(e + 8, size);
+				_write64le(e + 16, names.size());
+				_write32le(e + 24, (uint32_t)name.size());
+				entryTable.insert(entryTable.end(), e, e + PACK_ENTRY_SIZE);
+				hashes.push_back(_hash_pack_path(name.data(), name.size()));
+				names += name;
+				offset += size;
+			}
+
+			// Open addressing with linear probing, at most half full.
+			entryCount = hashes.size();
+			size_t slotCount = 2;
+			while (slotCount < entryCount * 2) slotCount *= 2;
+			std::vector<unsigned char> slots(slotCount * 4, 0);
+			for (size_t i = 0; i < entryCount; i++) {
+				size_t s = (size_t)(hashes[i] & (slotCount - 1));
+				while (_read32le(&slots[s * 4]) != 0) s = (s + 1) & (slotCount - 1);
+				_write32le(&slots[s * 4], (uint32_t)(i + 1));
+			}
+
+			uint64_t entriesOffset = offset;
+			uint64_t namesOffset = entriesOffset + entryTable.size();
+			uint64_t slotsOffset = namesOffset + names.size();
+			out.write(entryTable.data(), entryTable.size());
+			out.write((const unsigned char*)names.data(), names.size());
+			out.write(slots.data(), slots.size());
+
+			unsigned char footer[PACK_FOOTER_SIZE] = { 0 };
+			memcpy(footer, PACK_INDEX_MAGIC, 4);
+			_write64le(footer + 8, entriesOffset);
+			_write64le(footer + 16, entryCount);
+			_write64le(footer + 24, namesOffset);
+			_write64le(footer + 32, names.size());
+			_write64le(footer + 40, slotsOffset);
+			_write64le(footer + 48, slotCount);
+			out.write(footer, PACK_FOOTER_SIZE);
+			out.sync();
+			out.close();
+			rename(tempFile, packFile);
+		}
+		catch (...) {
+			out.close();
+			std::error_code ignored;
+			remove_file(tempFile, ignored);
+			throw;
+		}
+		return entryCount;
+	}
+
+	pack_reader::pack_reader() {
+		nativeFile = NULL;
+		close();
+	}
+
+	pack_reader::~pack_reader() {
+		close();
+	}
+
+	void pack_reader::open(const std::string& packFile) {
+		if (packFile.empty()) throw std::invalid_argument("packFile");
+		close();
+
+		_mapped_file* file = new _mapped_file();
+		nativeFile = file;
+		if (!file->open(packFile)) {
+			close();
+			throw io_exception();
+		}
+
+		const unsigned char* p = file->data();
+		uint64_t size = file->size();
+		if (size < PACK_HEADER_SIZE + PACK_FOOTER_SIZE || memcmp(p, PACK_MAGIC, 4) != 0) {
+			close();
+			throw io_exception();
+		}
+
+		const unsigned char* footer = p + size - PACK_FOOTER_SIZE;
+		uint64_t entriesOffset = _read64le(footer + 8);
+		uint64_t count = _read64le(footer + 16);
+		uint64_t namesOffset = _read64le(footer + 24);
+		uint64_t namesLength = _read64le(footer + 32);
+		uint64_t slotsOffset = _read64le(footer + 40);
+		uint64_t slots = _read64le(footer + 48);
+		uint64_t end = size - PACK_FOOTER_SIZE;
+		if (memcmp(footer, PACK_INDEX_MAGIC, 4) != 0 ||
+			entriesOffset > end || count > (end - entriesOffset) / PACK_ENTRY_SIZE ||
+			namesOffset != entriesOffset + count * PACK_ENTRY_SIZE || namesLength > end - namesOffset ||
+			slotsOffset != namesOffset + namesLength || slots > (end - slotsOffset) / 4 ||
+			slots < count || slots == 0 || (slots & (slots - 1)) != 0) {
+			close();
+			throw io_exception();
+		}
+
+		entries = p + entriesOffset;
+		entryCount = (size_t)count;
+		names = p + namesOffset;
+		namesSize = (size_t)namesLength;
+		this->slots = p + slotsOffset;
+		slotCount = (size_t)slots;
+	}
+
+	void pack_reader::close() {
+		delete (_mapped_file*)nativeFile;
+		nativeFile = NULL;
+		entries = NULL;
+		names = NULL;
+		namesSize = 0;
+		slots = NULL;
+		slotCount = 0;
+		entryCount = 0;
+	}
+
+	bool pack_reader::read(const std::string& path, const unsigned char*& data, size_t& length) const {
+		if (nativeFile == NULL) return false;
+
+		std::string name = _pack_path(path);
+		const _mapped_file* file = (const _mapped_file*)nativeFile;
+		size_t s = (size_t)(_hash_pack_path(name.data(), name.size()) & (slotCount - 1));
+		for (size_t probes = 0; probes < slotCount; probes++, s = (s + 1) & (slotCount - 1)) {
+			uint32_t index = _read32le(slots + s * 4);
+			if (index == 0) return false;
+			if (index > entryCount) continue;
+
+			const unsigned char* e = entries + (index - 1) * PACK_ENTRY_SIZE;
+			uint64_t nameOffset = _read64le(e + 16);
+			uint32_t nameLength = _read32le(e + 24);
+			if (nameLength != name.size() || nameOffset > namesSize || nameLength > namesSize - nameOffset) continue;
+			if (memcmp(names + nameOffset, name.data(), nameLength) != 0) continue;
+
+			uint64_t offset = _read64le(e);
+			uint64_t size = _read64le(e + 8);
+			if (offset > file->size() || size > file->size() - offset) return false;
+			data = file->data() + offset;
+			length = (size_t)size;
+			return true;
+		}
+		return false;
+	}
+
+	size_t pack_reader::file_count() const {
+		return entryCount;
+	}
+
+	void pack_reader::list(std::vector<std::string>& paths) const {
+		paths.clear();
+		for (size_t i = 0; i < entryCount; i++) {
+			const unsigned char* e = entries + i * PACK_ENTRY_SIZE;
+			uint64_t nameOffset = _read64le(e + 16);
+			uint32_t nameLength = _read32le(e + 24);
+			if (nameOffset > namesSize || nameLength > namesSize - nameOffset) continue;
+			paths.push_back(std::string((const char*)names + nameOffset, nameLength));
+		}
+	}
+
+	static const size_t SPARSE_BLOCK_SIZE = 4096;
+	static const size_t COPY_CHUNK_SIZE = 1024 * 1024;
+
+#ifndef _WIN32
+	static unsigned long long _get_data_extents(int fd, std::vector<file_extent>& extents) {
+		extents.clear();
+		struct stat st;
+		if (fstat(fd, &st) == -1) throw io_exception(errno);
+		unsigned long long size = (unsigned long long)st.st_size;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+		off_t pos = 0;
+		while ((unsigned long long)pos < size) {
+			off_t dataStart = lseek(fd, pos, SEEK_DATA);
+			if (dataStart == -1) {
+				if (errno == ENXIO) return size;
+				if (pos == 0) break;
+				throw io_exception(errno);
+			}
+			off_t holeStart = lseek(fd, dataStart, SEEK_HOLE);
+			if (holeStart == -1) holeStart = (off_t)size;
+
+			file_extent extent;
+			extent.offset = (unsigned long long)dataStart;
+			extent.length = (unsigned long long)(holeStart - dataStart);
+			extents.push_back(extent);
+			pos = holeStart;
+		}
+		if (pos != 0 || size == 0) return size;
+#endif
+		// Holes are not reported, the whole file is data.
+		extents.clear();
+		file_extent extent;
+		extent.offset = 0;
+		extent.length = size;
+		extents.push_back(extent);
+		return size;
+	}
+
+	static void _pread_all(int fd, unsigned char* p, size_t n, unsigned long long offset) {
+		while (n > 0) {
+			ssize_t r = pread(fd, p, n, (off_t)offset);
+			if (r == -1 && errno == EINTR) continue;
+			if (r <= 0) throw io_exception(r == -1 ? errno : EIO);
+			p += r;
+			n -= (size_t)r;
+			offset += (unsigned long long)r;
+		}
+	}
+
+	static void _pwrite_all(int fd, const unsigned char* p, size_t n, unsigned long long offset) {
+		while (n > 0) {
+			ssize_t r = pwrite(fd, p, n, (off_t)offset);
+			if (r == -1 && errno == EINTR) continue;
+			if (r <= 0) throw io_exception(r == -1 ? errno : EIO);
+			p += r;
+			n -= (size_t)r;
+			offset += (unsigned long long)r;
+		}
+	}
+
+	// Closes the descriptor when leaving the scope.
+	struct _fd_guard {
+		int fd;
+		explicit _fd_guard(int fd) : fd(fd) { }
+		~_fd_guard() { if (fd != -1) ::close(fd); }
+	};
+#endif // _WIN32
+
+	unsigned long long get_data_extents(const std::string& filename, std::vector<file_extent>& extents) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+
+#ifdef _WIN32
+		file_status status;
+		if (!get_file_status(filename, status)) throw io_exception((int)::GetLastError());
+		if (status.type != EFT_FILE) throw io_exception(ERROR_DIRECTORY);
+		extents.clear();
+		file_extent extent;
+		extent.offset = 0;
+		extent.length = status.size;
+		extents.push_back(extent);
+		return status.size;
+#else
+		_fd_guard file(::open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+		if (file.fd == -1) throw io_exception(errno);
+		return _get_data_extents(file.fd, extents);
+#endif // _WIN32
+	}
+
+	unsigned long long read_data_extents(const std::string& filename, std::vector<file_extent>& extents, std::vector<unsigned char>& data) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+
+#ifdef _WIN32
+		read_all_bytes(filename, data);
+		extents.clear();
+		file_extent extent;
+		extent.offset = 0;
+		extent.length = data.size();
+		extents.push_back(extent);
+		return data.size();
+#else
+		_fd_guard file(::open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+		if (file.fd == -1) throw io_exception(errno);
+
+		unsigned long long size = _get_data_extents(file.fd, extents);
+		unsigned long long total = 0;
+		for (size_t i = 0; i < extents.size(); i++) total += extents[i].length;
+
+		data.resize((size_t)total);
+		size_t pos = 0;
+		for (size_t i = 0; i < extents.size(); i++) {
+			_pread_all(file.fd, data.data() + pos, (size_t)extents[i].length, extents[i].offset);
+			pos += (size_t)extents[i].length;
+		}
+		return size;
+#endif // _WIN32
+	}
+
+	void write_data_extents(const std::string& filename, const std::vector<file_extent>& extents, const std::vector<unsigned char>& data, unsigned long long fileSize) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+
+		unsigned long long total = 0;
+		for (size_t i = 0; i < extents.size(); i++) {
+			if (extents[i].offset + extents[i].length > fileSize) throw std::invalid_argument("extents");
+			total += extents[i].length;
+		}
+		if (total != data.size()) throw std::invalid_argument("data");
+
+#ifdef _WIN32
+		std::vector<unsigned char> content((size_t)fileSize, 0);
+		size_t pos = 0;
+		for (size_t i = 0; i < extents.size(); i++) {
+			memcpy(content.data() + extents[i].offset, data.data() + pos, (size_t)extents[i].length);
+			pos += (size_t)extents[i].length;
+		}
+		write_all_bytes(filename, content);
+#else
+		_fd_guard file(::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+		if (file.fd == -1) throw io_exception(errno);
+		_invalidate_metadata_caches(filename, false);
+
+		size_t pos = 0;
+		for (size_t i = 0; i < extents.size(); i++) {
+			_pwrite_all(file.fd, data.data() + pos, (size_t)extents[i].length, extents[i].offset);
+			pos += (size_t)extents[i].length;
+		}
+		if (ftruncate(file.fd, (off_t)fileSize) == -1) throw io_exception(errno);
+#endif // _WIN32
+	}
+
+	static bool _is_zero(const unsigned char* p, size_t n) {
+		static const unsigned char zeros[SPARSE_BLOCK_SIZE] = { 0 };
+		while (n > 0) {
+			size_t k = std::min(n, SPARSE_BLOCK_SIZE);
+			if (memcmp(p, zeros, k) != 0) return false;
+			p += k;
+			n -= k;
+		}
+		return true;
+	}
+
+	void write_sparse_bytes(const std::string& filename, const unsigned char* data, size_t length) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+
+#ifdef _WIN32
+		write_all_bytes(filename, data, length);
+#else
+		_fd_guard file(::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+		if (file.fd == -1) throw io_exception(errno);
+		_invalidate_metadata_caches(filename, false);
+
+		// Write runs of non-zero blocks, the file is truncated, so the skipped blocks stay holes.
+		size_t pos = 0;
+		while (pos < length) {
+			size_t n = std::min(SPARSE_BLOCK_SIZE, length - pos);
+			if (_is_zero(data + pos, n)) {
+				pos += n;
+				continue;
+			}
+			size_t end = pos + n;
+			while (end < length) {
+				size_t k = std::min(SPARSE_BLOCK_SIZE, length - end);
+				if (_is_zero(data + end, k)) break;
+				end += k;
+			}
+			_pwrite_all(file.fd, data + pos, end - pos, pos);
+			pos = end;
+		}
+		if (ftruncate(file.fd, (off_t)length) == -1) throw io_exception(errno);
+#endif // _WIN32
+	}
+
+#ifndef _WIN32
+	// Copy the data extents of an opened file, then set the size and the permissions of the destination.
+	static unsigned long long _copy_data(int srcFd, int dstFd, const struct stat& st) {
+		std::vector<file_extent> extents;
+		unsigned long long size = _get_data_extents(srcFd, extents);
+		std::vector<unsigned char> buffer;
+		unsigned long long copied = 0;
+		for (size_t i = 0; i < extents.size(); i++) {
+			unsigned long long offset = extents[i].offset;
+			unsigned long long end = offset + extents[i].length;
+			while (offset < end) {
+				size_t n = (size_t)std::min<unsigned long long>(COPY_CHUNK_SIZE, end - offset);
+				buffer.resize(n);
+				_pread_all(srcFd, buffer.data(), n, offset);
+				_pwrite_all(dstFd, buffer.data(), n, offset);
+				offset += n;
+				copied += n;
+			}
+		}
+		if (ftruncate(dstFd, (off_t)size) == -1) throw io_exception(errno);
+		if (fchmod(dstFd, st.st_mode & 07777) == -1) throw io_exception(errno);
+		return copied;
+	}
+#endif // _WIN32
+
+	unsigned long long copy_file(const std::string& srcName, const std::string& dstName) {
+		if (srcName.empty()) throw std::invalid_argument("srcName");
+		if (dstName.empty()) throw std::invalid_argument("dstName");
+
+#ifdef _WIN32
+		if (!::CopyFileA(srcName.c_str(), dstName.c_str(), FALSE)) throw io_exception((int)::GetLastError());
+		_invalidate_metadata_caches(dstName, false);
+		file_status status;
+		if (!get_file_status(dstName, status)) throw io_exception();
+		return status.size;
+#else
+		_fd_guard src(::open(srcName.c_str(), O_RDONLY | O_CLOEXEC));
+		if (src.fd == -1) throw io_exception(errno);
+		struct stat st;
+		if (fstat(src.fd, &st) == -1) throw io_exception(errno);
+		if (!S_ISREG(st.st_mode)) throw io_exception(S_ISDIR(st.st_mode) ? EISDIR : EINVAL);
+
+		// Truncate only once the destination is known not to be the source, or a hard link of it.
+		_fd_guard dst(::open(dstName.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, st.st_mode & 07777));
+		if (dst.fd == -1) throw io_exception(errno);
+		struct stat dstSt;
+		if (fstat(dst.fd, &dstSt) == -1) throw io_exception(errno);
+		if (dstSt.st_dev == st.st_dev && dstSt.st_ino == st.st_ino) throw io_exception(EINVAL);
+		if (ftruncate(dst.fd, 0) == -1) throw io_exception(errno);
+		_invalidate_metadata_caches(dstName, false);
+		return _copy_data(src.fd, dst.fd, st);
+#endif // _WIN32
+	}
+
+	prefetch_options::prefetch_options() {
+		minWindow = 4;
+		maxWindow = 256;
+		maxBytes = 64ULL * 1024 * 1024;
+		lookahead = 200;
+	}
+
+	struct _prefetched_file {
+		std::string filename;
+		unsigned long long size;
+	};
+
+	struct _file_prefetcher_impl {
+		prefetch_options options;
+		std::function<bool(std::string&)> source;
+		std::unique_ptr<recursive_directory_range> range;
+		std::vector<std::string> filenames;
+		size_t listPos;
+
+		mutable std::mutex mutex;
+		std::condition_variable producerCond;
+		std::condition_variable consumerCond;
+		std::deque<_prefetched_file> ready;
+		unsigned long long readyBytes;
+		size_t window;
+		bool finished;
+		bool stopped;
+		std::exception_ptr error;
+
+		// Consumer rate, as an average of the interval between next() calls.
+		std::chrono::steady_clock::time_point lastNext;
+		double avgInterval;
+		bool hasLastNext;
+
+		std::thread worker;
+
+		void start() {
+			listPos = 0;
+			readyBytes = 0;
+			window = std::max<size_t>(options.minWindow, 1);
+			finished = false;
+			stopped = false;
+			avgInterval = 0;
+			hasLastNext = false;
+			worker = std::thread(&_file_prefetcher_impl::run, this);
+		}
+
+		bool has_room() const {
+			if (ready.empty()) return true;
+			return ready.size() < window && readyBytes < options.maxBytes;
+		}
+
+		void run() {
+			try {
+				std::string filename;
+				while (true) {
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						producerCond.wait(lock, [this]() { return stopped || has_room(); });
+						if (stopped) return;
+					}
+					if (!source(filename)) break;
+
+					_prefetched_file file;
+					file.filename = filename;
+					file.size = _prefetch(filename);
+
+					std::lock_guard<std::mutex> lock(mutex);
+					ready.push_back(file);
+					readyBytes += file.size;
+					consumerCond.notify_one();
+				}
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				error = std::current_exception();
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			finished = true;
+			consumerCond.notify_all();
+		}
+
+		// Ask the kernel to read the file into the page cache, return the file size.
+		static unsigned long long _prefetch(const std::string& filename) {
+#ifdef _WIN32
+			file_status status;
+			return get_file_status(filename, status) ? status.size : 0;
+#else
+			int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd == -1) return 0;
+			struct stat st;
+			unsigned long long size = fstat(fd, &st) == 0 ? (unsigned long long)st.st_size : 0;
+#if defined(POSIX_FADV_WILLNEED)
+			if (size > 0) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+			::close(fd);
+			return size;
+#endif // _WIN32
+		}
+
+		// Called with the mutex held.
+		void adapt() {
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (hasLastNext) {
+				double interval = std::chrono::duration<double, std::milli>(now - lastNext).count();
+				avgInterval = avgInterval == 0 ? interval : avgInterval * 0.875 + interval * 0.125;
+				size_t target = options.maxWindow;
+				if (avgInterval > 0) {
+					double count = options.lookahead / avgInterval;
+					if (count < (double)options.maxWindow) target = (size_t)count + 1;
+				}
+				window = std::max<size_t>(std::min(target, options.maxWindow), std::max<size_t>(options.minWindow, 1));
+			}
+			lastNext = now;
+			hasLastNext = true;
+		}
+	};
+
+	file_prefetcher::file_prefetcher(const std::vector<std::string>& filenames, const prefetch_options& options /*= prefetch_options()*/) {
+		impl = new _file_prefetcher_impl();
+		impl->options = options;
+		impl->filenames = filenames;
+		_file_prefetcher_impl* p = impl;
+		impl->source = [p](std::string& filename) {
+			if (p->listPos >= p->filenames.size()) return false;
+			filename = p->filenames[p->listPos++];
+			return true;
+		};
+		impl->start();
+	}
+
+	file_prefetcher::file_prefetcher(const std::string& dirName, const prefetch_options& options /*= prefetch_options()*/) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		impl = new _file_prefetcher_impl();
+		impl->options = options;
+		impl->range.reset(new recursive_directory_range(dirName, EFT_FILE));
+		_file_prefetcher_impl* p = impl;
+		impl->source = [p](std::string& filename) {
+			directory_entry entry;
+			if (!p->range->next(entry)) return false;
+			filename = entry.filename;
+			return true;
+		};
+		impl->start();
+	}
+
+	file_prefetcher::~file_prefetcher() {
+		{
+			std::lock_guard<std::mutex> lock(impl->mutex);
+			impl->stopped = true;
+			impl->producerCond.notify_all();
+		}
+		impl->worker.join();
+		delete impl;
+	}
+
+	bool file_prefetcher::next(std::string& filename) {
+		std::unique_lock<std::mutex> lock(impl->mutex);
+		impl->adapt();
+		impl->consumerCond.wait(lock, [this]() { return !impl->ready.empty() || impl->finished; });
+		if (impl->ready.empty()) {
+			if (impl->error) std::rethrow_exception(impl->error);
+			return false;
+		}
+
+		filename.swap(impl->ready.front().filename);
+		impl->readyBytes -= impl->ready.front().size;
+		impl->ready.pop_front();
+		impl->producerCond.notify_one();
+		return true;
+	}
+
+	size_t file_prefetcher::window() const {
+		std::lock_guard<std::mutex> lock(impl->mutex);
+		return impl->window;
+	}
+
+	static const int POOL_MIN_CLASS = 12;
+	static const int POOL_HUGE_CLASS = 21;
+	static const int POOL_CLASS_COUNT = 64;
+
+	struct _buffer_pool_impl {
+		std::mutex mutex;
+		std::vector<unsigned char*> freeLists[POOL_CLASS_COUNT];
+		size_t cachedBytes;
+		size_t maxCachedBytes;
+
+		static int size_class(size_t size) {
+			int c = POOL_MIN_CLASS;
+			while (c < POOL_CLASS_COUNT - 1 && ((size_t)1 << c) < size) c++;
+			return c;
+		}
+
+		static unsigned char* allocate(int c) {
+			size_t capacity = (size_t)1 << c;
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+			if (c >= POOL_HUGE_CLASS) {
+				void* p = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (p == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+				madvise(p, capacity, MADV_HUGEPAGE);
+#endif
+				return (unsigned char*)p;
+			}
+#endif
+			void* p = malloc(capacity);
+			if (p == NULL) throw std::bad_alloc();
+			return (unsigned char*)p;
+		}
+
+		static void free_buffer(unsigned char* p, int c) {
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+			if (c >= POOL_HUGE_CLASS) {
+				munmap(p, (size_t)1 << c);
+				return;
+			}
+#endif
+			free(p);
+		}
+
+		void release(unsigned char* p, size_t capacity) {
+			int c = size_class(capacity);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (cachedBytes + capacity <= maxCachedBytes) {
+					freeLists[c].push_back(p);
+					cachedBytes += capacity;
+					return;
+				}
+			}
+			free_buffer(p, c);
+		}
+
+		void trim() {
+			std::lock_guard<std::mutex> lock(mutex);
+			for (int c = 0; c < POOL_CLASS_COUNT; c++) {
+				for (size_t i = 0; i < freeLists[c].size(); i++) free_buffer(freeLists[c][i], c);
+				freeLists[c].clear();
+			}
+			cachedBytes = 0;
+		}
+	};
+
+	pooled_buffer::pooled_buffer() : pool(NULL), _Data(NULL), _Size(0), _Capacity(0) {
+	}
+
+	pooled_buffer::pooled_buffer(pooled_buffer&& other) : pool(other.pool), _Data(other._Data), _Size(other._Size), _Capacity(other._Capacity) {
+		other.pool = NULL;
+		other._Data = NULL;
+		other._Size = other._Capacity = 0;
+	}
+
+	pooled_buffer& pooled_buffer::operator=(pooled_buffer&& other) {
+		if (this != &other) {
+			reset();
+			std::swap(pool, other.pool);
+			std::swap(_Data, other._Data);
+			std::swap(_Size, other._Size);
+			std::swap(_Capacity, other._Capacity);
+		}
+		return *this;
+	}
+
+	pooled_buffer::~pooled_buffer() {
+		reset();
+	}
+
+	void pooled_buffer::resize(size_t size) {
+		if (size > _Capacity) throw std::invalid_argument("size");
+		_Size = size;
+	}
+
+	void pooled_buffer::reset() {
+		if (_Data != NULL) pool->release(_Data, _Capacity);
+		pool = NULL;
+		_Data = NULL;
+		_Size = _Capacity = 0;
+	}
+
+	buffer_pool::buffer_pool(size_t maxCachedBytes /*= 256 * 1024 * 1024*/) {
+		impl = new _buffer_pool_impl();
+		impl->cachedBytes = 0;
+		impl->maxCachedBytes = maxCachedBytes;
+	}
+
+	buffer_pool::~buffer_pool() {
+		impl->trim();
+		delete impl;
+	}
+
+	pooled_buffer buffer_pool::acquire(size_t size) {
+		int c = _buffer_pool_impl::size_class(size);
+		pooled_buffer buffer;
+		{
+			std::lock_guard<std::mutex> lock(impl->mutex);
+			std::vector<unsigned char*>& freeList = impl->freeLists[c];
+			if (!freeList.empty()) {
+				buffer._Data = freeList.back();
+				freeList.pop_back();
+				impl->cachedBytes -= (size_t)1 << c;
+			}
+		}
+		if (buffer._Data == NULL) buffer._Data = _buffer_pool_impl::allocate(c);
+		buffer.pool = impl;
+		buffer._Capacity = (size_t)1 << c;
+		buffer._Size = size;
+		return buffer;
+	}
+
+	size_t buffer_pool::cached_bytes() const {
+		std::lock_guard<std::mutex> lock(impl->mutex);
+		return impl->cachedBytes;
+	}
+
+	void buffer_pool::trim() {
+		impl->trim();
+	}
+
+	void _read_all_bytes(const std::string& filename, const std::function<unsigned char*(size_t size)>& allocate) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+
+		// Read with the system calls, a stream would allocate its own buffer on every call.
+		size_t pos = 0;
+#ifdef _WIN32
+		HANDLE hFile = ::CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile == INVALID_HANDLE_VALUE) throw io_exception((int)::GetLastError());
+		DWORD error = 0;
+		size_t size = 0;
+		try {
+			LARGE_INTEGER fileSize;
+			if (!::GetFileSizeEx(hFile, &fileSize)) throw io_exception((int)::GetLastError());
+			size = (size_t)fileSize.QuadPart;
+			unsigned char* data = allocate(size);
+			while (pos < size) {
+				DWORD n = 0;
+				if (!::ReadFile(hFile, data + pos, (DWORD)std::min<size_t>(size - pos, 0x40000000), &n, NULL)) {
+					error = ::GetLastError();
+					break;
+				}
+				if (n == 0) break;
+				pos += n;
+			}
+		}
+		catch (...) {
+			::CloseHandle(hFile);
+			throw;
+		}
+		::CloseHandle(hFile);
+		if (error != 0) throw io_exception((int)error);
+#else
+		_fd_guard file(::open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+		if (file.fd == -1) throw io_exception(errno);
+		struct stat st;
+		if (fstat(file.fd, &st) == -1) throw io_exception(errno);
+		size_t size = (size_t)st.st_size;
+		unsigned char* data = allocate(size);
+		while (pos < size) {
+			ssize_t n = ::read(file.fd, data + pos, size - pos);
+			if (n == -1 && errno == EINTR) continue;
+			if (n == -1) throw io_exception(errno);
+			if (n == 0) break;
+			pos += (size_t)n;
+		}
+#endif // _WIN32
+		// The file shrank while reading, shrinking keeps the data read.
+		if (pos < size) allocate(pos);
+	}
+
+	void read_all_bytes(const std::string& filename, buffer_pool& pool, pooled_buffer& buffer) {
+		_read_all_bytes(filename, [&pool, &buffer](size_t size) {
+			if (buffer.data() != NULL && size <= buffer.capacity())
+				buffer.resize(size);
+			else
+				buffer = pool.acquire(size);
+			return buffer.data();
+		});
+	}
+
+#ifndef _WIN32
+	// Max count of iovec in one call, IOV_MAX is not defined everywhere.
+	static size_t _iov_max() {
+#ifdef IOV_MAX
+		return IOV_MAX;
+#else
+		long n = sysconf(_SC_IOV_MAX);
+		return n > 0 ? (size_t)n : 16;
+#endif
+	}
+
+	// Fill iovecs from the buffers, starting at buffer index and skipping done bytes of it.
+	template<class Buffer>
+	static size_t _fill_iovecs(const Buffer* buffers, size_t count, size_t index, size_t done, std::vector<struct iovec>& iovs) {
+		size_t n = 0;
+		size_t max = iovs.size();
+		for (size_t i = index; i < count && n < max; i++) {
+			size_t skip = i == index ? done : 0;
+			if (buffers[i].length == skip) continue;
+			iovs[n].iov_base = (void*)(buffers[i].data + skip);
+			iovs[n].iov_len = buffers[i].length - skip;
+			n++;
+		}
+		return n;
+	}
+
+	// Move index and done forward by bytes.
+	template<class Buffer>
+	static void _advance_buffers(const Buffer* buffers, size_t count, size_t& index, size_t& done, size_t bytes) {
+		while (index < count) {
+			size_t left = buffers[index].length - done;
+			if (bytes < left) {
+				done += bytes;
+				return;
+			}
+			bytes -= left;
+			index++;
+			done = 0;
+		}
+	}
+#endif // _WIN32
+
+	void write_all_bytes(const std::string& filename, const const_buffer* buffers, size_t count, bool bAppend /*= false*/) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+		if (buffers == NULL && count != 0) throw std::invalid_argument("buffers");
+
+#ifdef _WIN32
+		std::ofstream ofs;
+		if (bAppend)
+			ofs.open(filename, std::ios::binary | std::ios::ate | std::ios::app);
+		else
+			ofs.open(filename, std::ios::binary | std::ios::ate | std::ios::out);
+
+		if (!ofs.is_open()) throw io_exception();
+		_invalidate_metadata_caches(filename, false);
+		for (size_t i = 0; i < count; i++) ofs.write((const char*)buffers[i].data, buffers[i].length);
+		if (!ofs) throw io_exception();
+#else
+		int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (bAppend ? O_APPEND : O_TRUNC);
+		_fd_guard file(::open(filename.c_str(), flags, 0666));
+		if (file.fd == -1) throw io_exception();
+		_invalidate_metadata_caches(filename, false);
+
+		// Partial writes resume in the middle of a buffer.
+		std::vector<struct iovec> iovs(std::min(_iov_max(), std::max<size_t>(count, 1)));
+		size_t index = 0, done = 0;
+		while (true) {
+			size_t n = _fill_iovecs(buffers, count, index, done, iovs);
+			if (n == 0) break;
+			ssize_t written = ::writev(file.fd, iovs.data(), (int)n);
+			if (written == -1 && errno == EINTR) continue;
+			if (written <= 0) throw io_exception();
+			_advance_buffers(buffers, count, index, done, (size_t)written);
+		}
+#endif // _WIN32
+	}
+
+	void write_all_bytes(const std::string& filename, const std::vector<const_buffer>& buffers, bool bAppend /*= false*/) {
+		write_all_bytes(filename, buffers.data(), buffers.size(), bAppend);
+	}
+
+	size_t read_bytes(const std::string& filename, const mutable_buffer* buffers, size_t count, unsigned long long offset /*= 0*/) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+		if (buffers == NULL && count != 0) throw std::invalid_argument("buffers");
+
+#ifdef _WIN32
+		std::ifstream ifs;
+		ifs.open(filename, std::ios::binary);
+		if (!ifs.is_open()) throw io_exception();
+		ifs.seekg((std::streamoff)offset, std::ios::beg);
+		size_t total = 0;
+		for (size_t i = 0; i < count && ifs; i++) {
+			ifs.read((char*)buffers[i].data, buffers[i].length);
+			total += (size_t)ifs.gcount();
+		}
+		return total;
+#else
+		_fd_guard file(::open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+		if (file.fd == -1) throw io_exception();
+
+		std::vector<struct iovec> iovs(std::min(_iov_max(), std::max<size_t>(count, 1)));
+		size_t index = 0, done = 0, total = 0;
+#ifndef __linux__
+		if (lseek(file.fd, (off_t)offset, SEEK_SET) == -1) throw io_exception();
+#endif
+		while (true) {
+			size_t n = _fill_iovecs(buffers, count, index, done, iovs);
+			if (n == 0) break;
+#ifdef __linux__
+			ssize_t r = ::preadv(file.fd, iovs.data(), (int)n, (off_t)(offset + total));
+#else
+			ssize_t r = ::readv(file.fd, iovs.data(), (int)n);
+#endif
+			if (r == -1 && errno == EINTR) continue;
+			if (r == -1) throw io_exception();
+			if (r == 0) break;
+			_advance_buffers(buffers, count, index, done, (size_t)r);
+			total += (size_t)r;
+		}
+		return total;
+#endif // _WIN32
+	}
+
+	size_t read_bytes(const std::string& filename, const std::vector<mutable_buffer>& buffers, unsigned long long offset /*= 0*/) {
+		return read_bytes(filename, buffers.data(), buffers.size(), offset);
+	}
+
+	append_options::append_options() {
+		ringSize = 65536;
+		flushInterval = 10;
+		syncPolicy = SP_NONE;
+		syncInterval = 1000;
+		rotateSize = 0;
+		rotateInterval = 0;
+	}
+
+	static const size_t APPEND_BATCH_SIZE = 1024 * 1024;
+
+	// A file opened for appending.
+	class _append_file {
+	public:
+#ifdef _WIN32
+		_append_file() : handle(INVALID_HANDLE_VALUE) { }
+#else
+		_append_file() : fd(-1) { }
+#endif // _WIN32
+		~_append_file() { close(); }
+
+		// Open the file, return its size.
+		unsigned long long open(const std::string& filename) {
+#ifdef _WIN32
+			handle = ::CreateFileA(filename.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (handle == INVALID_HANDLE_VALUE) throw io_exception();
+			LARGE_INTEGER size;
+			if (!::GetFileSizeEx(handle, &size)) throw io_exception();
+			return (unsigned long long)size.QuadPart;
+#else
+			fd = ::open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+			if (fd == -1) throw io_exception();
+			struct stat st;
+			if (fstat(fd, &st) == -1) throw io_exception();
+			return (unsigned long long)st.st_size;
+#endif // _WIN32
+		}
+
+		void write(const char* p, size_t n) {
+			while (n > 0) {
+#ifdef _WIN32
+				DWORD written = 0;
+				DWORD k = (DWORD)std::min<size_t>(n, 0x40000000);
+				if (!::WriteFile(handle, p, k, &written, NULL)) throw io_exception();
+#else
+				ssize_t written = ::write(fd, p, n);
+				if (written == -1 && errno == EINTR) continue;
+				if (written <= 0) throw io_exception();
+#endif // _WIN32
+				p += written;
+				n -= (size_t)written;
+			}
+		}
+
+		void sync() {
+#ifdef _WIN32
+			if (!::FlushFileBuffers(handle)) throw io_exception();
+#elif defined(__linux__)
+			if (fdatasync(fd) == -1) throw io_exception();
+#else
+			if (fsync(fd) == -1) throw io_exception();
+#endif // _WIN32
+		}
+
+		void close() {
+#ifdef _WIN32
+			if (handle != INVALID_HANDLE_VALUE) ::CloseHandle(handle);
+			handle = INVALID_HANDLE_VALUE;
+#else
+			if (fd != -1) ::close(fd);
+			fd = -1;
+#endif // _WIN32
+		}
+	private:
+#ifdef _WIN32
+		HANDLE handle;
+#else
+		int fd;
+#endif // _WIN32
+	};
+
+	// A cell of the ring buffer, the string keeps its capacity across records.
+	struct _append_cell {
+		std::atomic<size_t> sequence;
+		std::string data;
+	};
+
+	struct _append_writer_impl {
+		std::string filename;
+		append_options options;
+		_append_file file;
+		unsigned long long fileSize;
+		std::chrono::steady_clock::time_point fileOpened;
+		std::chrono::steady_clock::time_point lastSync;
+		std::atomic<size_t> rotations;
+		size_t nextRotation;
+
+		// Bounded multi-producer queue (Vyukov), with the flusher as the only consumer.
+		std::unique_ptr<_append_cell[]> cells;
+		size_t mask;
+		char pad0[64];
+		std::atomic<size_t> enqueuePos;
+		char pad1[64];
+		size_t dequeuePos;
+		std::atomic<bool> failed;
+
+		std::mutex mutex;
+		std::condition_variable flusherCond;
+		std::condition_variable flushedCond;
+		size_t flushTarget;
+		size_t flushRequested;
+		size_t flushCompleted;
+		bool stopping;
+		std::thread flusher;
+
+		void push(const unsigned char* data, size_t length) {
+			size_t pos = enqueuePos.load(std::memory_order_relaxed);
+			int spins = 0;
+			while (true) {
+				_append_cell& cell = cells[pos & mask];
+				size_t seq = cell.sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0) {
+					if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						cell.data.assign((const char*)data, length);
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						return;
+					}
+				}
+				else if (diff < 0) {
+					// Full, wake the flusher and wait for a free cell.
+					if (failed.load()) throw io_exception();
+					if (++spins == 64) {
+						flusherCond.notify_one();
+						spins = 0;
+					}
+					std::this_thread::yield();
+					pos = enqueuePos.load(std::memory_order_relaxed);
+				}
+				else {
+					pos = enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Move ready records to the batch, return the count of records moved.
+		size_t drain(std::string& batch) {
+			size_t count = 0;
+			while (batch.size() < APPEND_BATCH_SIZE) {
+				_append_cell& cell = cells[dequeuePos & mask];
+				if (cell.sequence.load(std::memory_order_acquire) != dequeuePos + 1) break;
+				batch.append(cell.data);
+				cell.data.clear();
+				cell.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+				dequeuePos++;
+				count++;
+			}
+			return count;
+		}
+
+		void open_file() {
+			fileSize = file.open(filename);
+			fileOpened = std::chrono::steady_clock::now();
+			lastSync = fileOpened;
+		}
+
+		void rotate() {
+			if (options.syncPolicy != SP_NONE) file.sync();
+			file.close();
+			while (_get_path_type(filename + "." + std::to_string(nextRotation)) != 0) nextRotation++;
+			cx::rename(filename, filename + "." + std::to_string(nextRotation++));
+			rotations++;
+			open_file();
+		}
+
+		bool rotation_due(std::chrono::steady_clock::time_point now) const {
+			if (fileSize == 0) return false;
+			if (options.rotateSize > 0 && fileSize >= options.rotateSize) return true;
+			return options.rotateInterval > 0 && now - fileOpened >= std::chrono::seconds(options.rotateInterval);
+		}
+
+		void run() {
+			std::string batch;
+			batch.reserve(APPEND_BATCH_SIZE + 4096);
+			while (true) {
+				size_t count = 0;
+				try {
+					while (true) {
+						batch.clear();
+						size_t n = drain(batch);
+						if (n == 0) break;
+						count += n;
+						file.write(batch.data(), batch.size());
+						fileSize += batch.size();
+						if (options.rotateSize > 0 && fileSize >= options.rotateSize) rotate();
+					}
+
+					std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+					if (count > 0 && (options.syncPolicy == SP_COMMIT ||
+						(options.syncPolicy == SP_INTERVAL && now - lastSync >= std::chrono::milliseconds(options.syncInterval)))) {
+						file.sync();
+						lastSync = now;
+					}
+					if (rotation_due(now)) rotate();
+				}
+				catch (...) {
+					failed = true;
+				}
+
+				std::unique_lock<std::mutex> lock(mutex);
+				if (flushRequested > flushCompleted && !failed && dequeuePos >= flushTarget) {
+					// All records appended before the flush requests are written.
+					if (count == 0 || options.syncPolicy != SP_COMMIT) {
+						try {
+							file.sync();
+							lastSync = std::chrono::steady_clock::now();
+						}
+						catch (...) {
+							failed = true;
+						}
+					}
+					flushCompleted = flushRequested;
+					flushedCond.notify_all();
+				}
+				if (failed) flushedCond.notify_all();
+				if (stopping && (dequeuePos == enqueuePos.load() || failed)) break;
+				if (count > 0) continue;
+				if (flushRequested > flushCompleted && !failed) {
+					// Wait for the records being published.
+					lock.unlock();
+					std::this_thread::yield();
+					continue;
+				}
+				flusherCond.wait_for(lock, std::chrono::milliseconds(std::max<unsigned int>(options.flushInterval, 1)));
+			}
+
+			if (!failed && options.syncPolicy != SP_NONE) {
+				try {
+					file.sync();
+				}
+				catch (...) {
+					failed = true;
+				}
+			}
+		}
+	};
+
+	append_writer::append_writer(const std::string& filename, const append_options& options /*= append_options()*/) {
+		if (filename.empty()) throw std::invalid_argument("filename");
+		std::unique_ptr<_append_writer_impl> p(new _append_writer_impl());
+		p->filename = filename;
+		p->options = options;
+		p->open_file();
+		_invalidate_metadata_caches(filename, false);
+		p->rotations = 0;
+		p->nextRotation = 1;
+
+		size_t ringSize = 2;
+		while (ringSize < options.ringSize) ringSize <<= 1;
+		p->cells.reset(new _append_cell[ringSize]);
+		for (size_t i = 0; i < ringSize; i++) p->cells[i].sequence.store(i, std::memory_order_relaxed);
+		p->mask = ringSize - 1;
+		p->enqueuePos = 0;
+		p->dequeuePos = 0;
+		p->failed = false;
+		p->flushTarget = 0;
+		p->flushRequested = 0;
+		p->flushCompleted = 0;
+		p->stopping = false;
+		p->flusher = std::thread(&_append_writer_impl::run, p.get());
+		impl = p.release();
+	}
+
+	append_writer::~append_writer() {
+		{
+			std::lock_guard<std::mutex> lock(impl->mutex);
+			impl->stopping = true;
+			impl->flusherCond.notify_one();
+		}
+		impl->flusher.join();
+		delete impl;
+	}
+
+	void append_writer::append(const unsigned char* data, size_t length) {
+		if (impl->failed.load(std::memory_order_relaxed)) throw io_exception();
+		impl->push(data, length);
+	}
+
+	void append_writer::flush() {
+		std::unique_lock<std::mutex> lock(impl->mutex);
+		impl->flushTarget = std::max(impl->flushTarget, impl->enqueuePos.load());
+		size_t request = ++impl->flushRequested;
+		impl->flusherCond.notify_one();
+		impl->flushedCond.wait(lock, [this, request]() { return impl->flushCompleted >= request || impl->failed; });
+		if (impl->failed) throw io_exception();
+	}
+
+	size_t append_writer::rotation_count() const {
+		return impl->rotations.load();
+	}
+
+	// Parent directory of a path, "/" for the entries of the root.
+	static std::string _directory_of(const std::string& path) {
+		std::string dir = get_parent_directory(path);
+		if (dir.empty() && !path.empty() && _is_separator(path[0])) dir = path.substr(0, 1);
+		return dir;
+	}
+
+#ifndef _WIN32
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+	// renameat2, emulated where the system call or the file system flags are not supported.
+	// Return 0 or errno.
+	static int _renameat2(int oldDirFd, const char* oldName, int newDirFd, const char* newName, unsigned int flags) {
+#if defined(__linux__) && defined(SYS_renameat2)
+		if (flags != 0) {
+			if (syscall(SYS_renameat2, oldDirFd, oldName, newDirFd, newName, flags) == 0) return 0;
+			if (errno != ENOSYS && errno != EINVAL) return errno;
+			if (flags & RENAME_EXCHANGE) return errno == ENOSYS ? ENOTSUP : EINVAL;
+		}
+#endif
+		if (flags & RENAME_EXCHANGE) return ENOTSUP;
+		if (flags & RENAME_NOREPLACE) {
+			// A hard link fails atomically if the target exists, then the source name is dropped.
+			// Directories cannot be hard linked, checking then renaming would not be atomic.
+			if (linkat(oldDirFd, oldName, newDirFd, newName, 0) == -1) {
+				if (errno == EPERM || errno == EMLINK || errno == EOPNOTSUPP) return ENOTSUP;
+				return errno;
+			}
+			if (unlinkat(oldDirFd, oldName, 0) == -1) {
+				int r = errno;
+				unlinkat(newDirFd, newName, 0);
+				return r;
+			}
+			return 0;
+		}
+		return renameat(oldDirFd, oldName, newDirFd, newName) == 0 ? 0 : errno;
+	}
+
+	// Directory fds opened by a move group, closed when the group ends.
+	class _directory_fds {
+	public:
+		~_directory_fds() {
+			for (std::map<std::string, int>::iterator i = fds.begin(); i != fds.end(); ++i) {
+				if (i->second != -1) ::close(i->second);
+			}
+		}
+
+		// Return the fd, or -1 with errno set.
+		int get(const std::string& dirName) {
+			std::map<std::string, int>::iterator i = fds.find(dirName);
+			if (i != fds.end()) {
+				if (i->second == -1) errno = errors[dirName];
+				return i->second;
+			}
+			int fd = ::open(dirName.empty() ? "." : dirName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			fds[dirName] = fd;
+			if (fd == -1) errors[dirName] = errno;
+			return fd;
+		}
+	private:
+		std::map<std::string, int> fds;
+		std::map<std::string, int> errors;
+	};
+
+	// Copy a regular file to another device, then unlink the source.
+	static int _move_across_devices(const std::string& source, const std::string& target, int newDirFd, const std::string& targetName, unsigned int flags) {
+		struct stat st;
+		if (lstat(source.c_str(), &st) == -1) return errno;
+		if (!S_ISREG(st.st_mode)) return EXDEV;
+		if ((flags & RENAME_NOREPLACE) && fstatat(newDirFd, targetName.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) return EEXIST;
+
+		// Copy next to the target, then move it in place, so the target is never seen partially written.
+		std::string tempName = "." + targetName + ".cxmove" + std::to_string((unsigned long long)getpid());
+		std::string tempFile = combine_paths(_directory_of(target), tempName);
+		try {
+			copy_file(source, tempFile);
+		}
+		catch (const io_exception& e) {
+			unlinkat(newDirFd, tempName.c_str(), 0);
+			return e.error_code() != 0 ? e.error_code() : EIO;
+		}
+		int r = _renameat2(newDirFd, tempName.c_str(), newDirFd, targetName.c_str(), flags);
+		if (r != 0) {
+			unlinkat(newDirFd, tempName.c_str(), 0);
+			return r;
+		}
+		return ::unlink(source.c_str()) == 0 ? 0 : errno;
+	}
+#endif // _WIN32
+
+	static int _move_file(const std::string& source, const std::string& target, int flags, void* context) {
+#ifdef _WIN32
+		(void)context;
+		if (flags & MF_EXCHANGE) return ERROR_NOT_SUPPORTED;
+		DWORD moveFlags = 0;
+		if (!(flags & MF_NOREPLACE)) moveFlags |= MOVEFILE_REPLACE_EXISTING;
+		if (!(flags & MF_NOCOPY)) moveFlags |= MOVEFILE_COPY_ALLOWED;
+		if (::MoveFileExA(source.c_str(), target.c_str(), moveFlags)) return 0;
+		DWORD error = ::GetLastError();
+		return (int)(error == 0 ? ERROR_GEN_FAILURE : error);
+#else
+		_directory_fds& fds = *(_directory_fds*)context;
+		std::string sourceName = get_filename(source), targetName = get_filename(target);
+		if (sourceName.empty() || targetName.empty()) return EINVAL;
+		int oldDirFd = fds.get(_directory_of(source));
+		if (oldDirFd == -1) return errno;
+		int newDirFd = fds.get(_directory_of(target));
+		if (newDirFd == -1) return errno;
+
+		unsigned int renameFlags = 0;
+		if (flags & MF_NOREPLACE) renameFlags |= RENAME_NOREPLACE;
+		if (flags & MF_EXCHANGE) renameFlags |= RENAME_EXCHANGE;
+		int r = _renameat2(oldDirFd, sourceName.c_str(), newDirFd, targetName.c_str(), renameFlags);
+		if (r == EXDEV && !(flags & (MF_NOCOPY | MF_EXCHANGE))) r = _move_across_devices(source, target, newDirFd, targetName, renameFlags);
+		return r;
+#endif // _WIN32
+	}
+
+	size_t move_files(const std::vector<move_request>& requests, std::vector<int>& errors, int flags /*= MF_NONE*/, int threads /*= 0*/) {
+		if ((flags & MF_NOREPLACE) && (flags & MF_EXCHANGE)) throw std::invalid_argument("flags");
+		for (size_t i = 0; i < requests.size(); i++) {
+			if (requests[i].source.empty() || requests[i].target.empty()) throw std::invalid_argument("requests");
+		}
+
+		// Group by target directory, keeping the request order within a group.
+		std::map<std::string, std::vector<size_t> > groupMap;
+		for (size_t i = 0; i < requests.size(); i++) groupMap[_directory_of(requests[i].target)].push_back(i);
+		std::vector<const std::vector<size_t>*> groups;
+		for (std::map<std::string, std::vector<size_t> >::const_iterator i = groupMap.begin(); i != groupMap.end(); ++i) groups.push_back(&i->second);
+
+		errors.assign(requests.size(), 0);
+		std::atomic<size_t> moved(0);
+		_parallel_for(groups.size(), threads, [&](size_t g) {
+#ifdef _WIN32
+			void* context = NULL;
+#else
+			_directory_fds fds;
+			void* context = &fds;
+#endif // _WIN32
+			const std::vector<size_t>& group = *groups[g];
+			for (size_t k = 0; k < group.size(); k++) {
+				const move_request& request = requests[group[k]];
+				errors[group[k]] = _move_file(request.source, request.target, flags, context);
+				_invalidate_metadata_caches(request.source, true);
+				_invalidate_metadata_caches(request.target, true);
+				if (errors[group[k]] == 0) moved++;
+			}
+		});
+		return moved;
+	}
+
+	static const unsigned char WALK_CHECKPOINT_MAGIC[4] = { 'C', 'X', 'W', 'K' };
+	static const uint32_t WALK_CHECKPOINT_VERSION = 2;
+
+	// Little endian serialization of walk checkpoints.
+	class _checkpoint_writer {
+	public:
+		void put32(uint32_t v) {
+			unsigned char b[4];
+			_write32le(b, v);
+			data.append((const char*)b, 4);
+		}
+
+		void put64(uint64_t v) {
+			unsigned char b[8];
+			_write64le(b, v);
+			data.append((const char*)b, 8);
+		}
+
+		void put_string(const std::string& s) {
+			put32((uint32_t)s.size());
+			data.append(s);
+		}
+
+		std::string data;
+	};
+
+	class _checkpoint_reader {
+	public:
+		_checkpoint_reader(const std::vector<unsigned char>& data) : p(data.data()), end(data.data() + data.size()) { }
+
+		uint32_t get32() {
+			need(4);
+			uint32_t v = _read32le(p);
+			p += 4;
+			return v;
+		}
+
+		uint64_t get64() {
+			need(8);
+			uint64_t v = _read64le(p);
+			p += 8;
+			return v;
+		}
+
+		std::string get_string() {
+			size_t n = get32();
+			need(n);
+			std::string s((const char*)p, n);
+			p += n;
+			return s;
+		}
+
+		bool at_end() const { return p == end; }
+	private:
+		void need(size_t n) {
+			if ((size_t)(end - p) < n) throw io_exception();
+		}
+
+		const unsigned char* p;
+		const unsigned char* end;
+	};
+
+	static uint64_t _double_bits(double d) {
+		uint64_t v;
+		memcpy(&v, &d, sizeof(v));
+		return v;
+	}
+
+	static double _bits_double(uint64_t v) {
+		double d;
+		memcpy(&d, &v, sizeof(d));
+		return d;
+	}
+
+	// Write a whole file and flush it to the disk, so renaming it over an older one never exposes a partial file.
+	static void _write_synced_file(const std::string& filename, const unsigned char* data, size_t length, std::error_code& ec) noexcept {
+		ec.clear();
+#ifdef _WIN32
+		HANDLE hFile = ::CreateFileA(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE) {
+			ec.assign((int)::GetLastError(), std::system_category());
+			return;
+		}
+		while (length > 0) {
+			DWORD n = 0;
+			if (!::WriteFile(hFile, data, (DWORD)std::min<size_t>(length, 0x40000000), &n, NULL)) {
+				ec.assign((int)::GetLastError(), std::system_category());
+				break;
+			}
+			data += n;
+			length -= n;
+		}
+		if (!ec && !::FlushFileBuffers(hFile)) ec.assign((int)::GetLastError(), std::system_category());
+		::CloseHandle(hFile);
+#else
+		int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (fd == -1) {
+			ec.assign(errno, std::system_category());
+			return;
+		}
+		_write_all_fd(fd, data, length, ec);
+		if (!ec && fsync(fd) == -1) ec.assign(errno, std::system_category());
+		if (::close(fd) == -1 && !ec) ec.assign(errno, std::system_category());
+#endif // _WIN32
+	}
+
+	bool recursive_directory_range::mark_visited(unsigned long long device, unsigned long long inode) {
+		size_t count = visited->count;
+		if (!visited->insert(device, inode)) return false;
+		// Kept for the next checkpoint once a side file was written, before that the whole set is written.
+		if (visited->count != count && !visitedFile.empty()) unsavedVisited.push_back(std::make_pair(device, inode));
+		return true;
+	}
+
+#ifndef _WIN32
+	// Write the visited records to the side file from the record index first, the records after it are dropped.
+	static void _write_visited_records(const std::string& filename, unsigned long long first, const std::vector<std::pair<unsigned long long, unsigned long long> >& records) {
+		_checkpoint_writer w;
+		for (size_t i = 0; i < records.size(); i++) {
+			w.put64(records[i].first);
+			w.put64(records[i].second);
+		}
+		_fd_guard file(::open(filename.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666));
+		if (file.fd == -1) throw io_exception(errno);
+		if (ftruncate(file.fd, (off_t)(first * 16)) == -1) throw io_exception(errno);
+		_pwrite_all(file.fd, (const unsigned char*)w.data.data(), w.data.size(), first * 16);
+		if (fsync(file.fd) == -1) throw io_exception(errno);
+	}
+#endif // _WIN32
+
+	void recursive_directory_range::save_checkpoint(const std::string& filename) const {
+		if (filename.empty()) throw std::invalid_argument("filename");
+		write_checkpoint(filename, positioned);
+	}
+
+	void recursive_directory_range::write_checkpoint(const std::string& filename, bool keepCurrent) const {
+		_checkpoint_writer w;
+		w.data.append((const char*)WALK_CHECKPOINT_MAGIC, 4);
+		w.put32(WALK_CHECKPOINT_VERSION);
+		w.put_string(dname);
+		w.put32((uint32_t)_Options.order);
+		w.put32((started ? 1 : 0) | (_Finished ? 2 : 0) | (keepCurrent ? 4 : 0));
+		w.put32((uint32_t)baseDepth);
+		w.put64(rootDevice);
+		w.put_string(pendingDir);
+		if (keepCurrent) {
+			w.put_string(current.filename);
+			w.put32((uint32_t)current.type);
+			w.put32((uint32_t)current.depth);
+			w.put32(current.symlink ? 1 : 0);
+		}
+
+		// Open directories, with the count of entries taken from each.
+		w.put32((uint32_t)stackDirs.size());
+		for (size_t i = 0; i < stackDirs.size(); i++) {
+			w.put_string(stackDirs[i]);
+			w.put64(consumed[i] ? positions[i] : 0);
+		}
+
+		if (frontier) {
+			const _walk_frontier& f = *frontier;
+			w.put64(f.seq);
+			w.put64(f.size());
+			for (size_t i = 0; i < f.size(); i++) {
+				const _walk_frontier_item& item = f.order == TO_PRIORITY ? f.heap[i] : f.queue[i];
+				w.put_string(item.filename);
+				w.put32((uint32_t)item.depth);
+				w.put64(_double_bits(item.score));
+				w.put64(item.seq);
+			}
+		}
+		else {
+			w.put64(0);
+			w.put64(0);
+		}
+
+		// The visited set only grows, it is kept in an append-only side file, so a save writes the new
+		// directories only. The checkpoint records how many of its records are valid.
+		size_t visitedCount = visited ? visited->count : 0;
+#ifndef _WIN32
+		if (visitedCount > 0) {
+			std::string sideFile = filename + ".visited";
+			if (sideFile != visitedFile) {
+				std::vector<std::pair<unsigned long long, unsigned long long> > records;
+				records.reserve(visitedCount);
+				for (size_t i = 0; i < visited->slots.size(); i++) {
+					if (visited->slots[i].second != 0) records.push_back(visited->slots[i]);
+				}
+				_write_visited_records(sideFile, 0, records);
+			}
+			else if (!unsavedVisited.empty()) {
+				_write_visited_records(sideFile, visitedSaved, unsavedVisited);
+			}
+			visitedFile = sideFile;
+			visitedSaved = visitedCount;
+			unsavedVisited.clear();
+		}
+#endif // _WIN32
+		w.put64(visitedCount);
+
+		// The previous checkpoint is only replaced once the new one is on the disk.
+		std::string tempFile = filename + ".tmp";
+		std::error_code ec;
+		_write_synced_file(tempFile, (const unsigned char*)w.data.data(), w.data.size(), ec);
+		if (!ec) rename(tempFile, filename, ec);
+		if (ec) {
+			std::error_code ignored;
+			remove_file(tempFile, ignored);
+			throw io_exception(ec.value());
+		}
+	}
+
+	void recursive_directory_range::load_checkpoint(const std::string& filename) {
+		std::vector<unsigned char> data;
+		read_all_bytes(filename, data);
+		_checkpoint_reader r(data);
+		if (data.size() < 8 || memcmp(data.data(), WALK_CHECKPOINT_MAGIC, 4) != 0) throw io_exception();
+		r.get32();
+		if (r.get32() != WALK_CHECKPOINT_VERSION) throw io_exception();
+		if (r.get_string() != dname || r.get32() != (uint32_t)_Options.order) throw std::invalid_argument("checkpointFile");
+
+		uint32_t flags = r.get32();
+		started = (flags & 1) != 0;
+		_Finished = (flags & 2) != 0;
+		baseDepth = (int)r.get32();
+		rootDevice = r.get64();
+		pendingDir = r.get_string();
+		if (flags & 4) {
+			current.filename = r.get_string();
+			current.type = (EnumFileType)r.get32();
+			current.depth = (int)r.get32();
+			current.symlink = r.get32() != 0;
+			positioned = true;
+		}
+
+		// Reopen the directories and skip the entries taken before.
+		// Each level is inside the one before, once a level is gone the deeper ones are skipped.
+		uint32_t levels = r.get32();
+		bool restoring = true;
+		for (uint32_t i = 0; i < levels; i++) {
+			std::string dirName = r.get_string();
+			uint64_t position = r.get64();
+			if (!restoring) continue;
+
+			std::unique_ptr<file_enumerator> fe(new file_enumerator());
+			if (_Options.filters == EFT_DIR) fe->filters(_Options.filters);
+			std::error_code ec;
+			bool found = fe->begin(dirName, ec);
+			for (uint64_t k = 1; k < position && found; k++) found = fe->next();
+			if (!found) {
+				restoring = false;
+				continue;
+			}
+
+			stack.push_back(std::move(fe));
+			consumed.push_back(position > 0);
+			stackDirs.push_back(dirName);
+			positions.push_back(position);
+		}
+
+		uint64_t seq = r.get64();
+		uint64_t frontierCount = r.get64();
+		for (uint64_t i = 0; i < frontierCount; i++) {
+			_walk_frontier_item item;
+			item.filename = r.get_string();
+			item.depth = (int)r.get32();
+			item.score = _bits_double(r.get64());
+			item.seq = r.get64();
+			if (!frontier) throw io_exception();
+			if (frontier->order == TO_PRIORITY) {
+				frontier->heap.push_back(item);
+				std::push_heap(frontier->heap.begin(), frontier->heap.end(), _walk_frontier::lower);
+			}
+			else {
+				frontier->queue.push_back(item);
+			}
+		}
+		if (frontier) frontier->seq = seq;
+
+		uint64_t visitedCount = r.get64();
+		if (!r.at_end()) throw io_exception();
+		if (visitedCount > 0 || _Options.oneFileSystem || _Options.followSymlinks) visited.reset(new _inode_set());
+		if (visitedCount > 0) {
+			// Records after the count were appended for a checkpoint which was not written.
+			std::string sideFile = filename + ".visited";
+			std::vector<unsigned char> records;
+			read_all_bytes(sideFile, records);
+			if (records.size() / 16 < visitedCount) throw io_exception();
+			_checkpoint_reader vr(records);
+			for (uint64_t i = 0; i < visitedCount; i++) {
+				uint64_t device = vr.get64();
+				uint64_t inode = vr.get64();
+				visited->insert(device, inode);
+			}
+			visitedFile = sideFile;
+			visitedSaved = visitedCount;
+		}
+	}
+
+	struct _scan_unit {
+		directory_entry entry;
+		unsigned long long estimate;
+		bool subtree;
+	};
+
+	// Estimate the entries of a subtree from the count of its children.
+	static unsigned long long _estimate_subtree(const std::string& dirName) {
+		std::error_code ec;
+		file_enumerator fe;
+		if (!fe.begin(dirName, ec)) return 1;
+		unsigned long long count = 1;
+		do {
+			count++;
+		} while (fe.next());
+		return count;
+	}
+
+	// List the children of a directory as units, subtrees for directories.
+	static void _list_scan_units(const std::string& dirName, int depth, std::vector<_scan_unit>& units) {
+		file_enumerator fe;
+		if (!fe.begin(dirName)) return;
+		do {
+			_scan_unit unit;
+			unit.entry.filename = fe.filename();
+			unit.entry.type = fe.file_type();
+			unit.entry.depth = depth;
+			unit.entry.symlink = fe.is_symlink();
+			unit.subtree = unit.entry.type == EFT_DIR && !unit.entry.symlink;
+			unit.estimate = unit.subtree ? _estimate_subtree(unit.entry.filename) : 1;
+			units.push_back(unit);
+		} while (fe.next());
+	}
+
+	void partition_scan(const std::string& dirName, size_t shardCount, std::vector<scan_shard>& shards) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		if (shardCount == 0) throw std::invalid_argument("shardCount");
+
+		std::vector<_scan_unit> units, split;
+		_list_scan_units(dirName, 1, units);
+		unsigned long long total = 0;
+		for (size_t i = 0; i < units.size(); i++) total += units[i].estimate;
+
+		// Split the directories larger than a shard into their children, the directory itself is a single entry.
+		unsigned long long shardSize = total / shardCount + 1;
+		for (size_t i = 0; i < units.size(); i++) {
+			if (shardCount > 1 && units[i].subtree && units[i].estimate > shardSize) {
+				_scan_unit self = units[i];
+				self.subtree = false;
+				self.estimate = 1;
+				split.push_back(self);
+				_list_scan_units(units[i].entry.filename, 2, split);
+			}
+			else {
+				split.push_back(units[i]);
+			}
+		}
+
+		// Largest first to the least loaded shard, ties broken by name so the result is deterministic.
+		std::sort(split.begin(), split.end(), [](const _scan_unit& a, const _scan_unit& b) {
+			if (a.estimate != b.estimate) return a.estimate > b.estimate;
+			return a.entry.filename < b.entry.filename;
+		});
+		shards.assign(shardCount, scan_shard());
+		for (size_t i = 0; i < split.size(); i++) {
+			size_t target = 0;
+			for (size_t k = 1; k < shardCount; k++) {
+				if (shards[k].estimatedEntries < shards[target].estimatedEntries) target = k;
+			}
+			scan_shard& shard = shards[target];
+			if (split[i].subtree)
+				shard.subtrees.push_back(split[i].entry);
+			else
+				shard.entries.push_back(split[i].entry);
+			shard.estimatedEntries += split[i].estimate;
+		}
+	}
+
+	enum _QueryKind {
+		QK_ALL,
+		QK_AND,
+		QK_OR,
+		QK_NOT,
+		QK_SIZE_MIN,
+		QK_SIZE_MAX,
+		QK_MTIME_MIN,
+		QK_MTIME_MAX,
+		QK_TYPE,
+		QK_NAME,
+		QK_PATH,
+		QK_DEPTH_MIN,
+		QK_DEPTH_MAX
+	};
+
+	struct _query_node {
+		_query_node(_QueryKind kind, int cost) : kind(kind), number(0), cost(cost) { }
+
+		_QueryKind kind;
+		long long number;
+		std::string pattern;
+		std::vector<std::shared_ptr<_query_node> > children;
+		int cost;
+	};
+
+	// Relative costs: depth and type come with the entry, names need a glob match, sizes and times a stat.
+	static const int QUERY_COST_ENTRY = 1;
+	static const int QUERY_COST_NAME = 4;
+	static const int QUERY_COST_PATH = 8;
+	static const int QUERY_COST_STAT = 100;
+
+	static std::shared_ptr<_query_node> _query_leaf(_QueryKind kind, int cost, long long number, const std::string& pattern = std::string()) {
+		std::shared_ptr<_query_node> node = std::make_shared<_query_node>(kind, cost);
+		node->number = number;
+		node->pattern = pattern;
+		return node;
+	}
+
+	// Combine with and/or, merging nested nodes of the same kind, the cheapest children first.
+	static std::shared_ptr<_query_node> _query_combine(_QueryKind kind, const std::shared_ptr<_query_node>& a, const std::shared_ptr<_query_node>& b) {
+		std::shared_ptr<_query_node> node = std::make_shared<_query_node>(kind, 0);
+		const std::shared_ptr<_query_node>* operands[2] = { &a, &b };
+		for (int i = 0; i < 2; i++) {
+			const std::shared_ptr<_query_node>& operand = *operands[i];
+			if (operand->kind == kind)
+				node->children.insert(node->children.end(), operand->children.begin(), operand->children.end());
+			else
+				node->children.push_back(operand);
+		}
+		std::stable_sort(node->children.begin(), node->children.end(),
+			[](const std::shared_ptr<_query_node>& x, const std::shared_ptr<_query_node>& y) { return x->cost < y->cost; });
+		for (size_t i = 0; i < node->children.size(); i++) node->cost += node->children[i]->cost;
+		return node;
+	}
+
+	file_query::file_query() : node(std::make_shared<_query_node>(QK_ALL, 0)) {
+	}
+
+	file_query::file_query(const std::shared_ptr<_query_node>& node) : node(node) {
+	}
+
+	file_query file_query::size_at_least(unsigned long long size) {
+		return file_query(_query_leaf(QK_SIZE_MIN, QUERY_COST_STAT, (long long)size));
+	}
+
+	file_query file_query::size_at_most(unsigned long long size) {
+		return file_query(_query_leaf(QK_SIZE_MAX, QUERY_COST_STAT, (long long)size));
+	}
+
+	file_query file_query::modified_after(long long time) {
+		return file_query(_query_leaf(QK_MTIME_MIN, QUERY_COST_STAT, time));
+	}
+
+	file_query file_query::modified_before(long long time) {
+		return file_query(_query_leaf(QK_MTIME_MAX, QUERY_COST_STAT, time));
+	}
+
+	file_query file_query::type(int filters) {
+		return file_query(_query_leaf(QK_TYPE, QUERY_COST_ENTRY, filters));
+	}
+
+	file_query file_query::name(const std::string& pattern) {
+		return file_query(_query_leaf(QK_NAME, QUERY_COST_NAME, 0, pattern));
+	}
+
+	file_query file_query::path(const std::string& pattern) {
+		return file_query(_query_leaf(QK_PATH, QUERY_COST_PATH, 0, pattern));
+	}
+
+	file_query file_query::depth_at_least(int depth) {
+		return file_query(_query_leaf(QK_DEPTH_MIN, QUERY_COST_ENTRY, depth));
+	}
+
+	file_query file_query::depth_at_most(int depth) {
+		return file_query(_query_leaf(QK_DEPTH_MAX, QUERY_COST_ENTRY, depth));
+	}
+
+	file_query file_query::operator&&(const file_query& other) const {
+		return file_query(_query_combine(QK_AND, node, other.node));
+	}
+
+	file_query file_query::operator||(const file_query& other) const {
+		return file_query(_query_combine(QK_OR, node, other.node));
+	}
+
+	file_query file_query::operator!() const {
+		if (node->kind == QK_NOT) return file_query(node->children[0]);
+		std::shared_ptr<_query_node> result = std::make_shared<_query_node>(QK_NOT, node->cost);
+		result->children.push_back(node);
+		return file_query(result);
+	}
+
+	// Match a bracket expression at pattern against ch, end is set after the closing bracket.
+	// A bracket without its closing bracket is a literal.
+	static bool _glob_bracket(const char* pattern, char ch, const char*& end) {
+		const char* p = pattern + 1;
+		bool negate = *p == '!';
+		if (negate) p++;
+		bool matched = false;
+		const char* start = p;
+		while (*p && (*p != ']' || p == start)) {
+			if (p[1] == '-' && p[2] && p[2] != ']') {
+				if ((unsigned char)ch >= (unsigned char)p[0] && (unsigned char)ch <= (unsigned char)p[2]) matched = true;
+				p += 3;
+			}
+			else {
+				if (ch == *p) matched = true;
+				p++;
+			}
+		}
+		if (*p != ']') {
+			end = pattern + 1;
+			return ch == '[';
+		}
+		end = p + 1;
+		return matched != negate;
+	}
+
+	// Match text with a glob pattern, '*' matching any characters including the separators.
+	static bool _glob_match(const char* pattern, const char* text) {
+		const char* starPattern = NULL;
+		const char* starText = NULL;
+		while (*text) {
+			if (*pattern == '*') {
+				starPattern = ++pattern;
+				starText = text;
+				continue;
+			}
+			if (*pattern == '[') {
+				const char* end;
+				if (_glob_bracket(pattern, *text, end)) {
+					pattern = end;
+					text++;
+					continue;
+				}
+			}
+			else if (*pattern && (*pattern == '?' || *pattern == *text)) {
+				pattern++;
+				text++;
+				continue;
+			}
+			// Backtrack: the last '*' takes one more character.
+			if (!starPattern) return false;
+			pattern = starPattern;
+			text = ++starText;
+		}
+		while (*pattern == '*') pattern++;
+		return *pattern == 0;
+	}
+
+	struct _query_entry {
+		std::string filename;
+		const char* name;
+		int type;
+		int depth;
+		int statState;
+		unsigned long long size;
+		long long mtime;
+#ifndef _WIN32
+		int dirFd;
+#endif // _WIN32
+	};
+
+	// Stat the entry once, on the first size or time predicate.
+	static bool _query_stat(_query_entry& entry) {
+		if (entry.statState == 0) {
+			entry.statState = -1;
+#ifdef _WIN32
+			file_status status;
+			if (get_file_status(entry.filename, status)) {
+				entry.size = status.size;
+				entry.mtime = status.mtime;
+				entry.statState = 1;
+			}
+#else
+			struct stat st;
+			if (fstatat(entry.dirFd, entry.name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+				entry.size = (unsigned long long)st.st_size;
+				entry.mtime = (long long)st.st_mtime;
+				entry.statState = 1;
+			}
+#endif // _WIN32
+		}
+		return entry.statState == 1;
+	}
+
+	static bool _query_eval(const _query_node& node, _query_entry& entry) {
+		switch (node.kind) {
+		case QK_ALL:
+			return true;
+		case QK_AND:
+			for (size_t i = 0; i < node.children.size(); i++) {
+				if (!_query_eval(*node.children[i], entry)) return false;
+			}
+			return true;
+		case QK_OR:
+			for (size_t i = 0; i < node.children.size(); i++) {
+				if (_query_eval(*node.children[i], entry)) return true;
+			}
+			return false;
+		case QK_NOT:
+			return !_query_eval(*node.children[0], entry);
+		case QK_SIZE_MIN:
+			return _query_stat(entry) && entry.size >= (unsigned long long)node.number;
+		case QK_SIZE_MAX:
+			return _query_stat(entry) && entry.size <= (unsigned long long)node.number;
+		case QK_MTIME_MIN:
+			return _query_stat(entry) && entry.mtime >= node.number;
+		case QK_MTIME_MAX:
+			return _query_stat(entry) && entry.mtime < node.number;
+		case QK_TYPE:
+			return (entry.type & node.number) != 0;
+		case QK_NAME:
+			return _glob_match(node.pattern.c_str(), entry.name);
+		case QK_PATH:
+			return _glob_match(node.pattern.c_str(), entry.filename.c_str());
+		case QK_DEPTH_MIN:
+			return entry.depth >= node.number;
+		case QK_DEPTH_MAX:
+			return entry.depth <= node.number;
+		}
+		return false;
+	}
+
+	enum _QueryTruth {
+		QT_NEVER,
+		QT_MAYBE,
+		QT_ALWAYS
+	};
+
+	// Whether the query may match the entries below a directory, which are all deeper than depth
+	// and whose paths start with the directory path.
+	static _QueryTruth _query_subtree(const _query_node& node, const std::string& dirName, int depth) {
+		switch (node.kind) {
+		case QK_ALL:
+			return QT_ALWAYS;
+		case QK_AND: {
+			_QueryTruth truth = QT_ALWAYS;
+			for (size_t i = 0; i < node.children.size(); i++) {
+				_QueryTruth child = _query_subtree(*node.children[i], dirName, depth);
+				if (child == QT_NEVER) return QT_NEVER;
+				if (child == QT_MAYBE) truth = QT_MAYBE;
+			}
+			return truth;
+		}
+		case QK_OR: {
+			_QueryTruth truth = QT_NEVER;
+			for (size_t i = 0; i < node.children.size(); i++) {
+				_QueryTruth child = _query_subtree(*node.children[i], dirName, depth);
+				if (child == QT_ALWAYS) return QT_ALWAYS;
+				if (child == QT_MAYBE) truth = QT_MAYBE;
+			}
+			return truth;
+		}
+		case QK_NOT: {
+			_QueryTruth child = _query_subtree(*node.children[0], dirName, depth);
+			return child == QT_NEVER ? QT_ALWAYS : child == QT_ALWAYS ? QT_NEVER : QT_MAYBE;
+		}
+		case QK_DEPTH_MIN:
+			return depth + 1 >= node.number ? QT_ALWAYS : QT_MAYBE;
+		case QK_DEPTH_MAX:
+			return depth + 1 > node.number ? QT_NEVER : QT_MAYBE;
+		case QK_PATH: {
+			// The paths below start with the directory path and a separator, the pattern
+			// with the characters before its first wildcard: one must be a prefix of the other.
+			size_t literal = node.pattern.find_first_of("*?[");
+			if (literal == std::string::npos) literal = node.pattern.size();
+			std::string prefix = combine_paths(dirName, "x");
+			prefix.resize(prefix.size() - 1);
+			size_t common = std::min(literal, prefix.size());
+			return node.pattern.compare(0, common, prefix, 0, common) == 0 ? QT_MAYBE : QT_NEVER;
+		}
+		default:
+			return QT_MAYBE;
+		}
+	}
+
+	// Evaluate the query on the entries of a directory, the sub-directories to walk are appended to subdirs.
+	static bool _find_in_directory(const std::string& dirName, int depth, const _query_node& query,
+		std::vector<directory_entry>& matches, std::vector<std::pair<std::string, int> >& subdirs) {
+		_query_entry entry;
+		directory_entry match;
+#ifdef _WIN32
+		file_enumerator fe;
+		std::error_code ec;
+		if (!fe.begin(dirName, ec)) return !ec;
+		do {
+			entry.filename = fe.filename();
+			size_t sep = entry.filename.find_last_of("\\/");
+			entry.name = entry.filename.c_str() + (sep == std::string::npos ? 0 : sep + 1);
+			entry.type = fe.file_type();
+			bool symlink = fe.is_symlink();
+#else
+		DIR* hDir = opendir(dirName.c_str());
+		if (hDir == NULL) return false;
+		entry.dirFd = dirfd(hDir);
+		struct dirent* d;
+		while ((d = readdir(hDir)) != NULL) {
+			bool symlink = false;
+			entry.type = _dirent_file_type(hDir, d, symlink);
+			if (entry.type == 0) continue;
+			entry.filename = combine_paths(dirName, d->d_name);
+			entry.name = d->d_name;
+#endif // _WIN32
+			entry.depth = depth;
+			entry.statState = 0;
+			if (_query_eval(query, entry)) {
+				match.filename = entry.filename;
+				match.type = (EnumFileType)entry.type;
+				match.depth = depth;
+				match.symlink = symlink;
+				matches.push_back(match);
+			}
+			if (entry.type == EFT_DIR && !symlink && _query_subtree(query, entry.filename, depth) != QT_NEVER) {
+				subdirs.push_back(std::make_pair(entry.filename, depth + 1));
+			}
+#ifdef _WIN32
+		} while (fe.next());
+#else
+		}
+		closedir(hDir);
+#endif // _WIN32
+		return true;
+	}
+
+	typedef std::pair<std::string, int> _walk_item;
+
+	static int _worker_count(int threads) {
+		if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+		if (threads <= 0) threads = 1;
+		return threads;
+	}
+
+	// Walk a tree on worker threads sharing a stack of directories, visit(item, worker, subdirs) appends the
+	// sub-directories to walk. The walk ends when the stack is empty and no worker is busy.
+	// The first exception is rethrown.
+	static void _parallel_walk(std::vector<_walk_item>& pending, int threads,
+		const std::function<void(const _walk_item&, int, std::vector<_walk_item>&)>& visit) {
+		std::mutex mutex;
+		std::condition_variable cv;
+		size_t busy = 0;
+		std::exception_ptr error;
+		auto work = [&](int index) {
+			std::vector<_walk_item> subdirs;
+			std::unique_lock<std::mutex> lock(mutex);
+			for (;;) {
+				while (pending.empty() && busy > 0 && !error) cv.wait(lock);
+				if (pending.empty() || error) {
+					cv.notify_all();
+					return;
+				}
+				_walk_item item = std::move(pending.back());
+				pending.pop_back();
+				busy++;
+				lock.unlock();
+
+				subdirs.clear();
+				try {
+					visit(item, index, subdirs);
+				} catch (...) {
+					lock.lock();
+					if (!error) error = std::current_exception();
+					busy--;
+					cv.notify_all();
+					return;
+				}
+
+				lock.lock();
+				busy--;
+				for (size_t i = 0; i < subdirs.size(); i++) pending.push_back(std::move(subdirs[i]));
+				cv.notify_all();
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (int i = 1; i < threads; i++) workers.push_back(std::thread(work, i));
+		work(0);
+		for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+		if (error) std::rethrow_exception(error);
+	}
+
+	void find_files(const std::string& dirName, const file_query& query, std::vector<directory_entry>& matches, int threads /*= 0*/) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		matches.clear();
+
+		const _query_node& root = *query.node;
+		std::vector<_walk_item> pending;
+		if (!_find_in_directory(dirName, 1, root, matches, pending)) throw io_exception(errno);
+
+		threads = _worker_count(threads);
+		std::vector<std::vector<directory_entry> > found(threads);
+		_parallel_walk(pending, threads, [&](const _walk_item& dir, int worker, std::vector<_walk_item>& subdirs) {
+			_find_in_directory(dir.first, dir.second, root, found[worker], subdirs);
+		});
+
+		for (size_t i = 0; i < found.size(); i++) matches.insert(matches.end(), found[i].begin(), found[i].end());
+		std::sort(matches.begin(), matches.end(), [](const directory_entry& a, const directory_entry& b) { return a.filename < b.filename; });
+	}
+
+#ifdef _WIN32
+	static void _clone_directory(const std::string& srcDir, const std::string& dstDir, CloneMode mode, clone_stats& stats) {
+		if (!::CreateDirectoryA(dstDir.c_str(), NULL) && ::GetLastError() != ERROR_ALREADY_EXISTS) throw io_exception((int)::GetLastError());
+		stats.directories++;
+
+		file_enumerator fe;
+		if (!fe.begin(srcDir)) return;
+		do {
+			std::string name = fe.filename().substr(fe.filename().find_last_of("\\/") + 1);
+			std::string target = combine_paths(dstDir, name);
+			if (fe.file_type() == EFT_DIR) {
+				_clone_directory(fe.filename(), target, mode, stats);
+			}
+			else if (mode == CM_HARDLINK && ::CreateHardLinkA(target.c_str(), fe.filename().c_str(), NULL)) {
+				stats.linked++;
+			}
+			else {
+				if (!::CopyFileA(fe.filename().c_str(), target.c_str(), TRUE)) throw io_exception((int)::GetLastError());
+				stats.copied++;
+			}
+		} while (fe.next());
+	}
+#else
+#if defined(__linux__) && !defined(FICLONE)
+#define FICLONE _IOW(0x94, 9, int)
+#endif // __linux__
+
+	struct _clone_context {
+		int srcRoot;
+		int dstRoot;
+		CloneMode mode;
+		std::atomic<size_t> directories;
+		std::atomic<size_t> linked;
+		std::atomic<size_t> reflinked;
+		std::atomic<size_t> copied;
+		std::atomic<size_t> symlinks;
+		std::mutex mutex;
+		std::vector<std::pair<std::string, mode_t> > dirModes;
+	};
+
+	static void _clone_file(_clone_context& context, int srcDirFd, int dstDirFd, const char* name) {
+		if (context.mode == CM_HARDLINK) {
+			if (linkat(srcDirFd, name, dstDirFd, name, 0) == 0) {
+				context.linked++;
+				return;
+			}
+			if (errno != EXDEV && errno != EMLINK && errno != EPERM) throw io_exception(errno);
+		}
+
+		_fd_guard src(openat(srcDirFd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+		if (src.fd == -1) throw io_exception(errno);
+		struct stat st;
+		if (fstat(src.fd, &st) == -1) throw io_exception(errno);
+		_fd_guard dst(openat(dstDirFd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777));
+		if (dst.fd == -1) throw io_exception(errno);
+#ifdef __linux__
+		if (context.mode != CM_COPY && ioctl(dst.fd, FICLONE, src.fd) == 0) {
+			if (fchmod(dst.fd, st.st_mode & 07777) == -1) throw io_exception(errno);
+			context.reflinked++;
+			return;
+		}
+#endif // __linux__
+		_copy_data(src.fd, dst.fd, st);
+		context.copied++;
+	}
+
+	// Clone the entries of a directory, relative to the roots. The sub-directories are created first,
+	// writable by their owner until the end of the clone, and appended to subdirs.
+	static void _clone_directory(_clone_context& context, const std::string& path, std::vector<_walk_item>& subdirs) {
+		const char* name = path.empty() ? "." : path.c_str();
+		int srcFd = openat(context.srcRoot, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (srcFd == -1) throw io_exception(errno);
+		DIR* hDir = fdopendir(srcFd);
+		if (hDir == NULL) {
+			int error = errno;
+			close(srcFd);
+			throw io_exception(error);
+		}
+		std::unique_ptr<DIR, int (*)(DIR*)> dirGuard(hDir, closedir);
+		_fd_guard dst(openat(context.dstRoot, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+		if (dst.fd == -1) throw io_exception(errno);
+
+		std::vector<std::string> files;
+		std::vector<std::pair<std::string, mode_t> > dirModes;
+		std::vector<char> target;
+		dirent* d;
+		while ((d = readdir(hDir)) != NULL) {
+			bool symlink = false;
+			int type = _dirent_file_type(hDir, d, symlink);
+			if (type == 0) continue;
+
+			if (symlink) {
+				target.resize(PATH_MAX);
+				ssize_t length = readlinkat(srcFd, d->d_name, target.data(), target.size() - 1);
+				if (length == -1) throw io_exception(errno);
+				target[length] = 0;
+				if (symlinkat(target.data(), dst.fd, d->d_name) == -1) throw io_exception(errno);
+				context.symlinks++;
+			}
+			else if (type == EFT_DIR) {
+				struct stat st;
+				if (fstatat(srcFd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) throw io_exception(errno);
+				if (mkdirat(dst.fd, d->d_name, 0700) == -1) throw io_exception(errno);
+				std::string subdir = path.empty() ? std::string(d->d_name) : path + '/' + d->d_name;
+				dirModes.push_back(std::make_pair(subdir, st.st_mode & 07777));
+				subdirs.push_back(std::make_pair(subdir, 0));
+				context.directories++;
+			}
+			else {
+				files.push_back(d->d_name);
+			}
+		}
+
+		// The sub-directories are handed to the other workers before the files are populated.
+		for (size_t i = 0; i < files.size(); i++) _clone_file(context, srcFd, dst.fd, files[i].c_str());
+
+		std::lock_guard<std::mutex> lock(context.mutex);
+		context.dirModes.insert(context.dirModes.end(), dirModes.begin(), dirModes.end());
+	}
+#endif // _WIN32
+
+	clone_stats clone_directories(const std::string& srcDir, const std::string& dstDir, CloneMode mode /*= CM_HARDLINK*/, int threads /*= 0*/) {
+		if (srcDir.empty()) throw std::invalid_argument("srcDir");
+		if (dstDir.empty()) throw std::invalid_argument("dstDir");
+		_scoped_invalidation invalidation(dstDir, true);
+
+		clone_stats stats;
+#ifdef _WIN32
+		(void)threads;
+		_clone_directory(srcDir, dstDir, mode, stats);
+#else
+		_fd_guard srcRoot(::open(srcDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+		if (srcRoot.fd == -1) throw io_exception(errno);
+		struct stat st;
+		if (fstat(srcRoot.fd, &st) == -1) throw io_exception(errno);
+		if (mkdir(dstDir.c_str(), 0700) == -1 && errno != EEXIST) throw io_exception(errno);
+		_fd_guard dstRoot(::open(dstDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+		if (dstRoot.fd == -1) throw io_exception(errno);
+
+		_clone_context context;
+		context.srcRoot = srcRoot.fd;
+		context.dstRoot = dstRoot.fd;
+		context.mode = mode;
+		context.directories = 1;
+		context.linked = 0;
+		context.reflinked = 0;
+		context.copied = 0;
+		context.symlinks = 0;
+
+		std::vector<_walk_item> pending(1, _walk_item(std::string(), 0));
+		_parallel_walk(pending, _worker_count(threads), [&context](const _walk_item& dir, int, std::vector<_walk_item>& subdirs) {
+			_clone_directory(context, dir.first, subdirs);
+		});
+
+		for (size_t i = 0; i < context.dirModes.size(); i++) {
+			if (fchmodat(dstRoot.fd, context.dirModes[i].first.c_str(), context.dirModes[i].second, 0) == -1) throw io_exception(errno);
+		}
+		if (fchmod(dstRoot.fd, st.st_mode & 07777) == -1) throw io_exception(errno);
+
+		stats.directories = context.directories;
+		stats.linked = context.linked;
+		stats.reflinked = context.reflinked;
+		stats.copied = context.copied;
+		stats.symlinks = context.symlinks;
+#endif // _WIN32
+		return stats;
+	}
+
+#ifndef _WIN32
+#ifndef O_PATH
+#define O_PATH O_RDONLY
+#endif // O_PATH
+#endif // _WIN32
+
+	directory_context::directory_context(const std::string& dirName) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+#ifdef _WIN32
+		char buf[MAX_PATH];
+		DWORD length = ::GetFullPathNameA(dirName.c_str(), MAX_PATH, buf, NULL);
+		if (length == 0 || length >= MAX_PATH) throw io_exception((int)::GetLastError());
+		if (!cx::is_directory(buf)) throw io_exception(ERROR_DIRECTORY);
+		dname = buf;
+		fd = -1;
+#else
+		fd = ::open(dirName.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (fd == -1) throw io_exception(errno);
+		dname = dirName;
+#endif // _WIN32
+	}
+
+	directory_context::directory_context(const directory_context& parent, const std::string& relName) {
+		if (relName.empty()) throw std::invalid_argument("relName");
+		dname = parent.resolve(relName);
+#ifdef _WIN32
+		if (!cx::is_directory(dname)) throw io_exception(ERROR_DIRECTORY);
+		fd = -1;
+#else
+		fd = ::openat(parent.fd, relName.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (fd == -1) throw io_exception(errno);
+#endif // _WIN32
+	}
+
+	directory_context::~directory_context() {
+#ifndef _WIN32
+		::close(fd);
+#endif // _WIN32
+	}
+
+	const std::string& directory_context::path() const {
+		return dname;
+	}
+
+	std::string directory_context::resolve(const std::string& relName) const {
+		if (relName.empty()) return dname;
+#ifdef _WIN32
+		if (_is_separator(relName[0]) || (relName.size() > 1 && relName[1] == ':')) return relName;
+#else
+		if (_is_separator(relName[0])) return relName;
+#endif // _WIN32
+		return combine_paths(dname, relName);
+	}
+
+	int directory_context::native_handle() const {
+		return fd;
+	}
+
+	bool directory_context::is_file(const std::string& relName) const {
+#ifdef _WIN32
+		return cx::is_file(resolve(relName));
+#else
+		struct stat st;
+		return !relName.empty() && fstatat(fd, relName.c_str(), &st, 0) == 0 && S_ISREG(st.st_mode);
+#endif // _WIN32
+	}
+
+	bool directory_context::is_directory(const std::string& relName) const {
+#ifdef _WIN32
+		return cx::is_directory(resolve(relName));
+#else
+		struct stat st;
+		return !relName.empty() && fstatat(fd, relName.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode);
+#endif // _WIN32
+	}
+
+	bool directory_context::get_file_status(const std::string& relName, file_status& status) const {
+		if (relName.empty()) return false;
+#ifdef _WIN32
+		if (!cx::get_file_status(resolve(relName), status)) return false;
+#else
+		struct stat st;
+		if (fstatat(fd, relName.c_str(), &st, 0) == -1) return false;
+		if (!_fill_file_status(st, status)) return false;
+#endif // _WIN32
+		status.filename = relName;
+		return true;
+	}
+
+	bool directory_context::create_directory(const std::string& relName) const {
+		if (relName.empty()) throw std::invalid_argument("relName");
+#ifdef _WIN32
+		bool r = ::CreateDirectoryA(resolve(relName).c_str(), NULL) == TRUE;
+#else
+		bool r = mkdirat(fd, relName.c_str(), 0777) == 0;
+#endif // _WIN32
+		if (r) _invalidate_metadata_caches(resolve(relName), false);
+		return r;
+	}
+
+	bool directory_context::remove_directory(const std::string& relName) const {
+		if (relName.empty()) throw std::invalid_argument("relName");
+#ifdef _WIN32
+		bool r = ::RemoveDirectoryA(resolve(relName).c_str()) == TRUE;
+#else
+		bool r = unlinkat(fd, relName.c_str(), AT_REMOVEDIR) == 0;
+#endif // _WIN32
+		if (r) _invalidate_metadata_caches(resolve(relName), false);
+		return r;
+	}
+
+	bool directory_context::remove_file(const std::string& relName) const {
+		if (relName.empty()) throw std::invalid_argument("relName");
+#ifdef _WIN32
+		return cx::remove_file(resolve(relName));
+#else
+		if (unlinkat(fd, relName.c_str(), 0) == 0) {
+			_invalidate_metadata_caches(resolve(relName), false);
+			return true;
+		}
+		if (errno == ENOENT) return false;
+		throw io_exception(errno);
+#endif // _WIN32
+	}
+
+	void directory_context::rename(const std::string& oldName, const std::string& newName) const {
+		if (oldName.empty()) throw std::invalid_argument("oldName");
+		if (newName.empty()) throw std::invalid_argument("newName");
+#ifdef _WIN32
+		cx::rename(resolve(oldName), resolve(newName));
+#else
+		if (renameat(fd, oldName.c_str(), fd, newName.c_str()) == -1) throw io_exception(errno);
+		_invalidate_metadata_caches(resolve(oldName), true);
+		_invalidate_metadata_caches(resolve(newName), true);
+#endif // _WIN32
+	}
+
+	void directory_context::read_all_bytes(const std::string& relName, std::vector<unsigned char>& data) const {
+		if (relName.empty()) throw std::invalid_argument("relName");
+#ifdef _WIN32
+		cx::read_all_bytes(resolve(relName), data);
+#else
+		_fd_guard file(::openat(fd, relName.c_str(), O_RDONLY | O_CLOEXEC));
+		if (file.fd == -1) throw io_exception(errno);
+		std::error_code ec;
+		_read_all_fd(file.fd, data, ec);
+		if (ec) throw io_exception(ec.value());
+#endif // _WIN32
+	}
+
+	void directory_context::write_all_bytes(const std::string& relName, const unsigned char* data, size_t length, bool bAppend /*= false*/) const {
+		if (relName.empty()) throw std::invalid_argument("relName");
+#ifdef _WIN32
+		cx::write_all_bytes(resolve(relName), data, length, bAppend);
+#else
+		int file = ::openat(fd, relName.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (bAppend ? O_APPEND : O_TRUNC), 0666);
+		if (file == -1) throw io_exception(errno);
+		std::error_code ec;
+		_write_all_fd(file, data, length, ec);
+		if (::close(file) == -1 && !ec) ec.assign(errno, std::system_category());
+		_invalidate_metadata_caches(resolve(relName), false);
+		if (ec) throw io_exception(ec.value());
+#endif // _WIN32
+	}
+
+	void directory_context::write_all_bytes(const std::string& relName, const std::vector<unsigned char>& data, bool bAppend /*= false*/) const {
+		write_all_bytes(relName, data.data(), data.size(), bAppend);
+	}
+
+	bool file_enumerator::begin(const directory_context& context, const std::string& relDir) {
+		if (started) return false;
+#ifdef _WIN32
+		if (!begin(context.resolve(relDir))) return false;
+		// Output the names relative to the context.
+		dname = relDir;
+		fname = combine_paths(relDir, get_filename(fname));
+		return true;
+#else
+		int dirFd = ::openat(context.native_handle(), relDir.empty() ? "." : relDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirFd == -1) throw io_exception(errno);
+		DIR* hDir = fdopendir(dirFd);
+		if (hDir == NULL) {
+			int error = errno;
+			::close(dirFd);
+			throw io_exception(error);
+		}
+		dname = relDir;
+		nativeEnumerator = hDir;
+		started = true;
+		if (next()) return true;
+		end();
+		return false;
+#endif // _WIN32
 	}
 
 }
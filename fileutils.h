@@ -25,14 +25,29 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <memory>
+#include <iterator>
 #include <stdexcept>
+#include <system_error>
 
 /** @brief cx namespace. */
 namespace cx {
 	/**
 	 * @brief I/O exception.
 	 */
-	class io_exception : public std::exception { };
+	class io_exception : public std::exception {
+	public:
+		io_exception() : code(0) { }
+		explicit io_exception(int errorCode) : code(errorCode) { }
+
+		/**
+		 * @brief Get the system error code, errno on POSIX or GetLastError() on Windows. 0 if unknown.
+		 */
+		int error_code() const { return code; }
+	private:
+		int code;
+	};
 
 	/**
 	 * @brief Combine two paths together.
@@ -138,7 +153,7 @@ namespace cx {
 	bool remove_directories(const std::string& path);
 
 	/**
-	 * @brief Remove a file.
+	 * @brief Remove a file. A symbolic link is removed itself, not the file it refers to.
 	 * @param path Directory name.
 	 * @return true if successful, or false if the file did not exists.
 	 * @throw invalid_argument When path is empty.
@@ -148,6 +163,15 @@ namespace cx {
 	 */
 	bool remove_file(const std::string& path);
 
+	/**
+	 * @brief Remove a file, without throwing.
+	 * @param path Directory name.
+	 * @param ec The output error: errno on POSIX or GetLastError() on Windows, in system_category,
+	 *   or errc::invalid_argument when path is empty. Cleared if successful or the file did not exist.
+	 * @return true if successful, or false if the file did not exists or failed.
+	 */
+	bool remove_file(const std::string& path, std::error_code& ec) noexcept;
+
 	/**
 	 * @brief Rename or move a file or directory.
 	 * @param oldName Old file name.
@@ -157,6 +181,96 @@ namespace cx {
 	 */
 	void rename(const std::string& oldName, const std::string& newName);
 
+	/**
+	 * @brief Rename or move a file or directory, without throwing.
+	 * @param oldName Old file name.
+	 * @param newName New file name.
+	 * @param ec The output error: errno in system_category, or errc::invalid_argument when a name is empty.
+	 *   Cleared if successful.
+	 */
+	void rename(const std::string& oldName, const std::string& newName, std::error_code& ec) noexcept;
+
+	struct _metadata_cache_impl;
+
+	/**
+	 * @brief A bounded, thread-safe cache for is_file and is_directory queries.
+	 * Entries are kept in sharded LRU lists and expire after a time to live.
+	 * Paths which do not exist are cached too, with their own time to live.
+	 * Paths are used as given, "a/b" and "./a/b" are different entries.
+	 * All live caches are invalidated by the mutators of this library:
+	 * create_directory, create_directories, remove_directory, remove_directories,
+	 * remove_file, rename and write_all_bytes.
+	 * Example:
+	 * @code
+	 * 	cx::metadata_cache cache(10000, 5000);
+	 * 	if (cache.is_file(path)) { ... }
+	 * @endcode
+	 */
+	class metadata_cache {
+	public:
+		/**
+		 * @brief Constructor.
+		 * @param capacity Max count of cached paths.
+		 * @param ttl Time to live of an existing entry in milliseconds. 0: never expire.
+		 * @param negativeTtl Time to live of a not-found entry in milliseconds. 0: never expire.
+		 */
+		metadata_cache(size_t capacity = 4096, unsigned int ttl = 1000, unsigned int negativeTtl = 100);
+
+		~metadata_cache();
+
+		/**
+		 * @brief Cached version of cx::is_file.
+		 * @param path The file name to check.
+		 * @return true if the file exists, or false if not.
+		 */
+		bool is_file(const std::string& path);
+
+		/**
+		 * @brief Cached version of cx::is_directory.
+		 * @param path The directory name to check.
+		 * @return true if the directory exists, or false if not.
+		 */
+		bool is_directory(const std::string& path);
+
+		/**
+		 * @brief Remove a path from the cache.
+		 * @param path The path.
+		 */
+		void invalidate(const std::string& path);
+
+		/**
+		 * @brief Remove a path and all paths under it from the cache.
+		 * @param path The path.
+		 */
+		void invalidate_tree(const std::string& path);
+
+		/**
+		 * @brief Remove all paths from the cache.
+		 */
+		void clear();
+
+		/**
+		 * @brief Get count of cached paths.
+		 * @return Count of cached paths.
+		 */
+		size_t size() const;
+
+		/**
+		 * @brief Invalidate the entries of a directory on changes made by other processes.
+		 * The directory is watched with inotify by a background thread, sub-directories are not watched.
+		 * Only supported on Linux.
+		 * @param dirName The directory to watch.
+		 * @return true if successful, or false if failed or not supported.
+		 * @throw invalid_argument When dirName is empty.
+		 */
+		bool watch(const std::string& dirName);
+	private:
+		_metadata_cache_impl* impl;
+	public:
+		metadata_cache(const metadata_cache&) = delete;
+		metadata_cache& operator=(const metadata_cache&) = delete;
+	};
+
 	/**
 	 * @brief The output file type in enumeration.
 	 */
@@ -172,6 +286,68 @@ namespace cx {
 		EFT_FILE = 2
 	};
 
+	/**
+	 * @brief File status of a directory entry.
+	 */
+	struct file_status {
+		/**
+		 * @brief Full path of the entry.
+		 */
+		std::string filename;
+
+		/**
+		 * @brief File type.
+		 */
+		EnumFileType type;
+
+		/**
+		 * @brief Inode number. Always 0 on Windows.
+		 */
+		unsigned long long inode;
+
+		/**
+		 * @brief Id of the device containing the entry. Always 0 on Windows.
+		 */
+		unsigned long long device;
+
+		/**
+		 * @brief File size in bytes.
+		 */
+		unsigned long long size;
+
+		/**
+		 * @brief Last modification time in seconds since the epoch.
+		 */
+		long long mtime;
+	};
+
+	/**
+	 * @brief Get the status of a file or directory.
+	 * @param path The file name.
+	 * @param status The output status.
+	 * @return true if successful, or false if the path does not exist or is neither a file nor a directory.
+	 */
+	bool get_file_status(const std::string& path, file_status& status);
+
+	/**
+	 * @brief Get the status of all entries of a directory.
+	 * The entries are read first and then stated in inode order, so the inode table
+	 * is walked sequentially instead of in readdir hash order on cold caches.
+	 * Symbolic links are skipped, so recursive enumeration never loops.
+	 * @param dirName The directory name.
+	 * @param entries The output entries, in inode order.
+	 * @param filters File type filters, such as:
+	 *   EFT_DIR: only output directories.
+	 *   EFT_FILE: only output files.
+	 *   EFT_DIR | EFT_FILE: output directories and files.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory failed.
+	 */
+	void stat_directory(const std::string& dirName, std::vector<file_status>& entries, int filters = EFT_DIR | EFT_FILE);
+
+	struct directory_entry;
+	class directory_context;
+
 	/**
 	 * @brief A simple file enumerator.
 	 * Example:
@@ -211,6 +387,37 @@ namespace cx {
 		 */
 		bool begin(const std::string& dirName);
 
+		/**
+		 * @brief Begin file enumeration in the directory, without throwing.
+		 * @param dirName Directory name for enumeration.
+		 * @param ec The output error: errno on POSIX or GetLastError() on Windows, in system_category,
+		 *   or errc::invalid_argument when dirName is empty. Cleared if no error.
+		 * @return true if successful, false if no file found or failed.
+		 */
+		bool begin(const std::string& dirName, std::error_code& ec) noexcept;
+
+		/**
+		 * @brief Begin file enumeration in the directory at a cursor, to resume an enumeration.
+		 * The cursor is a telldir position on POSIX, so resuming costs nothing whatever the entries before it.
+		 * On Windows it is the count of entries skipped.
+		 * @param dirName Directory name for enumeration.
+		 * @param cursor A cursor returned by cursor(), or 0 for the first entry.
+		 * @return true if successful, false if no file found after the cursor.
+		 * @throw invalid_argument When dirName is empty.
+		 * @throw io_exception When open directory failed.
+		 */
+		bool begin(const std::string& dirName, unsigned long long cursor);
+
+		/**
+		 * @brief Begin file enumeration in a directory relative to a context, without using the current directory.
+		 * The file names are output relative to the context.
+		 * @param context The context.
+		 * @param relDir Directory name relative to the context, or empty for the directory of the context.
+		 * @return true if successful, false if no file found.
+		 * @throw io_exception When open directory failed.
+		 */
+		bool begin(const directory_context& context, const std::string& relDir);
+
 		/** 
 		 * @brief End enumeration.
 		 */
@@ -223,6 +430,21 @@ namespace cx {
 		 */
 		bool next();
 
+		/**
+		 * @brief Output the current entry and the following ones, then move to the entry after them.
+		 * @param entries The entries are appended to it, of depth 1.
+		 * @param count Maximum count of entries to output.
+		 * @return true if entries remain after them, false if the enumeration finished.
+		 */
+		bool next_entries(std::vector<directory_entry>& entries, size_t count);
+
+		/**
+		 * @brief Get the opaque cursor of the current entry, or of the end once the enumeration finished.
+		 * The cursor stays valid as long as the directory is not modified.
+		 * @return The cursor, to pass to begin.
+		 */
+		unsigned long long cursor() const;
+
 		/**
 		 * @brief Get filename of current enumeration point.
 		 * @return Current filename.
@@ -235,6 +457,13 @@ namespace cx {
 		 */
 		EnumFileType file_type() const;
 
+		/**
+		 * @brief Check whether the entry of current enumeration point is a symbolic link (a reparse point on Windows).
+		 * On POSIX, symbolic links are output as EFT_FILE, whatever they refer to.
+		 * @return true if it is a symbolic link.
+		 */
+		bool is_symlink() const;
+
 		/**
 		 * @brief Get file type filters.
 		 * @return File type filters.
@@ -250,10 +479,14 @@ namespace cx {
 		 */
 		void filters(int newFilters);
 	private:
+		bool begin_at(const std::string& dirName, unsigned long long cursor, std::error_code& ec) noexcept;
+
 		void* nativeEnumerator;
 		bool started;
+		unsigned long long position;
 		std::string fname;
 		EnumFileType ftype;
+		bool symlink;
 		std::string dname;
 		int _Filters;
 	public:
@@ -261,6 +494,29 @@ namespace cx {
 		file_enumerator& operator=(const file_enumerator&) = delete;
 	};
 
+	/**
+	 * @brief Read a page of the entries of a directory, for paged listings of large directories.
+	 * Each page costs O(count), whatever the entries before it. Example:
+	 * @code
+	 * unsigned long long cursor = 0;
+	 * std::vector<cx::directory_entry> page;
+	 * bool more;
+	 * do {
+	 *     more = cx::read_directory_page(dirName, cursor, 1000, page);
+	 *     // ...
+	 * } while (more);
+	 * @endcode
+	 * @param dirName Directory name.
+	 * @param cursor The cursor of the page, 0 for the first one. Set to the cursor of the next page.
+	 * @param count Maximum count of entries in the page.
+	 * @param entries The output entries, of depth 1.
+	 * @param filters File type filters, as of file_enumerator.
+	 * @return true if entries remain after the page, false if it is the last one.
+	 * @throw invalid_argument When dirName is empty or count is 0.
+	 * @throw io_exception When open directory failed.
+	 */
+	bool read_directory_page(const std::string& dirName, unsigned long long& cursor, size_t count, std::vector<directory_entry>& entries, int filters = EFT_DIR | EFT_FILE);
+
 	/**
 	 * @brief Enumeration output callback function
 	 * @param filename Output file name.
@@ -355,65 +611,2009 @@ namespace cx {
 	}
 
 	/**
-	 * @brief Get children file count of the given directory.
-	 * @param dirName The parent directory.
-	 * @param filters File type filters with all following options:
-	 *   EFT_DIR: Only count directories.
-	 *   EFT_FILE: Only count files.
-	 *   EFT_DIR | EFT_FILE: Count directories and files.
-	 * @param depth Walk depth. Default: 1.
-	 * @return File count: >= 0.
+	 * @brief What a walker does after an error.
+	 */
+	enum ErrorAction {
+		/**
+		 * @brief Skip the directory and go on.
+		 */
+		EA_SKIP = 0,
+
+		/**
+		 * @brief Try to open the directory again.
+		 */
+		EA_RETRY = 1,
+
+		/**
+		 * @brief Stop the enumeration.
+		 */
+		EA_ABORT = 2
+	};
+
+	/**
+	 * @brief Error callback function of the enumerations.
+	 * @param path The directory which could not be opened.
+	 * @param ec The error.
+	 * @return What to do next.
+	 */
+	typedef ErrorAction (*enum_error_callback)(const std::string& path, const std::error_code& ec);
+
+	template<class Callback, class ErrorCallback>
+	bool _enum_files_by_depth(const std::string& dirName, Callback& callbackFun, ErrorCallback& errorFun, int filters, int depth, int currentDepth, bool& cancelEnum) {
+		if (depth != 0 && currentDepth > depth) return true;
+
+		file_enumerator fe;
+		if (filters == EFT_DIR) fe.filters(filters);
+
+		std::error_code ec;
+		while (!fe.begin(dirName, ec)) {
+			if (!ec) return true;
+			ErrorAction action = errorFun(dirName, ec);
+			if (action == EA_ABORT) return false;
+			if (action != EA_RETRY) return true;
+		}
+
+		do {
+			EnumFileType fileType = fe.file_type();
+			if (fileType & filters) {
+				callbackFun(fe.filename(), fileType, cancelEnum);
+				if (cancelEnum) return true;
+			}
+
+			if (fileType == EFT_DIR && (depth == 0 || currentDepth + 1 <= depth)) {
+				if (!_enum_files_by_depth(fe.filename(), callbackFun, errorFun, filters, depth, currentDepth + 1, cancelEnum)) return false;
+				if (cancelEnum) return true;
+			}
+		} while (fe.next());
+		return true;
+	}
+
+	/**
+	 * @brief Enum files in the directory, reporting the directories which could not be opened to an error callback
+	 * instead of throwing.
+	 * @tparam CallbackFun: Callback function as enum_files_callback.
+	 * @tparam ErrorCallback: Error callback function as enum_error_callback.
+	 * @param dirName: Directory name.
+	 * @param callbackFun: Output callback function, as of enum_files.
+	 * @param filters File type filters, as of enum_files.
+	 * @param depth Walk depth, as of enum_files.
+	 * @param errorFun: Error callback function.
+	 *   The definition is like enum_error_callback:
+	 *   ErrorAction foo(const std::string& path, const std::error_code& ec);
+	 *      path: the directory which could not be opened.
+	 *      ec: the error.
+	 *      return: EA_SKIP, EA_RETRY or EA_ABORT.
+	 * @return true if finished or canceled by callbackFun, or false if aborted by errorFun.
 	 * @throw invalid_argument When dirName is empty.
-	 * @throw io_exception When open directory failed.
 	 */
-	int get_file_count(const std::string& dirName, int filters = EFT_DIR | EFT_FILE, int depth = 1);
+	template<class Callback, class ErrorCallback>
+	bool enum_files(const std::string& dirName, Callback callbackFun, int filters, int depth, ErrorCallback errorFun) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		bool cancelEnum = false;
+		return _enum_files_by_depth(dirName, callbackFun, errorFun, filters, depth, 1, cancelEnum);
+	}
 
 	/**
-	 * @brief Get all children file count of the given directory.
-	 * @param dirName The parent directory.
-	 * @param filters File type filters with all following options:
-	 *   EFT_DIR: Only count directories.
-	 *   EFT_FILE: Only count files.
-	 *   EFT_DIR | EFT_FILE: Count directories and files.
-	 * @return File count: >= 0.
+	 * @brief Enum all files in the directory, reporting the directories which could not be opened to an error callback
+	 * instead of throwing.
+	 * @tparam CallbackFun: Callback function as enum_files_callback.
+	 * @tparam ErrorCallback: Error callback function as enum_error_callback.
+	 * @param dirName: Directory name.
+	 * @param callbackFun: Output callback function, as of enum_all_files.
+	 * @param filters File type filters, as of enum_all_files.
+	 * @param errorFun: Error callback function, as of enum_files.
+	 * @return true if finished or canceled by callbackFun, or false if aborted by errorFun.
 	 * @throw invalid_argument When dirName is empty.
-	 * @throw io_exception When open directory failed.
 	 */
-	int get_all_file_count(const std::string& dirName, int filters = EFT_DIR | EFT_FILE);
+	template<class Callback, class ErrorCallback>
+	bool enum_all_files(const std::string& dirName, Callback callbackFun, int filters, ErrorCallback errorFun) {
+		return enum_files(dirName, callbackFun, filters, 0, errorFun);
+	}
 
 	/**
-	 * @brief Get application current directory.
-	 * @return Current directory.
+	 * @brief Directory reader for the specialized enumerations, which outputs entry names without building full paths.
 	 */
-	std::string get_current_directory();
+	class _dir_reader {
+	public:
+		_dir_reader();
+		~_dir_reader();
+
+		/**
+		 * @brief Open a directory.
+		 * @param path The directory name, a separator is appended if it does not end with one.
+		 * @throw io_exception When open directory failed.
+		 */
+		void open(std::string& path);
+
+		/**
+		 * @brief Read the next entry, skipping "." and "..". Links are files, as of file_enumerator.
+		 * @param fileType The output file type.
+		 * @return The entry name, valid until the next call, or NULL at the end.
+		 */
+		const char* next(EnumFileType& fileType);
+	private:
+		void* nativeHandle;
+		void* findData;
+		bool first;
+	public:
+		_dir_reader(const _dir_reader&) = delete;
+		_dir_reader& operator=(const _dir_reader&) = delete;
+	};
+
+	struct _match_all_names {
+		bool operator()(const char*) const { return true; }
+	};
+
+	template<int Filters, int Depth, class Callback, class NamePredicate>
+	bool _enum_files_static(std::string& path, Callback& callbackFun, NamePredicate& namePred, int currentDepth) {
+		_dir_reader reader;
+		reader.open(path);
+		const size_t length = path.size();
+
+		EnumFileType fileType;
+		const char* name;
+		while ((name = reader.next(fileType)) != NULL) {
+			// The filters and depth are constants, so the branches for unwanted types fold away.
+			bool isDir = fileType == EFT_DIR;
+			bool walkInto = isDir && (Depth == 0 || currentDepth < Depth);
+			bool output = (isDir ? (Filters & EFT_DIR) != 0 : (Filters & EFT_FILE) != 0) && namePred(name);
+			if (!output && !walkInto) continue;
+
+			path.resize(length);
+			path += name;
+			if (output) {
+				bool cancelEnum = false;
+				callbackFun((const std::string&)path, fileType, cancelEnum);
+				if (cancelEnum) return false;
+			}
+			if (walkInto && !_enum_files_static<Filters, Depth>(path, callbackFun, namePred, currentDepth + 1)) return false;
+		}
+		return true;
+	}
 
 	/**
-	 * @brief Read all byte to buffer from a file.
-	 * @param filename The filename.
-	 * @param data The data buffer.
-	 * @throw invalid_argument When filename is empty.
-	 * @throw io_exception When open file failed.
+	 * @brief Enum files in the directory, with the filters and depth known at compile time.
+	 * The enumeration is specialized for them, and the paths are only built for the entries output
+	 * or walked into. Example:
+	 * @code
+	 * cx::enum_files<cx::EFT_FILE, 0>(dir, [](const std::string& filename, cx::EnumFileType, bool&) { ... },
+	 *     [](const char* name) { return strstr(name, ".log") != NULL; });
+	 * @endcode
+	 * @tparam Filters File type filters, as of enum_files.
+	 * @tparam Depth Walk depth, as of enum_files.
+	 * @tparam CallbackFun: Callback function as enum_files_callback.
+	 * @tparam NamePredicate: Name predicate, bool foo(const char* name).
+	 * @param dirName: Directory name.
+	 * @param callbackFun: Output callback function, as of enum_files.
+	 * @param namePred: Predicate on the entry names, without directory. Only the entries it accepts are output,
+	 *   the directories it rejects are still walked into.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory failed.
 	 */
-	void read_all_bytes(const std::string& filename, std::vector<unsigned char>& data);
+	template<int Filters, int Depth, class Callback, class NamePredicate>
+	void enum_files(const std::string& dirName, Callback callbackFun, NamePredicate namePred) {
+		static_assert((Filters & (EFT_DIR | EFT_FILE)) != 0, "Filters");
+		static_assert(Depth >= 0, "Depth");
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+		std::string path = dirName;
+		_enum_files_static<Filters, Depth>(path, callbackFun, namePred, 1);
+	}
 
 	/**
-	 * @brief Write all bytes from a buffer to a file.
-	 * @param filename The filename.
-	 * @param data The data buffer.
-	 * @param bAppend true: for append mode, false: for creation mode.
-	 * @throw invalid_argument When filename is empty.
-	 * @throw io_exception When open file failed.
+	 * @brief Enum files in the directory, with the filters and depth known at compile time.
+	 * @tparam Filters File type filters, as of enum_files.
+	 * @tparam Depth Walk depth, as of enum_files.
+	 * @tparam CallbackFun: Callback function as enum_files_callback.
+	 * @param dirName: Directory name.
+	 * @param callbackFun: Output callback function, as of enum_files.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory failed.
 	 */
-	void write_all_bytes(const std::string& filename, const std::vector<unsigned char>& data, bool bAppend = false);
+	template<int Filters, int Depth, class Callback>
+	void enum_files(const std::string& dirName, Callback callbackFun) {
+		enum_files<Filters, Depth>(dirName, callbackFun, _match_all_names());
+	}
+
+	template<class Callback>
+	void _enum_files_status_by_depth(const std::string& dirName, Callback callbackFun, int filters, int depth, int& currentDepth, bool& cancelEnum) {
+		if (dirName.empty()) throw std::invalid_argument("dirName");
+
+		if (currentDepth < 1) currentDepth = 1;
+		if (depth != 0 && currentDepth > depth) return;
+
+		bool recurse = depth == 0 || currentDepth + 1 <= depth;
+		std::vector<file_status> entries;
+		stat_directory(dirName, entries, recurse ? (filters | EFT_DIR) : filters);
+
+		for (size_t i = 0; i < entries.size(); i++) {
+			const file_status& status = entries[i];
+
+			if (status.type & filters) {
+				callbackFun(status, cancelEnum);
+				if (cancelEnum) return;
+			}
+
+			if (status.type == EFT_DIR && recurse) {
+				currentDepth++;
+				_enum_files_status_by_depth(status.filename, callbackFun, filters, depth, currentDepth, cancelEnum);
+				currentDepth--;
+				if (cancelEnum) return;
+			}
+		}
+	}
 
 	/**
-	 * @brief Write all bytes from a buffer to a file.
-	 * @param filename The filename.
-	 * @param data The data buffer.
-	 * @param length Data length.
-	 * @param bAppend true: for append mode, false: for creation mode.
-	 * @throw invalid_argument When filename is empty.
-	 * @throw io_exception When open file failed.
+	 * @brief Enum files in the directory with their status.
+	 * Each directory is read as a batch and stated in inode order, see stat_directory.
+	 * @tparam CallbackFun: Callback function.
+	 * @param dirName: Directory name.
+	 * @param callbackFun: Output callback function:
+	 *   void foo(const file_status& status, bool& cancelEnum);
+	 *      status: output file status.
+	 *      cancelEnum: the value indicating weather the enumeration should be canceled.
+	 * @param filters File type filters, such as:
+	 *   EFT_DIR: Only output directories.
+	 *   EFT_FILE: Only output files.
+	 *   EFT_DIR | EFT_FILE: As default, Output directories and files.
+	 * @param depth Walk depth. Default: 1.
+	 *   0: Max sub-directory depth of this directory.
+	 *   >=1: Real depth to walk into.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory failed.
 	 */
-	void write_all_bytes(const std::string& filename, const unsigned char* data, size_t length, bool bAppend = false);
+	template<class Callback>
+	void enum_files_status(const std::string& dirName, Callback callbackFun, int filters = EFT_DIR | EFT_FILE, int depth = 1) {
+		int currentDepth = 1;
+		bool cancelEnum = false;
+		_enum_files_status_by_depth(dirName, callbackFun, filters, depth, currentDepth, cancelEnum);
+	}
+
+	/**
+	 * @brief Enum all files in the directory with their status.
+	 * Each directory is read as a batch and stated in inode order, see stat_directory.
+	 * @tparam CallbackFun: Callback function.
+	 * @param dirName: Directory name.
+	 * @param callbackFun: Output callback function:
+	 *   void foo(const file_status& status, bool& cancelEnum);
+	 * @param filters File type filters, such as:
+	 *   EFT_DIR: Only output directories.
+	 *   EFT_FILE: Only output files.
+	 *   EFT_DIR | EFT_FILE: As default, Output directories and files.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory failed.
+	 */
+	template<class Callback>
+	void enum_all_files_status(const std::string& dirName, Callback callbackFun, int filters = EFT_DIR | EFT_FILE) {
+		int currentDepth = 1;
+		bool cancelEnum = false;
+		_enum_files_status_by_depth(dirName, callbackFun, filters, 0, currentDepth, cancelEnum);
+	}
+
+	/**
+	 * @brief An entry output by recursive_directory_range.
+	 */
+	struct directory_entry {
+		/**
+		 * @brief Full path of the entry.
+		 */
+		std::string filename;
+
+		/**
+		 * @brief File type.
+		 */
+		EnumFileType type;
+
+		/**
+		 * @brief Depth of the entry, 1 for the children of the walked directory.
+		 */
+		int depth;
+
+		/**
+		 * @brief Whether the entry is a symbolic link.
+		 */
+		bool symlink;
+	};
+
+	/**
+	 * @brief Order in which a walk visits directories.
+	 */
+	enum TraversalOrder {
+		/**
+		 * @brief A directory is walked into right after it is output, as enum_files.
+		 */
+		TO_DEPTH_FIRST = 0,
+
+		/**
+		 * @brief All entries of a depth are output before the entries of the next depth.
+		 */
+		TO_BREADTH_FIRST = 1,
+
+		/**
+		 * @brief The directory with the highest score of walk_options::priority is walked next.
+		 */
+		TO_PRIORITY = 2
+	};
+
+	/**
+	 * @brief Scoring callback of TO_PRIORITY walks.
+	 *   double foo(const directory_entry& dir);
+	 *      dir: a directory waiting to be walked into.
+	 *      return: the score, directories with higher scores are walked first.
+	 */
+	typedef std::function<double(const directory_entry& dir)> walk_priority_callback;
+
+	/**
+	 * @brief Options of walk_files and recursive_directory_range.
+	 */
+	struct walk_options {
+		walk_options();
+
+		/**
+		 * @brief File type filters, EFT_DIR, EFT_FILE or both. Default: EFT_DIR | EFT_FILE.
+		 */
+		int filters;
+
+		/**
+		 * @brief Walk depth, 0 for no limit. Default: 0.
+		 */
+		int depth;
+
+		/**
+		 * @brief Do not walk into directories on other devices than the walked directory (st_dev check),
+		 * such as /proc under /. Mount points are still output. Default: false. Ignored on Windows.
+		 */
+		bool oneFileSystem;
+
+		/**
+		 * @brief Walk into symbolic links to directories, which are then output as EFT_DIR. Default: false.
+		 * Each directory is walked once, found by (device, inode), so link cycles end.
+		 */
+		bool followSymlinks;
+
+		/**
+		 * @brief Skip the sub-directories which could not be opened, instead of throwing io_exception. Default: true.
+		 */
+		bool skipErrors;
+
+		/**
+		 * @brief Order in which directories are visited. Default: TO_DEPTH_FIRST.
+		 */
+		TraversalOrder order;
+
+		/**
+		 * @brief Max count of directories waiting in TO_BREADTH_FIRST and TO_PRIORITY walks. Default: 65536.
+		 * When it is full, the directories found are walked into depth first, so memory stays bounded.
+		 */
+		size_t maxFrontier;
+
+		/**
+		 * @brief Scoring callback of TO_PRIORITY walks, called once per directory. Required for TO_PRIORITY.
+		 */
+		walk_priority_callback priority;
+
+		/**
+		 * @brief Checkpoint file of a resumable walk. Default: empty, no checkpoint.
+		 * If the file exists, the walk resumes from it, else it starts from the beginning.
+		 * The position is saved every checkpointInterval entries, when the next entry is pulled,
+		 * so at most checkpointInterval entries are output again after a restart.
+		 * The directories visited with followSymlinks are kept in checkpointFile.visited, only the new ones are
+		 * appended at each checkpoint. The files are removed when the walk finishes.
+		 */
+		std::string checkpointFile;
+
+		/**
+		 * @brief Count of entries between two checkpoints. Default: 10000.
+		 */
+		size_t checkpointInterval;
+	};
+
+	struct _inode_set;
+	struct _walk_frontier;
+
+	/**
+	 * @brief A lazy recursive file enumeration.
+	 * Entries are output in the same order as enum_files, but pulled by the caller,
+	 * so the walk can be paused, resumed and consumed in bounded batches.
+	 * Opened directories are kept in an explicit stack instead of native recursion.
+	 * Example:
+	 * @code
+	 * 	cx::recursive_directory_range range(dirName);
+	 * 	for (const cx::directory_entry& entry : range) {
+	 * 	    std::cout << entry.filename << std::endl;
+	 * 	}
+	 *
+	 * 	std::vector<cx::directory_entry> batch;
+	 * 	while (range.next(batch, 100) > 0) { ... }
+	 * @endcode
+	 */
+	class recursive_directory_range {
+	public:
+		/**
+		 * @brief Input iterator of recursive_directory_range.
+		 * All iterators of a range share the same position: the entry an iterator refers to
+		 * stays at the front of the range until the iterator is incremented.
+		 */
+		class iterator {
+		public:
+			typedef std::input_iterator_tag iterator_category;
+			typedef directory_entry value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const directory_entry* pointer;
+			typedef const directory_entry& reference;
+
+			iterator() : range(NULL) { }
+			reference operator*() const { return range->current; }
+			pointer operator->() const { return &range->current; }
+			iterator& operator++() {
+				if (!range->advance(range->current)) {
+					range->positioned = false;
+					range = NULL;
+				}
+				return *this;
+			}
+			void operator++(int) { ++*this; }
+			bool operator==(const iterator& other) const { return range == other.range; }
+			bool operator!=(const iterator& other) const { return range != other.range; }
+		private:
+			explicit iterator(recursive_directory_range* r) : range(r) { }
+			recursive_directory_range* range;
+			friend class recursive_directory_range;
+		};
+
+		/**
+		 * @brief Constructor.
+		 * @param dirName Directory name.
+		 * @param filters File type filters, such as:
+		 *   EFT_DIR: Only output directories.
+		 *   EFT_FILE: Only output files.
+		 *   EFT_DIR | EFT_FILE: As default, Output directories and files.
+		 * @param depth Walk depth. Default: 0.
+		 *   0: Max sub-directory depth of this directory.
+		 *   >=1: Real depth to walk into.
+		 * @throw invalid_argument When dirName is empty.
+		 */
+		recursive_directory_range(const std::string& dirName, int filters = EFT_DIR | EFT_FILE, int depth = 0);
+
+		/**
+		 * @brief Constructor with walk options.
+		 * @param dirName Directory name.
+		 * @param options Walk options.
+		 * @throw invalid_argument When dirName is empty, options.depth is negative,
+		 *   options.priority is empty for TO_PRIORITY, or options.checkpointFile belongs to another walk.
+		 * @throw io_exception When options.checkpointFile could not be read.
+		 */
+		recursive_directory_range(const std::string& dirName, const walk_options& options);
+
+		~recursive_directory_range();
+
+		/**
+		 * @brief Get the iterator at the current position, pulling the first entry if needed.
+		 * @return The iterator.
+		 * @throw io_exception When open directory failed.
+		 */
+		iterator begin();
+
+		/**
+		 * @brief Get the end iterator.
+		 * @return The end iterator.
+		 */
+		iterator end();
+
+		/**
+		 * @brief Pull the next entry.
+		 * @param entry The output entry.
+		 * @return true if got a new entry, or false if the enumeration finished.
+		 * @throw io_exception When open directory failed.
+		 */
+		bool next(directory_entry& entry);
+
+		/**
+		 * @brief Pull at most count entries.
+		 * @param entries The output entries, cleared first.
+		 * @param count Max count of entries to pull.
+		 * @return Count of entries pulled, 0 if the enumeration finished.
+		 * @throw io_exception When open directory failed.
+		 */
+		size_t next(std::vector<directory_entry>& entries, size_t count);
+
+		/**
+		 * @brief Check whether the enumeration finished.
+		 * @return true if no more entry could be pulled.
+		 */
+		bool finished() const;
+
+		/**
+		 * @brief Save the walk position to a checkpoint file, written to a temporary file then renamed.
+		 * The entries pulled so far are not output again by a range resumed from it,
+		 * except the entry the iterators refer to. The directories visited with followSymlinks
+		 * are written to filename.visited.
+		 * @param filename The checkpoint file name.
+		 * @throw invalid_argument When filename is empty.
+		 * @throw io_exception When write file failed.
+		 */
+		void save_checkpoint(const std::string& filename) const;
+	private:
+		bool advance(directory_entry& entry);
+		void write_checkpoint(const std::string& filename, bool keepCurrent) const;
+		void load_checkpoint(const std::string& filename);
+		bool mark_visited(unsigned long long device, unsigned long long inode);
+
+		std::vector<std::unique_ptr<file_enumerator> > stack;
+		std::vector<bool> consumed;
+		std::vector<std::string> stackDirs;
+		std::vector<unsigned long long> positions;
+		unsigned long long pulled;
+		std::string dname;
+		std::string pendingDir;
+		directory_entry current;
+		walk_options _Options;
+		unsigned long long rootDevice;
+		std::unique_ptr<_inode_set> visited;
+		mutable std::string visitedFile;
+		mutable unsigned long long visitedSaved;
+		mutable std::vector<std::pair<unsigned long long, unsigned long long> > unsavedVisited;
+		std::unique_ptr<_walk_frontier> frontier;
+		int baseDepth;
+		bool started;
+		bool positioned;
+		bool _Finished;
+	public:
+		recursive_directory_range(const recursive_directory_range&) = delete;
+		recursive_directory_range& operator=(const recursive_directory_range&) = delete;
+	};
+
+	/**
+	 * @brief Walk a directory tree with control over devices and symbolic links.
+	 * @tparam Callback: Callback function.
+	 * @param dirName: Directory name.
+	 * @param callbackFun: Output callback function, the definition is like:
+	 *   void foo(const directory_entry& entry, bool& cancelEnum);
+	 *      entry: output entry.
+	 *      cancelEnum: the value indicating weather the walk should be canceled.
+	 * @param options Walk options.
+	 * @throw invalid_argument When dirName is empty, options.depth is negative,
+	 *   or options.priority is empty for TO_PRIORITY.
+	 * @throw io_exception When dirName could not be opened, or a sub-directory if options.skipErrors is false.
+	 */
+	template<class Callback>
+	void walk_files(const std::string& dirName, Callback callbackFun, const walk_options& options = walk_options()) {
+		recursive_directory_range range(dirName, options);
+		directory_entry entry;
+		while (range.next(entry)) {
+			bool cancelEnum = false;
+			callbackFun(entry, cancelEnum);
+			if (cancelEnum) return;
+		}
+	}
+
+	/**
+	 * @brief Get children file count of the given directory.
+	 * @param dirName The parent directory.
+	 * @param filters File type filters with all following options:
+	 *   EFT_DIR: Only count directories.
+	 *   EFT_FILE: Only count files.
+	 *   EFT_DIR | EFT_FILE: Count directories and files.
+	 * @param depth Walk depth. Default: 1.
+	 * @return File count: >= 0.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory failed.
+	 */
+	int get_file_count(const std::string& dirName, int filters = EFT_DIR | EFT_FILE, int depth = 1);
+
+	/**
+	 * @brief Get all children file count of the given directory.
+	 * @param dirName The parent directory.
+	 * @param filters File type filters with all following options:
+	 *   EFT_DIR: Only count directories.
+	 *   EFT_FILE: Only count files.
+	 *   EFT_DIR | EFT_FILE: Count directories and files.
+	 * @return File count: >= 0.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory failed.
+	 */
+	int get_all_file_count(const std::string& dirName, int filters = EFT_DIR | EFT_FILE);
+
+	/**
+	 * @brief Get application current directory.
+	 * @return Current directory.
+	 */
+	std::string get_current_directory();
+
+	/**
+	 * @brief Read all byte to buffer from a file.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open file failed.
+	 */
+	void read_all_bytes(const std::string& filename, std::vector<unsigned char>& data);
+
+	/**
+	 * @brief Read all byte to buffer from a file, without throwing.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @param ec The output error: errno on POSIX or GetLastError() on Windows, in system_category,
+	 *   errc::invalid_argument when filename is empty, or errc::not_enough_memory. Cleared if successful.
+	 */
+	void read_all_bytes(const std::string& filename, std::vector<unsigned char>& data, std::error_code& ec) noexcept;
+
+	/**
+	 * @brief Write all bytes from a buffer to a file.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @param bAppend true: for append mode, false: for creation mode.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open file failed.
+	 */
+	void write_all_bytes(const std::string& filename, const std::vector<unsigned char>& data, bool bAppend = false);
+
+	/**
+	 * @brief Write all bytes from a buffer to a file.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @param length Data length.
+	 * @param bAppend true: for append mode, false: for creation mode.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open file failed.
+	 */
+	void write_all_bytes(const std::string& filename, const unsigned char* data, size_t length, bool bAppend = false);
+
+	/**
+	 * @brief Write all bytes from a buffer to a file, without throwing.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @param bAppend true: for append mode, false: for creation mode.
+	 * @param ec The output error: errno on POSIX or GetLastError() on Windows, in system_category,
+	 *   or errc::invalid_argument when filename is empty. Cleared if successful.
+	 */
+	void write_all_bytes(const std::string& filename, const std::vector<unsigned char>& data, bool bAppend, std::error_code& ec) noexcept;
+
+	/**
+	 * @brief Write all bytes from a buffer to a file, without throwing.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @param length Data length.
+	 * @param bAppend true: for append mode, false: for creation mode.
+	 * @param ec The output error: errno on POSIX or GetLastError() on Windows, in system_category,
+	 *   or errc::invalid_argument when filename is empty. Cleared if successful.
+	 */
+	void write_all_bytes(const std::string& filename, const unsigned char* data, size_t length, bool bAppend, std::error_code& ec) noexcept;
+
+	/**
+	 * @brief Options of process_files and process_all_files.
+	 */
+	struct pipeline_options {
+		pipeline_options();
+
+		/**
+		 * @brief Thread count of the read stage. Default: 2.
+		 */
+		int readThreads;
+
+		/**
+		 * @brief Thread count of the process stage. Default: hardware concurrency.
+		 */
+		int processThreads;
+
+		/**
+		 * @brief Max count of files waiting between two stages. Default: 64.
+		 * A stage blocks when its output queue is full.
+		 */
+		size_t queueSize;
+
+		/**
+		 * @brief Max count of file buffers in flight. Default: 0, as many as threads and queued files.
+		 * Buffers are recycled, so the memory is bounded by this count times the largest file size.
+		 */
+		size_t bufferCount;
+	};
+
+	/**
+	 * @brief Process callback of process_files and process_all_files.
+	 *   void foo(const std::string& filename, const unsigned char* data, size_t length, bool& cancelEnum);
+	 *      filename: file name.
+	 *      data: file content, valid until the callback returns.
+	 *      length: file length.
+	 *      cancelEnum: the value indicating weather the processing should be canceled.
+	 * The callback is invoked concurrently by the process stage threads.
+	 */
+	typedef std::function<void(const std::string& filename, const unsigned char* data, size_t length, bool& cancelEnum)> process_files_callback;
+
+	/**
+	 * @brief Read and process files in a staged pipeline.
+	 * Files are read by the read stage threads into recycled buffers,
+	 * and handed to the process stage threads through a bounded queue.
+	 * @param files The file names.
+	 * @param callbackFun Process callback function, see process_files_callback.
+	 * @param options Pipeline options.
+	 * @throw io_exception When open file failed.
+	 * @throw Any exception thrown by callbackFun, the processing is canceled.
+	 */
+	void process_files(const std::vector<std::string>& files, process_files_callback callbackFun, const pipeline_options& options = pipeline_options());
+
+	/**
+	 * @brief Enumerate all files in the directory, read and process them in a staged pipeline.
+	 * The directory is walked by the calling thread, files are read by the read stage threads
+	 * into recycled buffers and handed to the process stage threads, with bounded queues between the stages.
+	 * @param dirName Directory name.
+	 * @param callbackFun Process callback function, see process_files_callback.
+	 * @param options Pipeline options.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory or file failed.
+	 * @throw Any exception thrown by callbackFun, the processing is canceled.
+	 */
+	void process_all_files(const std::string& dirName, process_files_callback callbackFun, const pipeline_options& options = pipeline_options());
+
+	/**
+	 * @brief Hash algorithms.
+	 */
+	enum HashAlgorithm {
+		/**
+		 * @brief CRC-32C (Castagnoli), SSE4.2 or ARMv8 CRC instructions when available.
+		 */
+		HA_CRC32C = 1,
+
+		/**
+		 * @brief xxHash 64-bit with seed 0.
+		 */
+		HA_XXH64 = 2,
+
+		/**
+		 * @brief SHA-256, SHA-NI instructions when available.
+		 */
+		HA_SHA256 = 3
+	};
+
+	struct _hasher_impl;
+
+	/**
+	 * @brief Incremental hash calculator. The instructions are selected at runtime by the CPU features.
+	 * Example:
+	 * @code
+	 * 	cx::hasher h(cx::HA_SHA256);
+	 * 	h.update(data, length);
+	 * 	std::string digest = h.digest();
+	 * @endcode
+	 */
+	class hasher {
+	public:
+		/**
+		 * @brief Constructor.
+		 * @param algorithm Hash algorithm.
+		 * @throw invalid_argument When algorithm is unknown.
+		 */
+		hasher(HashAlgorithm algorithm);
+
+		~hasher();
+
+		/**
+		 * @brief Hash more data.
+		 * @param data The data buffer.
+		 * @param length Data length.
+		 */
+		void update(const unsigned char* data, size_t length);
+
+		/**
+		 * @brief Get the digest of all data hashed since construction or the last reset.
+		 * @return Lowercase hex digest, in the canonical big-endian byte order.
+		 */
+		std::string digest() const;
+
+		/**
+		 * @brief Restart hashing.
+		 */
+		void reset();
+	private:
+		_hasher_impl* impl;
+	public:
+		hasher(const hasher&) = delete;
+		hasher& operator=(const hasher&) = delete;
+	};
+
+	/**
+	 * @brief Hash a buffer.
+	 * @param data The data buffer.
+	 * @param length Data length.
+	 * @param algorithm Hash algorithm.
+	 * @return Lowercase hex digest.
+	 * @throw invalid_argument When algorithm is unknown.
+	 */
+	std::string hash_bytes(const unsigned char* data, size_t length, HashAlgorithm algorithm = HA_SHA256);
+
+	/**
+	 * @brief Hash a file. The file is streamed in large chunks, not loaded as a whole.
+	 * @param filename The filename.
+	 * @param algorithm Hash algorithm.
+	 * @return Lowercase hex digest.
+	 * @throw invalid_argument When filename is empty or algorithm is unknown.
+	 * @throw io_exception When open or read file failed.
+	 */
+	std::string hash_file(const std::string& filename, HashAlgorithm algorithm = HA_SHA256);
+
+	/**
+	 * @brief Hash result of a file.
+	 */
+	struct file_hash {
+		/**
+		 * @brief File name.
+		 */
+		std::string filename;
+
+		/**
+		 * @brief Lowercase hex digest.
+		 */
+		std::string digest;
+	};
+
+	/**
+	 * @brief Hash all files in the directory in parallel.
+	 * The directory is walked by the calling thread while the worker threads stream and hash the files.
+	 * @param dirName Directory name.
+	 * @param hashes The output hashes, sorted by file name.
+	 * @param algorithm Hash algorithm.
+	 * @param threads Count of worker threads. 0: hardware concurrency.
+	 * @throw invalid_argument When dirName is empty or algorithm is unknown.
+	 * @throw io_exception When open directory or file failed.
+	 */
+	void hash_tree(const std::string& dirName, std::vector<file_hash>& hashes, HashAlgorithm algorithm = HA_SHA256, int threads = 0);
+
+	/**
+	 * @brief Find files with identical content in the directory.
+	 * Files are grouped by size first, then by a hash of their first and last 4 KiB,
+	 * and only the remaining candidates are fully hashed in parallel, so files with
+	 * a unique size are never read. Hard links to the same inode are not read twice.
+	 * Groups are confirmed by SHA-256 over the whole content, files up to 8 KiB are hashed so at once.
+	 * Files which vanish or cannot be read during the search are skipped.
+	 * @param dirName Directory name.
+	 * @param groups The output groups of duplicate files. Each group holds at least 2 file names, sorted.
+	 * The groups are sorted by their first file name.
+	 * @param threads Count of worker threads. 0: hardware concurrency.
+	 * @return Count of bytes read from the files.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory failed.
+	 */
+	unsigned long long find_duplicates(const std::string& dirName, std::vector<std::vector<std::string> >& groups, int threads = 0);
+
+	/**
+	 * @brief A match output by search_tree.
+	 */
+	struct search_match {
+		/**
+		 * @brief File name.
+		 */
+		std::string filename;
+
+		/**
+		 * @brief Byte offset of the match in the file.
+		 */
+		unsigned long long offset;
+
+		/**
+		 * @brief Line number of the match, starting from 1.
+		 */
+		size_t lineNumber;
+
+		/**
+		 * @brief Content of the line, without line break.
+		 */
+		std::string line;
+
+		/**
+		 * @brief Index of the matched pattern.
+		 */
+		size_t patternIndex;
+	};
+
+	/**
+	 * @brief Search literal patterns in all files in the directory.
+	 * Files are memory mapped and searched by worker threads, while the calling thread walks the directory.
+	 * A single pattern is found with a memchr prefilter on its rarest byte, several patterns with an Aho-Corasick automaton.
+	 * Every occurrence of every pattern is output, overlapping occurrences included.
+	 * Binary files, which contain a NUL byte in their first 8 KiB, are skipped, as well as files which cannot be opened.
+	 * @param dirName Directory name.
+	 * @param patterns The patterns to search.
+	 * @param matches The output matches, sorted by file name, offset and pattern index.
+	 * @param threads Count of worker threads. 0: hardware concurrency.
+	 * @throw invalid_argument When dirName is empty, patterns is empty or any pattern is empty.
+	 * @throw io_exception When open directory failed.
+	 */
+	void search_tree(const std::string& dirName, const std::vector<std::string>& patterns, std::vector<search_match>& matches, int threads = 0);
+
+	/**
+	 * @brief Search a literal pattern in all files in the directory, see search_tree with several patterns.
+	 * @param dirName Directory name.
+	 * @param pattern The pattern to search.
+	 * @param matches The output matches, sorted by file name and offset.
+	 * @param threads Count of worker threads. 0: hardware concurrency.
+	 * @throw invalid_argument When dirName or pattern is empty.
+	 * @throw io_exception When open directory failed.
+	 */
+	void search_tree(const std::string& dirName, const std::string& pattern, std::vector<search_match>& matches, int threads = 0);
+
+	/**
+	 * @brief Options of write_compressed_bytes.
+	 */
+	struct compression_options {
+		compression_options();
+
+		/**
+		 * @brief Size of the blocks compressed independently. Default: 1 MiB.
+		 * The memory used is bounded by about 2 * threads * blockSize.
+		 */
+		size_t blockSize;
+
+		/**
+		 * @brief Count of threads compressing blocks in parallel. Default: hardware concurrency.
+		 */
+		int threads;
+	};
+
+	/**
+	 * @brief Write all bytes from a buffer to a file as a compressed frame.
+	 * The data is split in blocks, compressed in parallel with the LZ4 block format and
+	 * written in order. Blocks which do not shrink are stored as they are.
+	 * In append mode a new frame is appended after the existing content.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @param length Data length.
+	 * @param bAppend true: for append mode, false: for creation mode.
+	 * @param options Compression options.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open or write file failed.
+	 */
+	void write_compressed_bytes(const std::string& filename, const unsigned char* data, size_t length, bool bAppend = false, const compression_options& options = compression_options());
+
+	/**
+	 * @brief Write all bytes from a buffer to a file as a compressed frame, see write_compressed_bytes.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @param bAppend true: for append mode, false: for creation mode.
+	 * @param options Compression options.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open or write file failed.
+	 */
+	void write_compressed_bytes(const std::string& filename, const std::vector<unsigned char>& data, bool bAppend = false, const compression_options& options = compression_options());
+
+	/**
+	 * @brief Read all bytes of a file, decompressing the frames written by write_compressed_bytes.
+	 * The frames are detected by their header, files without a frame header are read as they are.
+	 * The file is read block by block, only the decompressed data is held in memory.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open or read file failed, with errno, or with EBADMSG
+	 *   (ERROR_INVALID_DATA on Windows) when a frame is corrupted.
+	 */
+	void read_compressed_bytes(const std::string& filename, std::vector<unsigned char>& data);
+
+	/**
+	 * @brief Check whether the file starts with a frame written by write_compressed_bytes.
+	 * @param filename The filename.
+	 * @return true if the file starts with a frame header, or false if not or the file cannot be opened.
+	 */
+	bool is_compressed_file(const std::string& filename);
+
+	/**
+	 * @brief Pack all files in the directory into a single pack file.
+	 * The files are stored one after another, followed by a hashed index of their
+	 * paths, relative to dirName with '/' as separator. Read the pack with pack_reader.
+	 * Links are packed as the files they refer to, dangling links and links to directories are skipped.
+	 * The pack is written to packFile.tmp then renamed, so a failed build keeps the previous pack.
+	 * A pack inside dirName is not packed.
+	 * @param dirName Directory name.
+	 * @param packFile The pack file name.
+	 * @return Count of files packed.
+	 * @throw invalid_argument When dirName or packFile is empty.
+	 * @throw io_exception When open directory, open or read a file, or write the pack failed, with errno.
+	 */
+	size_t build_pack(const std::string& dirName, const std::string& packFile);
+
+	/**
+	 * @brief Reader of the pack files written by build_pack.
+	 * The pack is memory mapped, a file is found with one hash lookup and returned
+	 * as a view of the mapping, without copy. A reader can be used by many threads once opened.
+	 * Example:
+	 * @code
+	 * 	cx::pack_reader pack;
+	 * 	pack.open("data.pack");
+	 * 	const unsigned char* data;
+	 * 	size_t length;
+	 * 	if (pack.read("dir/file.txt", data, length)) { ... }
+	 * @endcode
+	 */
+	class pack_reader {
+	public:
+		pack_reader();
+
+		~pack_reader();
+
+		/**
+		 * @brief Open a pack file.
+		 * @param packFile The pack file name.
+		 * @throw invalid_argument When packFile is empty.
+		 * @throw io_exception When open file failed or the file is not a valid pack.
+		 */
+		void open(const std::string& packFile);
+
+		/**
+		 * @brief Close the pack file, the views returned by read become invalid.
+		 */
+		void close();
+
+		/**
+		 * @brief Find a file in the pack.
+		 * @param path The path relative to the packed directory.
+		 * @param data The output file content, valid until the reader is closed.
+		 * @param length The output file length.
+		 * @return true if the file was found, or false if not.
+		 */
+		bool read(const std::string& path, const unsigned char*& data, size_t& length) const;
+
+		/**
+		 * @brief Get count of files in the pack.
+		 * @return Count of files.
+		 */
+		size_t file_count() const;
+
+		/**
+		 * @brief Get the paths of all files in the pack, in packing order.
+		 * @param paths The output paths.
+		 */
+		void list(std::vector<std::string>& paths) const;
+	private:
+		void* nativeFile;
+		const unsigned char* entries;
+		const unsigned char* names;
+		size_t namesSize;
+		const unsigned char* slots;
+		size_t slotCount;
+		size_t entryCount;
+	public:
+		pack_reader(const pack_reader&) = delete;
+		pack_reader& operator=(const pack_reader&) = delete;
+	};
+
+	/**
+	 * @brief A range of bytes in a file.
+	 */
+	struct file_extent {
+		/**
+		 * @brief Offset of the first byte.
+		 */
+		unsigned long long offset;
+
+		/**
+		 * @brief Count of bytes.
+		 */
+		unsigned long long length;
+	};
+
+	/**
+	 * @brief Get the data extents of a file, the holes of sparse files are not included.
+	 * Found with SEEK_DATA and SEEK_HOLE. When the file system does not report holes,
+	 * the whole file is a single extent.
+	 * @param filename The filename.
+	 * @param extents The output data extents, in offset order.
+	 * @return The file size.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open file failed.
+	 */
+	unsigned long long get_data_extents(const std::string& filename, std::vector<file_extent>& extents);
+
+	/**
+	 * @brief Read the data extents of a file, skipping the holes.
+	 * @param filename The filename.
+	 * @param extents The output data extents, in offset order.
+	 * @param data The output data, the content of all extents one after another.
+	 * @return The file size.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open or read file failed.
+	 */
+	unsigned long long read_data_extents(const std::string& filename, std::vector<file_extent>& extents, std::vector<unsigned char>& data);
+
+	/**
+	 * @brief Write data extents to a new file, the ranges between the extents are left as holes.
+	 * @param filename The filename.
+	 * @param extents The data extents, in offset order.
+	 * @param data The data, the content of all extents one after another.
+	 * @param fileSize The file size.
+	 * @throw invalid_argument When filename is empty, or the extents do not match data or fileSize.
+	 * @throw io_exception When open or write file failed.
+	 */
+	void write_data_extents(const std::string& filename, const std::vector<file_extent>& extents, const std::vector<unsigned char>& data, unsigned long long fileSize);
+
+	/**
+	 * @brief Write all bytes from a buffer to a new file, leaving holes for the blocks which are all zero.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @param length Data length.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open or write file failed.
+	 */
+	void write_sparse_bytes(const std::string& filename, const unsigned char* data, size_t length);
+
+	/**
+	 * @brief Copy a file. Only the data extents are read and written, so the holes of sparse files are kept.
+	 * The permissions of the source file are copied too.
+	 * @param srcName The source file name.
+	 * @param dstName The destination file name, replaced if it exists.
+	 * @return Count of data bytes copied.
+	 * @throw invalid_argument When srcName or dstName is empty.
+	 * @throw io_exception When open, read or write file failed, or EINVAL when dstName is srcName or a hard link of it.
+	 */
+	unsigned long long copy_file(const std::string& srcName, const std::string& dstName);
+
+	/**
+	 * @brief Options of file_prefetcher.
+	 */
+	struct prefetch_options {
+		prefetch_options();
+
+		/**
+		 * @brief Min count of files prefetched ahead of the consumer. Default: 4.
+		 */
+		size_t minWindow;
+
+		/**
+		 * @brief Max count of files prefetched ahead of the consumer. Default: 256.
+		 */
+		size_t maxWindow;
+
+		/**
+		 * @brief Max bytes prefetched ahead of the consumer. Default: 64 MiB.
+		 * At least one file is always prefetched.
+		 */
+		unsigned long long maxBytes;
+
+		/**
+		 * @brief How far ahead to prefetch, in milliseconds of consumer time. Default: 200.
+		 * The window is this time multiplied by the observed consumer rate, within [minWindow, maxWindow].
+		 */
+		unsigned int lookahead;
+	};
+
+	struct _file_prefetcher_impl;
+
+	/**
+	 * @brief Prefetch files ahead of a sequential consumer.
+	 * A background thread walks the files in order and asks the kernel to read them into the page cache
+	 * (posix_fadvise WILLNEED), a window ahead of the consumer. The window follows the consumer rate,
+	 * so reading files in a plain loop overlaps the I/O with the processing:
+	 *   cx::file_prefetcher prefetcher(dir);
+	 *   std::string filename;
+	 *   while (prefetcher.next(filename)) { cx::read_all_bytes(filename, data); ... }
+	 * The kernel hint is only issued on POSIX systems, elsewhere the files are just handed out in order.
+	 */
+	class file_prefetcher {
+	public:
+		/**
+		 * @brief Prefetch a list of files, in the list order.
+		 * @param filenames The files.
+		 * @param options Prefetch options.
+		 */
+		file_prefetcher(const std::vector<std::string>& filenames, const prefetch_options& options = prefetch_options());
+
+		/**
+		 * @brief Prefetch all files of a directory, in the order of enum_all_files.
+		 * The directory is enumerated by the background thread too.
+		 * @param dirName Directory name.
+		 * @param options Prefetch options.
+		 * @throw invalid_argument When dirName is empty.
+		 */
+		file_prefetcher(const std::string& dirName, const prefetch_options& options = prefetch_options());
+
+		/**
+		 * @brief Destructor, stops the background thread.
+		 */
+		~file_prefetcher();
+
+		/**
+		 * @brief Get the next file, waiting for the background thread if needed.
+		 * @param filename The output file name.
+		 * @return true if successful, or false if all files were handed out.
+		 */
+		bool next(std::string& filename);
+
+		/**
+		 * @brief Get the current window, the count of files to be prefetched ahead of the consumer.
+		 */
+		size_t window() const;
+	private:
+		_file_prefetcher_impl* impl;
+	public:
+		file_prefetcher(const file_prefetcher&) = delete;
+		file_prefetcher& operator=(const file_prefetcher&) = delete;
+	};
+
+	struct _buffer_pool_impl;
+	class buffer_pool;
+
+	/**
+	 * @brief A buffer borrowed from a buffer_pool, given back to the pool on destruction.
+	 * Movable, not copyable. The pool must outlive its buffers.
+	 */
+	class pooled_buffer {
+	public:
+		pooled_buffer();
+		pooled_buffer(pooled_buffer&& other);
+		pooled_buffer& operator=(pooled_buffer&& other);
+		~pooled_buffer();
+
+		/**
+		 * @brief Get the data.
+		 */
+		unsigned char* data() { return _Data; }
+		const unsigned char* data() const { return _Data; }
+
+		/**
+		 * @brief Get the count of bytes in use.
+		 */
+		size_t size() const { return _Size; }
+
+		/**
+		 * @brief Get the count of bytes available, a power of two.
+		 */
+		size_t capacity() const { return _Capacity; }
+
+		/**
+		 * @brief Check whether no bytes are in use.
+		 */
+		bool empty() const { return _Size == 0; }
+
+		/**
+		 * @brief Set the count of bytes in use.
+		 * @param size The count of bytes.
+		 * @throw invalid_argument When size is larger than the capacity.
+		 */
+		void resize(size_t size);
+
+		/**
+		 * @brief Give the buffer back to the pool.
+		 */
+		void reset();
+	private:
+		friend class buffer_pool;
+		_buffer_pool_impl* pool;
+		unsigned char* _Data;
+		size_t _Size;
+		size_t _Capacity;
+	public:
+		pooled_buffer(const pooled_buffer&) = delete;
+		pooled_buffer& operator=(const pooled_buffer&) = delete;
+	};
+
+	/**
+	 * @brief A thread safe pool of buffers in power of two size classes.
+	 * Buffers given back are kept per size class and handed out again, so a loop loading files of
+	 * similar sizes allocates nothing once warmed up. Classes from 2 MiB are mapped directly from the system
+	 * and backed with transparent huge pages where supported.
+	 */
+	class buffer_pool {
+	public:
+		/**
+		 * @brief Constructor.
+		 * @param maxCachedBytes Max bytes of the buffers kept for reuse. Default: 256 MiB.
+		 * Buffers given back beyond this are freed.
+		 */
+		buffer_pool(size_t maxCachedBytes = 256 * 1024 * 1024);
+
+		/**
+		 * @brief Destructor, frees the kept buffers.
+		 */
+		~buffer_pool();
+
+		/**
+		 * @brief Borrow a buffer.
+		 * @param size Count of bytes in use. The capacity is rounded up to a power of two, at least 4 KiB.
+		 * @return The buffer.
+		 * @throw bad_alloc When out of memory.
+		 */
+		pooled_buffer acquire(size_t size);
+
+		/**
+		 * @brief Get the bytes of the buffers kept for reuse.
+		 */
+		size_t cached_bytes() const;
+
+		/**
+		 * @brief Free the buffers kept for reuse.
+		 */
+		void trim();
+	private:
+		_buffer_pool_impl* impl;
+	public:
+		buffer_pool(const buffer_pool&) = delete;
+		buffer_pool& operator=(const buffer_pool&) = delete;
+	};
+
+	/**
+	 * @brief Read all bytes from a file to a pooled buffer.
+	 * The buffer is reused when its capacity is large enough, or exchanged for one from the pool.
+	 * @param filename The filename.
+	 * @param pool The buffer pool.
+	 * @param buffer The data buffer.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open or read file failed.
+	 */
+	void read_all_bytes(const std::string& filename, buffer_pool& pool, pooled_buffer& buffer);
+
+	void _read_all_bytes(const std::string& filename, const std::function<unsigned char*(size_t size)>& allocate);
+
+	/**
+	 * @brief Read all bytes from a file to a vector with a custom allocator.
+	 * @param filename The filename.
+	 * @param data The data buffer.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open or read file failed.
+	 */
+	template<class Allocator>
+	void read_all_bytes(const std::string& filename, std::vector<unsigned char, Allocator>& data) {
+		_read_all_bytes(filename, [&data](size_t size) {
+			data.resize(size);
+			return data.data();
+		});
+	}
+
+	/**
+	 * @brief A read only memory range, for vectored writes.
+	 */
+	struct const_buffer {
+		const_buffer() : data(NULL), length(0) { }
+		const_buffer(const void* data, size_t length) : data((const unsigned char*)data), length(length) { }
+
+		/**
+		 * @brief The first byte.
+		 */
+		const unsigned char* data;
+
+		/**
+		 * @brief Count of bytes.
+		 */
+		size_t length;
+	};
+
+	/**
+	 * @brief A writable memory range, for vectored reads.
+	 */
+	struct mutable_buffer {
+		mutable_buffer() : data(NULL), length(0) { }
+		mutable_buffer(void* data, size_t length) : data((unsigned char*)data), length(length) { }
+
+		/**
+		 * @brief The first byte.
+		 */
+		unsigned char* data;
+
+		/**
+		 * @brief Count of bytes.
+		 */
+		size_t length;
+	};
+
+	/**
+	 * @brief Write buffers one after another to a file, with a single open and gathered writes (writev).
+	 * @param filename The filename.
+	 * @param buffers The buffers.
+	 * @param count Count of buffers.
+	 * @param bAppend true: for append mode, false: for creation mode.
+	 * @throw invalid_argument When filename is empty, or buffers is NULL while count is not 0.
+	 * @throw io_exception When open or write file failed.
+	 */
+	void write_all_bytes(const std::string& filename, const const_buffer* buffers, size_t count, bool bAppend = false);
+
+	/**
+	 * @brief Write buffers one after another to a file, with a single open and gathered writes (writev).
+	 * @param filename The filename.
+	 * @param buffers The buffers.
+	 * @param bAppend true: for append mode, false: for creation mode.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open or write file failed.
+	 */
+	void write_all_bytes(const std::string& filename, const std::vector<const_buffer>& buffers, bool bAppend = false);
+
+	/**
+	 * @brief Read bytes of a file into buffers one after another, with a single open and scattered reads (preadv).
+	 * @param filename The filename.
+	 * @param buffers The buffers, filled in order.
+	 * @param count Count of buffers.
+	 * @param offset The file offset to read from. Default: 0.
+	 * @return Count of bytes read, less than the total length of the buffers when the file ends first.
+	 * @throw invalid_argument When filename is empty, or buffers is NULL while count is not 0.
+	 * @throw io_exception When open or read file failed.
+	 */
+	size_t read_bytes(const std::string& filename, const mutable_buffer* buffers, size_t count, unsigned long long offset = 0);
+
+	/**
+	 * @brief Read bytes of a file into buffers one after another, with a single open and scattered reads (preadv).
+	 * @param filename The filename.
+	 * @param buffers The buffers, filled in order.
+	 * @param offset The file offset to read from. Default: 0.
+	 * @return Count of bytes read, less than the total length of the buffers when the file ends first.
+	 * @throw invalid_argument When filename is empty.
+	 * @throw io_exception When open or read file failed.
+	 */
+	size_t read_bytes(const std::string& filename, const std::vector<mutable_buffer>& buffers, unsigned long long offset = 0);
+
+	/**
+	 * @brief When append_writer forces written records to the storage device.
+	 */
+	enum SyncPolicy {
+		/**
+		 * @brief Never, leave it to the operating system.
+		 */
+		SP_NONE = 0,
+
+		/**
+		 * @brief At most once per syncInterval.
+		 */
+		SP_INTERVAL = 1,
+
+		/**
+		 * @brief After every group commit.
+		 */
+		SP_COMMIT = 2
+	};
+
+	/**
+	 * @brief Options of append_writer.
+	 */
+	struct append_options {
+		append_options();
+
+		/**
+		 * @brief Count of records the ring buffer holds, rounded up to a power of two. Default: 65536.
+		 * Appending blocks while the ring is full.
+		 */
+		size_t ringSize;
+
+		/**
+		 * @brief Max time in milliseconds a record waits before it is written. Default: 10.
+		 */
+		unsigned int flushInterval;
+
+		/**
+		 * @brief When written records are synced. Default: SP_NONE.
+		 */
+		SyncPolicy syncPolicy;
+
+		/**
+		 * @brief Sync interval in milliseconds for SP_INTERVAL. Default: 1000.
+		 */
+		unsigned int syncInterval;
+
+		/**
+		 * @brief Rotate the file when it reaches this size in bytes. Default: 0, no size rotation.
+		 */
+		unsigned long long rotateSize;
+
+		/**
+		 * @brief Rotate the file when it has been written for this many seconds. Default: 0, no time rotation.
+		 */
+		unsigned int rotateInterval;
+	};
+
+	struct _append_writer_impl;
+
+	/**
+	 * @brief A thread safe writer appending records to a file which is kept open.
+	 * Records go through a lock free ring buffer to a background thread, which writes them in batches
+	 * (group commit), so appending does not wait for the file. Records are never interleaved.
+	 * On rotation the file is renamed to filename.1, filename.2, ..., the first free number, and a new file is started.
+	 */
+	class append_writer {
+	public:
+		/**
+		 * @brief Open the file for appending, it is created if it does not exist.
+		 * @param filename The filename.
+		 * @param options Append options.
+		 * @throw invalid_argument When filename is empty.
+		 * @throw io_exception When open file failed.
+		 */
+		append_writer(const std::string& filename, const append_options& options = append_options());
+
+		/**
+		 * @brief Destructor, writes the pending records and closes the file.
+		 * No append may be running.
+		 */
+		~append_writer();
+
+		/**
+		 * @brief Append a record.
+		 * @param data The record data.
+		 * @param length The record length.
+		 * @throw io_exception When a previous write failed.
+		 */
+		void append(const unsigned char* data, size_t length);
+
+		/**
+		 * @brief Append a record.
+		 * @param data The record data.
+		 * @throw io_exception When a previous write failed.
+		 */
+		void append(const std::string& data) { append((const unsigned char*)data.data(), data.size()); }
+
+		/**
+		 * @brief Wait until the records appended before are written and synced.
+		 * @throw io_exception When write or sync failed.
+		 */
+		void flush();
+
+		/**
+		 * @brief Get the count of files rotated by this writer.
+		 */
+		size_t rotation_count() const;
+	private:
+		_append_writer_impl* impl;
+	public:
+		append_writer(const append_writer&) = delete;
+		append_writer& operator=(const append_writer&) = delete;
+	};
+
+	/**
+	 * @brief A move of move_files.
+	 */
+	struct move_request {
+		move_request() { }
+		move_request(const std::string& source, const std::string& target) : source(source), target(target) { }
+
+		/**
+		 * @brief The file or directory to move.
+		 */
+		std::string source;
+
+		/**
+		 * @brief The new name.
+		 */
+		std::string target;
+	};
+
+	/**
+	 * @brief Flags of move_files.
+	 */
+	enum MoveFlags {
+		/**
+		 * @brief Replace existing targets.
+		 */
+		MF_NONE = 0,
+
+		/**
+		 * @brief Fail with EEXIST when the target exists.
+		 * The check is atomic with renameat2 on Linux and with MoveFileEx on Windows. Without renameat2 a file
+		 * is hard linked to the target then unlinked, so both names exist for a moment, and a directory
+		 * fails with ENOTSUP.
+		 */
+		MF_NOREPLACE = 1,
+
+		/**
+		 * @brief Swap source and target atomically, both must exist. Linux only.
+		 */
+		MF_EXCHANGE = 2,
+
+		/**
+		 * @brief Fail with EXDEV instead of copying when source and target are on different devices.
+		 */
+		MF_NOCOPY = 4
+	};
+
+	/**
+	 * @brief Move or rename many files.
+	 * The moves are grouped by target directory, the groups are run in parallel, and the moves of a group
+	 * are done in order relative to the opened directories (renameat2 on Linux).
+	 * A regular file moved to another device is copied and unlinked, unless MF_NOCOPY is set.
+	 * @param requests The moves.
+	 * @param errors The output error codes, one per request: 0 if moved, or else errno on POSIX or GetLastError() on Windows.
+	 * @param flags Move flags, such as:
+	 * MF_NOREPLACE: do not replace existing targets.
+	 * MF_EXCHANGE: swap source and target.
+	 * MF_NOCOPY: do not copy across devices.
+	 * @param threads Thread count. Default: 0, hardware concurrency.
+	 * @return Count of requests moved.
+	 * @throw invalid_argument When a name is empty, or both MF_NOREPLACE and MF_EXCHANGE are set.
+	 */
+	size_t move_files(const std::vector<move_request>& requests, std::vector<int>& errors, int flags = MF_NONE, int threads = 0);
+
+	/**
+	 * @brief A part of a directory tree, output by partition_scan.
+	 */
+	struct scan_shard {
+		scan_shard() : estimatedEntries(0) { }
+
+		/**
+		 * @brief Directories walked with all their entries, the directories themselves included.
+		 */
+		std::vector<directory_entry> subtrees;
+
+		/**
+		 * @brief Entries output without walking into them.
+		 */
+		std::vector<directory_entry> entries;
+
+		/**
+		 * @brief Estimated count of entries in the shard.
+		 */
+		unsigned long long estimatedEntries;
+	};
+
+	/**
+	 * @brief Split a directory tree into shards of balanced sizes, for walks by independent processes.
+	 * A shallow pre-scan counts the entries of each directory of depth 1, the subtrees are then
+	 * assigned to the shards by estimated size, largest first. A directory which alone is larger than
+	 * a shard is split into its children. All shards together hold every entry of the tree once,
+	 * as walked with the default walk_options. The pre-scan never follows links, and does not check devices:
+	 * with followSymlinks, each subtree is walked with visited directories of its own, so a directory linked
+	 * from several subtrees is output once per subtree, and the links outside the subtrees are not followed;
+	 * with oneFileSystem, a directory mounted from another file system is still a subtree, walked as a whole.
+	 * The result only depends on the tree, so each process may compute it and walk its own shard.
+	 * @param dirName Directory name.
+	 * @param shardCount Count of shards.
+	 * @param shards The output shards, shardCount of them, some may be empty.
+	 * @throw invalid_argument When dirName is empty or shardCount is 0.
+	 * @throw io_exception When open directory failed.
+	 */
+	void partition_scan(const std::string& dirName, size_t shardCount, std::vector<scan_shard>& shards);
+
+	/**
+	 * @brief Walk a shard of partition_scan. The entries are output with their depth in the whole tree.
+	 * @tparam Callback: Callback function, as of walk_files.
+	 * @param shard The shard.
+	 * @param callbackFun: Output callback function, as of walk_files.
+	 * @param options Walk options, the same for all shards. The depth is counted from the partitioned directory,
+	 *   oneFileSystem applies from each subtree, the checkpoint file is not supported.
+	 * @throw io_exception When a sub-directory could not be opened and options.skipErrors is false.
+	 */
+	template<class Callback>
+	void walk_shard(const scan_shard& shard, Callback callbackFun, const walk_options& options = walk_options()) {
+		bool cancelEnum = false;
+		for (size_t i = 0; i < shard.entries.size(); i++) {
+			const directory_entry& entry = shard.entries[i];
+			if (!(entry.type & options.filters) || (options.depth != 0 && entry.depth > options.depth)) continue;
+			callbackFun(entry, cancelEnum);
+			if (cancelEnum) return;
+		}
+
+		walk_options subtreeOptions = options;
+		subtreeOptions.checkpointFile.clear();
+		for (size_t i = 0; i < shard.subtrees.size(); i++) {
+			const directory_entry& root = shard.subtrees[i];
+			if (options.depth != 0 && root.depth > options.depth) continue;
+			if (root.type & options.filters) {
+				callbackFun(root, cancelEnum);
+				if (cancelEnum) return;
+			}
+			if (options.depth != 0 && root.depth == options.depth) continue;
+
+			subtreeOptions.depth = options.depth == 0 ? 0 : options.depth - root.depth;
+			recursive_directory_range range(root.filename, subtreeOptions);
+			directory_entry entry;
+			for (bool first = true; ; first = false) {
+				try {
+					if (!range.next(entry)) break;
+				}
+				catch (const io_exception&) {
+					// The subtree root vanished or could not be opened since the partition.
+					if (first && options.skipErrors) break;
+					throw;
+				}
+				entry.depth += root.depth;
+				callbackFun(entry, cancelEnum);
+				if (cancelEnum) return;
+			}
+		}
+	}
+
+	struct _query_node;
+
+	/**
+	 * @brief A predicate on the metadata of directory entries, for find_files.
+	 * Predicates are combined with &&, || and !. The cheapest predicates are evaluated first:
+	 * depth, type and names before size and modification time, which need a stat.
+	 * Example:
+	 * @code
+	 * // Files larger than 1 MiB modified in the last 7 days.
+	 * cx::file_query query = cx::file_query::type(cx::EFT_FILE) && cx::file_query::size_at_least(1 << 20)
+	 *     && cx::file_query::modified_after(time(NULL) - 7 * 86400);
+	 * @endcode
+	 */
+	class file_query {
+	public:
+		/**
+		 * @brief A query matching all entries.
+		 */
+		file_query();
+
+		/**
+		 * @brief Match the entries of at least size bytes.
+		 */
+		static file_query size_at_least(unsigned long long size);
+
+		/**
+		 * @brief Match the entries of at most size bytes.
+		 */
+		static file_query size_at_most(unsigned long long size);
+
+		/**
+		 * @brief Match the entries modified at time or later, in seconds since the epoch.
+		 */
+		static file_query modified_after(long long time);
+
+		/**
+		 * @brief Match the entries modified before time, in seconds since the epoch.
+		 */
+		static file_query modified_before(long long time);
+
+		/**
+		 * @brief Match the entries of the types, EFT_DIR and/or EFT_FILE.
+		 */
+		static file_query type(int filters);
+
+		/**
+		 * @brief Match the entry names with a glob pattern: '*', '?' and '[a-z]' or '[!a-z]'.
+		 */
+		static file_query name(const std::string& pattern);
+
+		/**
+		 * @brief Match the full paths with a glob pattern, where '*' also matches the separators.
+		 * Subtrees which cannot match the characters before the first wildcard are not walked.
+		 */
+		static file_query path(const std::string& pattern);
+
+		/**
+		 * @brief Match the entries of at least depth, the children of the walked directory being of depth 1.
+		 */
+		static file_query depth_at_least(int depth);
+
+		/**
+		 * @brief Match the entries of at most depth. Deeper subtrees are not walked.
+		 */
+		static file_query depth_at_most(int depth);
+
+		file_query operator&&(const file_query& other) const;
+		file_query operator||(const file_query& other) const;
+		file_query operator!() const;
+
+	private:
+		explicit file_query(const std::shared_ptr<_query_node>& node);
+
+		std::shared_ptr<_query_node> node;
+
+		friend void find_files(const std::string& dirName, const file_query& query, std::vector<directory_entry>& matches, int threads);
+	};
+
+	/**
+	 * @brief Find the entries of a directory tree matching a query.
+	 * The subdirectories are walked in parallel. Entries are typed from the directory listing and
+	 * only stated when a size or time predicate is evaluated. Links are not followed,
+	 * and sub-directories which cannot be opened are skipped.
+	 * @param dirName Directory name.
+	 * @param query The query.
+	 * @param matches The output entries, sorted by file name.
+	 * @param threads Count of worker threads. 0: hardware concurrency.
+	 * @throw invalid_argument When dirName is empty.
+	 * @throw io_exception When open directory failed.
+	 */
+	void find_files(const std::string& dirName, const file_query& query, std::vector<directory_entry>& matches, int threads = 0);
+
+	/**
+	 * @brief How clone_directories populates the files.
+	 */
+	enum CloneMode {
+		/**
+		 * @brief Hard link the files, falling back to a reflink or a copy where linking fails, such as across devices.
+		 */
+		CM_HARDLINK,
+
+		/**
+		 * @brief Clone the files sharing their data extents (FICLONE on Linux), falling back to a copy where unsupported.
+		 */
+		CM_REFLINK,
+
+		/**
+		 * @brief Copy the files.
+		 */
+		CM_COPY
+	};
+
+	/**
+	 * @brief Counts of entries created by clone_directories.
+	 */
+	struct clone_stats {
+		clone_stats() : directories(0), linked(0), reflinked(0), copied(0), symlinks(0) { }
+
+		/**
+		 * @brief Count of directories created, the destination included.
+		 */
+		size_t directories;
+
+		/**
+		 * @brief Count of files hard linked.
+		 */
+		size_t linked;
+
+		/**
+		 * @brief Count of files cloned by reflink.
+		 */
+		size_t reflinked;
+
+		/**
+		 * @brief Count of files copied.
+		 */
+		size_t copied;
+
+		/**
+		 * @brief Count of symbolic links recreated.
+		 */
+		size_t symlinks;
+	};
+
+	/**
+	 * @brief Recreate a directory tree, with its files hard linked, reflinked or copied.
+	 * The sub-directories are cloned in parallel, each one with directory relative calls (mkdirat, linkat)
+	 * on its opened source and destination. Symbolic links are recreated, not followed, and other
+	 * entries such as devices and sockets are skipped. The permissions of the directories are set
+	 * once all entries are created, so read-only trees can be cloned. On Windows the files are
+	 * hard linked or copied by the calling thread.
+	 * @param srcDir The source directory.
+	 * @param dstDir The destination directory, created if it does not exist. It must not be inside srcDir.
+	 * @param mode How the files are populated.
+	 * @param threads Count of worker threads. 0: hardware concurrency.
+	 * @return Counts of entries created.
+	 * @throw invalid_argument When srcDir or dstDir is empty.
+	 * @throw io_exception When a directory could not be opened, or an entry could not be created, such as an existing one.
+	 */
+	clone_stats clone_directories(const std::string& srcDir, const std::string& dstDir, CloneMode mode = CM_HARDLINK, int threads = 0);
+
+	/**
+	 * @brief A base directory for relative paths, held as an opened directory.
+	 * Relative names are resolved from the directory itself with the *at calls on POSIX, so they neither depend on
+	 * nor change the current directory, and still refer to the same directory after it is renamed.
+	 * On Windows the names are combined with the directory name instead, so they follow neither.
+	 * Absolute names are used as they are.
+	 * The changes invalidate the metadata caches under the names given by resolve. Cached entries spelled
+	 * otherwise, or resolved from another current directory or before the directory was renamed, are not
+	 * invalidated and must be invalidated by the caller.
+	 *
+	 * Thread safety: a context does not change once constructed. Its member functions are const, take no lock
+	 * and share nothing but the descriptor, which the kernel resolves from concurrently, so any count of threads
+	 * may use one context at the same time. The other functions of this library resolve relative paths from the
+	 * current directory, which is global to the process: they may run concurrently, but not while a thread changes
+	 * the current directory. A file_enumerator or a recursive_directory_range must be used by one thread at a time.
+	 * Example:
+	 * @code
+	 * cx::directory_context sandbox("/jobs/42");
+	 * sandbox.create_directory("out");
+	 * sandbox.write_all_bytes("out/result.bin", data);
+	 * @endcode
+	 */
+	class directory_context {
+	public:
+		/**
+		 * @brief Open a directory as a context.
+		 * @param dirName Directory name, relative to the current directory.
+		 * @throw invalid_argument When dirName is empty.
+		 * @throw io_exception When open directory failed.
+		 */
+		explicit directory_context(const std::string& dirName);
+
+		/**
+		 * @brief Open a sub-directory of a context as a context.
+		 * @param parent The parent context.
+		 * @param relName Directory name, relative to parent.
+		 * @throw invalid_argument When relName is empty.
+		 * @throw io_exception When open directory failed.
+		 */
+		directory_context(const directory_context& parent, const std::string& relName);
+
+		~directory_context();
+
+		/**
+		 * @brief Get the directory name the context was opened with.
+		 * @return The directory name.
+		 */
+		const std::string& path() const;
+
+		/**
+		 * @brief Get the name of an entry for the functions taking plain paths.
+		 * @param relName Name relative to the context.
+		 * @return The name combined with the directory name, or relName if it is absolute.
+		 */
+		std::string resolve(const std::string& relName) const;
+
+		/**
+		 * @brief Get the native descriptor of the directory.
+		 * @return The descriptor on POSIX, or -1 on Windows.
+		 */
+		int native_handle() const;
+
+		/**
+		 * @brief Check whether the entry is a file, as of cx::is_file.
+		 * @param relName Name relative to the context.
+		 * @return true if it is a file.
+		 */
+		bool is_file(const std::string& relName) const;
+
+		/**
+		 * @brief Check whether the entry is a directory, as of cx::is_directory.
+		 * @param relName Name relative to the context.
+		 * @return true if it is a directory.
+		 */
+		bool is_directory(const std::string& relName) const;
+
+		/**
+		 * @brief Get the status of a file or directory, as of cx::get_file_status.
+		 * @param relName Name relative to the context.
+		 * @param status The output status, its filename is relName.
+		 * @return true if successful, or false if the entry does not exist or is neither a file nor a directory.
+		 */
+		bool get_file_status(const std::string& relName, file_status& status) const;
+
+		/**
+		 * @brief Create a directory.
+		 * @param relName Name relative to the context.
+		 * @return true if successful, or false if failed.
+		 * @throw invalid_argument When relName is empty.
+		 */
+		bool create_directory(const std::string& relName) const;
+
+		/**
+		 * @brief Remove an empty directory.
+		 * @param relName Name relative to the context.
+		 * @return true if successful, or false if failed.
+		 * @throw invalid_argument When relName is empty.
+		 */
+		bool remove_directory(const std::string& relName) const;
+
+		/**
+		 * @brief Remove a file or a symbolic link.
+		 * @param relName Name relative to the context.
+		 * @return true if successful, false if the file does not exist.
+		 * @throw invalid_argument When relName is empty.
+		 * @throw io_exception When remove failed for other reasons.
+		 */
+		bool remove_file(const std::string& relName) const;
+
+		/**
+		 * @brief Rename a file or directory, replacing the new name if it exists.
+		 * @param oldName Name relative to the context.
+		 * @param newName New name relative to the context.
+		 * @throw invalid_argument When oldName or newName is empty.
+		 * @throw io_exception When rename failed.
+		 */
+		void rename(const std::string& oldName, const std::string& newName) const;
+
+		/**
+		 * @brief Read all bytes of a file.
+		 * @param relName Name relative to the context.
+		 * @param data The data buffer.
+		 * @throw invalid_argument When relName is empty.
+		 * @throw io_exception When open or read file failed.
+		 */
+		void read_all_bytes(const std::string& relName, std::vector<unsigned char>& data) const;
+
+		/**
+		 * @brief Write all bytes to a file.
+		 * @param relName Name relative to the context.
+		 * @param data The data buffer.
+		 * @param length Data length.
+		 * @param bAppend true: for append mode, false: for creation mode.
+		 * @throw invalid_argument When relName is empty.
+		 * @throw io_exception When open or write file failed.
+		 */
+		void write_all_bytes(const std::string& relName, const unsigned char* data, size_t length, bool bAppend = false) const;
+
+		/**
+		 * @brief Write all bytes to a file.
+		 * @param relName Name relative to the context.
+		 * @param data The data buffer.
+		 * @param bAppend true: for append mode, false: for creation mode.
+		 * @throw invalid_argument When relName is empty.
+		 * @throw io_exception When open or write file failed.
+		 */
+		void write_all_bytes(const std::string& relName, const std::vector<unsigned char>& data, bool bAppend = false) const;
+	private:
+		std::string dname;
+		int fd;
+	public:
+		directory_context(const directory_context&) = delete;
+		directory_context& operator=(const directory_context&) = delete;
+	};
 }
\ No newline at end of file
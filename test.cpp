@@ -2,13 +2,20 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
 
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <dirent.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #endif // _WIN32
 
@@ -525,6 +532,1831 @@ bool test_read_write() {
 	return true;
 }
 
+bool test_file_status() {
+	const char* baseDir = "mytestdir";
+	std::string subDir = cx::combine_paths(baseDir, "sub");
+	std::string file1 = cx::combine_paths(baseDir, "file1.txt");
+	std::string file2 = cx::combine_paths(subDir, "file2.txt");
+	cx::remove_directories(baseDir);
+	CREATE_DIR(subDir);
+
+	std::vector<unsigned char> data(100, 'x');
+	cx::write_all_bytes(file1, data);
+	cx::write_all_bytes(file2, data.data(), 10);
+
+	cx::file_status status;
+	ASSERT(!cx::get_file_status("", status));
+	ASSERT(!cx::get_file_status(cx::combine_paths(baseDir, "none"), status));
+	ASSERT(cx::get_file_status(file1, status));
+	ASSERT(status.type == cx::EFT_FILE);
+	ASSERT(status.size == 100);
+	ASSERT(status.mtime > 0);
+	ASSERT(cx::get_file_status(subDir, status));
+	ASSERT(status.type == cx::EFT_DIR);
+
+	std::vector<cx::file_status> entries;
+	cx::stat_directory(baseDir, entries);
+	ASSERT(entries.size() == 2);
+#ifndef _WIN32
+	ASSERT(entries[0].inode <= entries[1].inode);
+#endif // _WIN32
+	cx::stat_directory(baseDir, entries, cx::EFT_FILE);
+	ASSERT(entries.size() == 1);
+	ASSERT(entries[0].filename == file1);
+	ASSERT(entries[0].size == 100);
+	ASSERT_EXCEPTION(cx::stat_directory(cx::combine_paths(baseDir, "none"), entries), cx::io_exception);
+
+	unsigned long long totalSize = 0;
+	int count = 0;
+	cx::enum_all_files_status(baseDir, [&totalSize, &count](const cx::file_status& status, bool& cancelEnum) {
+			totalSize += status.size;
+			count++;
+		}, cx::EFT_FILE
+	);
+	ASSERT(count == 2);
+	ASSERT(totalSize == 110);
+
+	count = 0;
+	cx::enum_files_status(baseDir, [&count](const cx::file_status& status, bool& cancelEnum) {
+			count++;
+			cancelEnum = true;
+		}, cx::EFT_DIR | cx::EFT_FILE, 0
+	);
+	ASSERT(count == 1);
+
+#ifndef _WIN32
+	// links are skipped, a loop back to the parent is not followed.
+	ASSERT(symlink("..", cx::combine_paths(subDir, "loop").c_str()) == 0);
+	ASSERT(symlink("file1.txt", cx::combine_paths(baseDir, "link1").c_str()) == 0);
+	cx::stat_directory(baseDir, entries);
+	ASSERT(entries.size() == 2);
+	count = 0;
+	cx::enum_all_files_status(baseDir, [&count](const cx::file_status& status, bool& cancelEnum) {
+			count++;
+		}
+	);
+	ASSERT(count == 3);
+#endif // _WIN32
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_metadata_cache() {
+	const char* baseDir = "mytestdir";
+	std::string subDir = cx::combine_paths(baseDir, "sub");
+	std::string file1 = cx::combine_paths(baseDir, "file1.txt");
+	std::string file2 = cx::combine_paths(subDir, "file2.txt");
+	cx::remove_directories(baseDir);
+	CREATE_DIR(baseDir);
+
+	cx::metadata_cache cache(64, 0, 0);
+	ASSERT(!cache.is_file(""));
+	ASSERT(!cache.is_file(file1));
+	ASSERT(!cache.is_directory(subDir));
+	ASSERT(cache.size() == 2);
+
+	// negative entries are invalidated by the mutators.
+	CREATE_FILE(file1);
+	ASSERT(!cache.is_file(file1));
+	cx::write_all_bytes(file1, std::vector<unsigned char>(1, 'x'));
+	ASSERT(cache.is_file(file1));
+	ASSERT(!cache.is_directory(file1));
+	cx::create_directory(subDir);
+	ASSERT(cache.is_directory(subDir));
+
+	// positive entries are served from memory until invalidated.
+	::remove(file1.c_str());
+	ASSERT(cache.is_file(file1));
+	cache.invalidate(file1);
+	ASSERT(!cache.is_file(file1));
+
+	CREATE_FILE(file2);
+	ASSERT(cache.is_file(file2));
+	cx::rename(subDir, cx::combine_paths(baseDir, "sub2"));
+	ASSERT(!cache.is_file(file2));
+	ASSERT(!cache.is_directory(subDir));
+	ASSERT(cache.is_directory(cx::combine_paths(baseDir, "sub2")));
+
+	// entries expire.
+	{
+		cx::metadata_cache shortCache(4, 1, 1);
+		ASSERT(!shortCache.is_file(file1));
+		CREATE_FILE(file1);
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		ASSERT(shortCache.is_file(file1));
+		for (int i = 0; i < 100; i++) shortCache.is_file(cx::combine_paths(baseDir, std::to_string(i)));
+		ASSERT(shortCache.size() <= 16);
+	}
+
+#ifdef __linux__
+	// changes made by others are seen through inotify.
+	ASSERT(cache.watch(baseDir));
+	cache.invalidate(file1);
+	ASSERT(cache.is_file(file1));
+	::remove(file1.c_str());
+	bool invalidated = false;
+	for (int i = 0; i < 200 && !invalidated; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		invalidated = !cache.is_file(file1);
+	}
+	ASSERT(invalidated);
+#endif // __linux__
+
+	cx::remove_directories(baseDir);
+	ASSERT(!cache.is_directory(baseDir));
+	return true;
+}
+
+bool test_recursive_directory_range() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "a", "b"));
+	CREATE_DIR(cx::combine_paths(baseDir, "a", "c"));
+	CREATE_DIR(cx::combine_paths(baseDir, "b", "d"));
+	CREATE_FILE(cx::combine_paths(baseDir, "a", "file1.txt"));
+	CREATE_FILE(cx::combine_paths(baseDir, "b", "d", "file2.txt"));
+	CREATE_FILE(cx::combine_paths(baseDir, "file3.txt"));
+
+	// same order as enum_all_files.
+	{
+		std::vector<std::string> expected;
+		cx::enum_all_files(baseDir, [&expected](const std::string& fileName, cx::EnumFileType fileType, bool& cancelEnum) {
+				expected.push_back(fileName);
+			}
+		);
+		ASSERT(expected.size() == 8);
+
+		std::vector<std::string> names;
+		cx::recursive_directory_range range(baseDir);
+		for (const cx::directory_entry& entry : range) {
+			names.push_back(entry.filename);
+			ASSERT(entry.depth >= 1 && entry.depth <= 3);
+		}
+		ASSERT(names == expected);
+		ASSERT(range.finished());
+		ASSERT(range.begin() == range.end());
+	}
+
+	// pull in batches and resume after a break.
+	{
+		cx::recursive_directory_range range(baseDir, cx::EFT_FILE);
+		std::vector<cx::directory_entry> batch;
+		ASSERT(range.next(batch, 2) == 2);
+		ASSERT(batch[0].type == cx::EFT_FILE);
+		ASSERT(batch[1].type == cx::EFT_FILE);
+		std::string third;
+		for (const cx::directory_entry& entry : range) {
+			third = entry.filename;
+			break;
+		}
+		ASSERT(!third.empty());
+		ASSERT(range.next(batch, 2) == 1);
+		ASSERT(batch[0].filename == third);
+		ASSERT(range.next(batch, 2) == 0);
+		ASSERT(range.finished());
+	}
+
+	// depth and filters.
+	{
+		cx::recursive_directory_range range(baseDir, cx::EFT_DIR, 1);
+		std::vector<cx::directory_entry> batch;
+		ASSERT(range.next(batch, 100) == 2);
+		ASSERT(batch[0].depth == 1 && batch[1].depth == 1);
+	}
+
+	ASSERT_EXCEPTION(cx::recursive_directory_range(""), std::invalid_argument);
+	{
+		cx::recursive_directory_range range(cx::combine_paths(baseDir, "none"));
+		ASSERT_EXCEPTION(range.begin(), cx::io_exception);
+	}
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_process_files() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "a", "b"));
+
+	std::vector<std::string> files;
+	size_t totalSize = 0;
+	for (int i = 0; i < 50; i++) {
+		std::string filename = cx::combine_paths(baseDir, i % 2 ? "a" : "a/b", std::to_string(i) + ".txt");
+		std::vector<unsigned char> data(i * 100, (unsigned char)i);
+		cx::write_all_bytes(filename, data);
+		files.push_back(filename);
+		totalSize += data.size();
+	}
+
+	cx::pipeline_options options;
+	options.readThreads = 2;
+	options.processThreads = 3;
+	options.queueSize = 4;
+
+	{
+		std::mutex mutex;
+		size_t count = 0, size = 0;
+		bool contentOk = true;
+		cx::process_all_files(baseDir, [&](const std::string& filename, const unsigned char* data, size_t length, bool& cancelEnum) {
+				std::lock_guard<std::mutex> lock(mutex);
+				count++;
+				size += length;
+				for (size_t i = 0; i < length; i++) {
+					if (data[i] != length / 100) contentOk = false;
+				}
+			}, options
+		);
+		ASSERT(count == 50);
+		ASSERT(size == totalSize);
+		ASSERT(contentOk);
+	}
+
+	{
+		std::atomic<int> count(0);
+		options.processThreads = 1;
+		cx::process_files(files, [&count](const std::string& filename, const unsigned char* data, size_t length, bool& cancelEnum) {
+				if (++count == 10) cancelEnum = true;
+			}, options
+		);
+		ASSERT(count == 10);
+	}
+
+	ASSERT_EXCEPTION(cx::process_all_files(baseDir, [](const std::string& filename, const unsigned char* data, size_t length, bool& cancelEnum) {
+			throw std::runtime_error("process failed");
+		}), std::runtime_error);
+
+	files.push_back(cx::combine_paths(baseDir, "none"));
+	ASSERT_EXCEPTION(cx::process_files(files, [](const std::string& filename, const unsigned char* data, size_t length, bool& cancelEnum) {
+		}), cx::io_exception);
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_hash() {
+	const unsigned char* abc = (const unsigned char*)"abc";
+	const unsigned char* digits = (const unsigned char*)"123456789";
+	ASSERT(cx::hash_bytes(abc, 0, cx::HA_SHA256) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	ASSERT(cx::hash_bytes(abc, 3, cx::HA_SHA256) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	ASSERT(cx::hash_bytes(abc, 0, cx::HA_CRC32C) == "00000000");
+	ASSERT(cx::hash_bytes(digits, 9, cx::HA_CRC32C) == "e3069283");
+	ASSERT(cx::hash_bytes(abc, 0, cx::HA_XXH64) == "ef46db3751d8e999");
+	ASSERT(cx::hash_bytes(abc, 3, cx::HA_XXH64) == "44bc2cf5ad770999");
+	ASSERT_EXCEPTION(cx::hasher((cx::HashAlgorithm)0), std::invalid_argument);
+
+	std::vector<unsigned char> data(3 * 1024 * 1024 + 17);
+	for (size_t i = 0; i < data.size(); i++) data[i] = (unsigned char)(i * 31 + 7);
+
+	// incremental hashing gives the same digest for any split.
+	cx::HashAlgorithm algorithms[] = { cx::HA_CRC32C, cx::HA_XXH64, cx::HA_SHA256 };
+	for (cx::HashAlgorithm algorithm : algorithms) {
+		std::string digest = cx::hash_bytes(data.data(), data.size(), algorithm);
+		cx::hasher h(algorithm);
+		size_t pos = 0, step = 1;
+		while (pos < data.size()) {
+			size_t n = std::min(step, data.size() - pos);
+			h.update(data.data() + pos, n);
+			pos += n;
+			step = step * 7 % 1000 + 1;
+		}
+		ASSERT(h.digest() == digest);
+		h.reset();
+		ASSERT(h.digest() == cx::hash_bytes(abc, 0, algorithm));
+	}
+
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "a"));
+	std::string file1 = cx::combine_paths(baseDir, "a", "file1.bin");
+	std::string file2 = cx::combine_paths(baseDir, "file2.bin");
+	cx::write_all_bytes(file1, data);
+	cx::write_all_bytes(file2, abc, 3);
+
+	ASSERT(cx::hash_file(file1, cx::HA_SHA256) == cx::hash_bytes(data.data(), data.size(), cx::HA_SHA256));
+	ASSERT(cx::hash_file(file2, cx::HA_XXH64) == "44bc2cf5ad770999");
+	ASSERT_EXCEPTION(cx::hash_file(cx::combine_paths(baseDir, "none")), cx::io_exception);
+
+	std::vector<cx::file_hash> hashes;
+	cx::hash_tree(baseDir, hashes, cx::HA_CRC32C, 2);
+	ASSERT(hashes.size() == 2);
+	ASSERT(hashes[0].filename == file1);
+	ASSERT(hashes[0].digest == cx::hash_file(file1, cx::HA_CRC32C));
+	ASSERT(hashes[1].filename == file2);
+	ASSERT(hashes[1].digest == "364b3fb7");
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_find_duplicates() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "a"));
+
+	std::vector<unsigned char> big(100000, 'x');
+	std::vector<unsigned char> bigChanged = big;
+	bigChanged[50000] = 'y';
+	std::vector<unsigned char> small(100, 's');
+	std::vector<unsigned char> smallChanged = small;
+	smallChanged[50] = 't';
+
+	std::string big1 = cx::combine_paths(baseDir, "big1");
+	std::string big2 = cx::combine_paths(baseDir, "a", "big2");
+	std::string small1 = cx::combine_paths(baseDir, "small1");
+	std::string small2 = cx::combine_paths(baseDir, "a", "small2");
+	std::string empty1 = cx::combine_paths(baseDir, "empty1");
+	std::string empty2 = cx::combine_paths(baseDir, "a", "empty2");
+	cx::write_all_bytes(big1, big);
+	cx::write_all_bytes(big2, big);
+	cx::write_all_bytes(cx::combine_paths(baseDir, "big3"), bigChanged);
+	cx::write_all_bytes(small1, small);
+	cx::write_all_bytes(small2, small);
+	cx::write_all_bytes(cx::combine_paths(baseDir, "small3"), smallChanged);
+	cx::write_all_bytes(cx::combine_paths(baseDir, "unique"), std::vector<unsigned char>(12345, 'u'));
+	CREATE_FILE(empty1);
+	CREATE_FILE(empty2);
+
+	std::vector<std::vector<std::string> > groups;
+	unsigned long long bytesRead = cx::find_duplicates(baseDir, groups, 2);
+	ASSERT(groups.size() == 3);
+	ASSERT(groups[0] == std::vector<std::string>({ cx::combine_paths(baseDir, "a", "big2"), big1 }));
+	ASSERT(groups[1] == std::vector<std::string>({ empty2, empty1 }));
+	ASSERT(groups[2] == std::vector<std::string>({ small2, small1 }));
+	// the unique file is never read, the small files only once, the big ones fully only when the ends match.
+	ASSERT(bytesRead == 3 * 100 + 3 * 8192 + 3 * 100000);
+
+#ifndef _WIN32
+	// hard links are the same content without reading.
+	std::string link = cx::combine_paths(baseDir, "link");
+	ASSERT(::link(cx::combine_paths(baseDir, "unique").c_str(), link.c_str()) == 0);
+	bytesRead = cx::find_duplicates(baseDir, groups);
+	ASSERT(groups.size() == 4);
+	ASSERT(groups[3] == std::vector<std::string>({ link, cx::combine_paths(baseDir, "unique") }));
+	ASSERT(bytesRead == 3 * 100 + 3 * 8192 + 3 * 100000);
+
+	// symbolic links are not hard links of their targets.
+	ASSERT(symlink("unique", cx::combine_paths(baseDir, "symlink").c_str()) == 0);
+	bytesRead = cx::find_duplicates(baseDir, groups);
+	ASSERT(groups.size() == 4);
+	ASSERT(groups[3] == std::vector<std::string>({ link, cx::combine_paths(baseDir, "unique") }));
+#endif // _WIN32
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_search_tree() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "a"));
+
+	std::string file1 = cx::combine_paths(baseDir, "a", "file1.txt");
+	std::string file2 = cx::combine_paths(baseDir, "file2.log");
+	std::string text1 = "hello world\nfoo bar\r\nabcd foo\n";
+	std::string text2 = "no match here\nlast line with bar";
+	std::string binary = std::string("foo bar\0", 8);
+	cx::write_all_bytes(file1, (const unsigned char*)text1.data(), text1.size());
+	cx::write_all_bytes(file2, (const unsigned char*)text2.data(), text2.size());
+	cx::write_all_bytes(cx::combine_paths(baseDir, "binary.bin"), (const unsigned char*)binary.data(), binary.size());
+	CREATE_FILE(cx::combine_paths(baseDir, "empty.txt"));
+
+	std::vector<cx::search_match> matches;
+	cx::search_tree(baseDir, "foo", matches, 2);
+	ASSERT(matches.size() == 2);
+	ASSERT(matches[0].filename == file1);
+	ASSERT(matches[0].offset == 12);
+	ASSERT(matches[0].lineNumber == 2);
+	ASSERT(matches[0].line == "foo bar");
+	ASSERT(matches[1].offset == 26);
+	ASSERT(matches[1].lineNumber == 3);
+	ASSERT(matches[1].line == "abcd foo");
+
+	cx::search_tree(baseDir, std::vector<std::string>({ "bar", "abcd", "c", "line" }), matches);
+	ASSERT(matches.size() == 6);
+	ASSERT(matches[0].filename == file1 && matches[0].offset == 16 && matches[0].patternIndex == 0 && matches[0].lineNumber == 2);
+	ASSERT(matches[1].offset == 21 && matches[1].patternIndex == 1 && matches[1].lineNumber == 3);
+	ASSERT(matches[2].offset == 23 && matches[2].patternIndex == 2 && matches[2].lineNumber == 3);
+	ASSERT(matches[3].filename == file2 && matches[3].offset == 6 && matches[3].patternIndex == 2);
+	ASSERT(matches[3].lineNumber == 1 && matches[3].line == "no match here");
+	ASSERT(matches[4].offset == 19 && matches[4].patternIndex == 3);
+	ASSERT(matches[4].lineNumber == 2 && matches[4].line == "last line with bar");
+	ASSERT(matches[5].offset == 29 && matches[5].patternIndex == 0);
+
+	ASSERT_EXCEPTION(cx::search_tree(baseDir, "", matches), std::invalid_argument);
+	ASSERT_EXCEPTION(cx::search_tree(baseDir, std::vector<std::string>(), matches), std::invalid_argument);
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_compressed_bytes() {
+	std::string testfile = "fileutils-test_compressed.bin";
+	cx::remove_file(testfile);
+
+	std::vector<unsigned char> text;
+	for (int i = 0; i < 20000; i++) {
+		std::string line = "line " + std::to_string(i % 97) + ": the quick brown fox jumps over the lazy dog\n";
+		text.insert(text.end(), line.begin(), line.end());
+	}
+	std::vector<unsigned char> noise(100000);
+	unsigned int seed = 12345;
+	for (size_t i = 0; i < noise.size(); i++) {
+		seed = seed * 1103515245 + 12345;
+		noise[i] = (unsigned char)(seed >> 16);
+	}
+
+	cx::compression_options options;
+	options.blockSize = 64 * 1024;
+	options.threads = 3;
+
+	std::vector<unsigned char> data;
+	cx::write_compressed_bytes(testfile, text, false, options);
+	ASSERT(cx::is_compressed_file(testfile));
+	cx::file_status status;
+	ASSERT(cx::get_file_status(testfile, status));
+	ASSERT(status.size < text.size() / 4);
+	cx::read_compressed_bytes(testfile, data);
+	ASSERT(data == text);
+
+	// incompressible blocks are stored, frames can be appended.
+	cx::write_compressed_bytes(testfile, noise, true, options);
+	ASSERT(cx::get_file_status(testfile, status));
+	cx::read_compressed_bytes(testfile, data);
+	ASSERT(data.size() == text.size() + noise.size());
+	ASSERT(std::equal(text.begin(), text.end(), data.begin()));
+	ASSERT(std::equal(noise.begin(), noise.end(), data.begin() + text.size()));
+
+	cx::write_compressed_bytes(testfile, NULL, 0);
+	cx::read_compressed_bytes(testfile, data);
+	ASSERT(data.empty());
+	for (size_t n = 1; n < 40; n++) {
+		cx::write_compressed_bytes(testfile, text.data(), n);
+		cx::read_compressed_bytes(testfile, data);
+		ASSERT(data.size() == n && std::equal(data.begin(), data.end(), text.begin()));
+	}
+
+	// files without frames are read as they are.
+	cx::write_all_bytes(testfile, text);
+	ASSERT(!cx::is_compressed_file(testfile));
+	cx::read_compressed_bytes(testfile, data);
+	ASSERT(data == text);
+
+	// corrupted frames are detected.
+	cx::write_compressed_bytes(testfile, text);
+	cx::read_all_bytes(testfile, data);
+	data[data.size() / 2] ^= 0x55;
+	cx::write_all_bytes(testfile, data);
+	try {
+		cx::read_compressed_bytes(testfile, data);
+		ASSERT(false);
+	} catch (const cx::io_exception& e) {
+#ifdef _WIN32
+		ASSERT(e.error_code() == ERROR_INVALID_DATA);
+#else
+		ASSERT(e.error_code() == EBADMSG);
+#endif // _WIN32
+	}
+
+	// I/O errors keep their code.
+	cx::remove_file(testfile);
+	try {
+		cx::read_compressed_bytes(testfile, data);
+		ASSERT(false);
+	} catch (const cx::io_exception& e) {
+#ifdef _WIN32
+		ASSERT(e.error_code() == ERROR_FILE_NOT_FOUND);
+#else
+		ASSERT(e.error_code() == ENOENT);
+#endif // _WIN32
+	}
+	return true;
+}
+
+bool test_pack() {
+	const char* baseDir = "mytestdir";
+	std::string packFile = "fileutils-test.pack";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "a", "b"));
+
+	std::vector<std::string> names;
+	for (int i = 0; i < 300; i++) {
+		std::string name = (i % 3 == 0 ? "a/b/" : i % 3 == 1 ? "a/" : "") + std::to_string(i) + ".txt";
+		std::string content = "content of " + name;
+		cx::write_all_bytes(cx::combine_paths(baseDir, name), (const unsigned char*)content.data(), content.size());
+		names.push_back(name);
+	}
+	CREATE_FILE(cx::combine_paths(baseDir, "empty"));
+	names.push_back("empty");
+
+	ASSERT(cx::build_pack(baseDir, packFile) == names.size());
+
+	cx::pack_reader pack;
+	const unsigned char* data = NULL;
+	size_t length = 0;
+	ASSERT(!pack.read("a/1.txt", data, length));
+	pack.open(packFile);
+	ASSERT(pack.file_count() == names.size());
+
+	for (size_t i = 0; i < names.size(); i++) {
+		ASSERT(pack.read(names[i], data, length));
+		std::string expected = names[i] == "empty" ? "" : "content of " + names[i];
+		ASSERT(std::string((const char*)data, length) == expected);
+	}
+	ASSERT(!pack.read("a/b/1.txt", data, length));
+	ASSERT(!pack.read("none", data, length));
+	ASSERT(!pack.read("", data, length));
+
+	std::vector<std::string> paths;
+	pack.list(paths);
+	std::sort(paths.begin(), paths.end());
+	std::sort(names.begin(), names.end());
+	ASSERT(paths == names);
+
+	pack.close();
+	ASSERT(!pack.read("a/1.txt", data, length));
+	cx::write_all_bytes(packFile, std::vector<unsigned char>(100, 0));
+	ASSERT_EXCEPTION(pack.open(packFile), cx::io_exception);
+	ASSERT_EXCEPTION(pack.open(cx::combine_paths(baseDir, "none")), cx::io_exception);
+
+	// A pack inside the tree is packed neither into itself nor into the next one.
+	std::string innerPack = cx::combine_paths(".", baseDir, "inner.pack");
+	ASSERT(cx::build_pack(baseDir, innerPack) == names.size());
+	ASSERT(cx::build_pack(baseDir, innerPack) == names.size());
+	pack.open(innerPack);
+	ASSERT(pack.file_count() == names.size() && !pack.read("inner.pack", data, length));
+	pack.close();
+	ASSERT(!cx::is_file(innerPack + ".tmp"));
+	ASSERT(cx::remove_file(innerPack));
+
+#ifndef _WIN32
+	// Dangling links are skipped.
+	ASSERT(symlink("none", cx::combine_paths(baseDir, "dangling").c_str()) == 0);
+	ASSERT(cx::build_pack(baseDir, packFile) == names.size());
+#endif // _WIN32
+
+	// A failed build keeps the previous pack.
+	std::vector<unsigned char> previous, kept;
+	cx::read_all_bytes(packFile, previous);
+	CREATE_DIR(packFile + ".tmp");
+	ASSERT_EXCEPTION(cx::build_pack(baseDir, packFile), cx::io_exception);
+	cx::read_all_bytes(packFile, kept);
+	ASSERT(kept == previous);
+	ASSERT(cx::remove_directory(packFile + ".tmp"));
+
+	cx::remove_file(packFile);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_sparse_files() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(baseDir);
+	std::string sparseFile = cx::combine_paths(baseDir, "sparse.bin");
+	std::string copyFile = cx::combine_paths(baseDir, "copy.bin");
+
+	// 1 MiB of zeros with data at the start and at 512 KiB.
+	std::vector<unsigned char> content(1024 * 1024, 0);
+	for (size_t i = 0; i < 100; i++) content[i] = (unsigned char)(i + 1);
+	for (size_t i = 512 * 1024; i < 512 * 1024 + 5000; i++) content[i] = (unsigned char)i | 1;
+	cx::write_sparse_bytes(sparseFile, content.data(), content.size());
+
+	std::vector<unsigned char> data;
+	cx::read_all_bytes(sparseFile, data);
+	ASSERT(data == content);
+
+	std::vector<cx::file_extent> extents;
+	ASSERT(cx::get_data_extents(sparseFile, extents) == content.size());
+	ASSERT(!extents.empty());
+	unsigned long long total = 0;
+	for (size_t i = 0; i < extents.size(); i++) {
+		if (i > 0) ASSERT(extents[i].offset >= extents[i - 1].offset + extents[i - 1].length);
+		total += extents[i].length;
+	}
+	ASSERT(total <= content.size());
+	// Where the file system reports holes, as for a file which is one hole, the zeros are not written.
+	std::string holeFile = cx::combine_paths(baseDir, "hole.bin");
+	std::vector<cx::file_extent> holeExtents;
+	cx::write_data_extents(holeFile, holeExtents, std::vector<unsigned char>(), content.size());
+	cx::get_data_extents(holeFile, holeExtents);
+	if (holeExtents.empty()) ASSERT(total < content.size());
+
+	ASSERT(cx::read_data_extents(sparseFile, extents, data) == content.size());
+	ASSERT(data.size() == total);
+	size_t pos = 0;
+	for (size_t i = 0; i < extents.size(); i++) {
+		ASSERT(memcmp(data.data() + pos, content.data() + extents[i].offset, (size_t)extents[i].length) == 0);
+		pos += (size_t)extents[i].length;
+	}
+
+	ASSERT(cx::copy_file(sparseFile, copyFile) == total);
+	cx::read_all_bytes(copyFile, data);
+	ASSERT(data == content);
+
+	std::vector<cx::file_extent> written(1);
+	written[0].offset = 4096;
+	written[0].length = 3;
+	cx::write_data_extents(copyFile, written, std::vector<unsigned char>(3, 'x'), 10000);
+	cx::read_all_bytes(copyFile, data);
+	ASSERT(data.size() == 10000);
+	ASSERT(data[4095] == 0 && data[4096] == 'x' && data[4098] == 'x' && data[4099] == 0);
+	ASSERT_EXCEPTION(cx::write_data_extents(copyFile, written, std::vector<unsigned char>(3, 'x'), 100), std::invalid_argument);
+	ASSERT_EXCEPTION(cx::write_data_extents(copyFile, written, std::vector<unsigned char>(2, 'x'), 10000), std::invalid_argument);
+
+	cx::write_sparse_bytes(copyFile, content.data(), 0);
+	ASSERT(cx::get_data_extents(copyFile, extents) == 0);
+	ASSERT(cx::copy_file(copyFile, sparseFile) == 0);
+	cx::file_status status;
+	ASSERT(cx::get_file_status(sparseFile, status) && status.size == 0);
+
+	ASSERT_EXCEPTION(cx::copy_file(cx::combine_paths(baseDir, "none"), copyFile), cx::io_exception);
+	ASSERT_EXCEPTION(cx::copy_file(baseDir, copyFile), cx::io_exception);
+
+	// Copying a file onto itself fails and keeps its content.
+	cx::write_all_bytes(copyFile, content);
+	ASSERT_EXCEPTION(cx::copy_file(copyFile, cx::combine_paths(".", copyFile)), cx::io_exception);
+#ifndef _WIN32
+	try {
+		cx::copy_file(copyFile, cx::combine_paths(".", copyFile));
+		ASSERT(false);
+	} catch (const cx::io_exception& e) {
+		ASSERT(e.error_code() == EINVAL);
+	}
+	std::string hardLink = cx::combine_paths(baseDir, "hardlink.bin");
+	ASSERT(::link(copyFile.c_str(), hardLink.c_str()) == 0);
+	ASSERT_EXCEPTION(cx::copy_file(copyFile, hardLink), cx::io_exception);
+#endif // _WIN32
+	cx::read_all_bytes(copyFile, data);
+	ASSERT(data == content);
+	ASSERT_EXCEPTION(cx::get_data_extents(cx::combine_paths(baseDir, "none"), extents), cx::io_exception);
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_file_prefetcher() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "a"));
+
+	std::vector<std::string> files;
+	for (int i = 0; i < 50; i++) {
+		std::string filename = cx::combine_paths(baseDir, i % 2 ? "a" : "", std::to_string(i) + ".txt");
+		cx::write_all_bytes(filename, std::vector<unsigned char>(100 + i, 'x'));
+		files.push_back(filename);
+	}
+
+	{
+		cx::prefetch_options options;
+		options.minWindow = 2;
+		options.maxWindow = 8;
+		cx::file_prefetcher prefetcher(files, options);
+		std::string filename;
+		std::vector<std::string> result;
+		while (prefetcher.next(filename)) {
+			result.push_back(filename);
+			ASSERT(prefetcher.window() >= 2 && prefetcher.window() <= 8);
+		}
+		ASSERT(result == files);
+		ASSERT(!prefetcher.next(filename));
+	}
+
+	{
+		cx::file_prefetcher prefetcher(baseDir);
+		std::string filename;
+		std::vector<std::string> result;
+		std::vector<unsigned char> data;
+		while (prefetcher.next(filename)) {
+			cx::read_all_bytes(filename, data);
+			result.push_back(filename);
+		}
+		std::sort(result.begin(), result.end());
+		std::sort(files.begin(), files.end());
+		ASSERT(result == files);
+	}
+
+	{
+		// Stop before the consumer is done.
+		cx::file_prefetcher prefetcher(files);
+		std::string filename;
+		ASSERT(prefetcher.next(filename));
+	}
+
+	{
+		std::vector<std::string> none;
+		cx::file_prefetcher prefetcher(none);
+		std::string filename;
+		ASSERT(!prefetcher.next(filename));
+	}
+
+	ASSERT_EXCEPTION(cx::file_prefetcher(std::string()), std::invalid_argument);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+template<class T>
+struct counting_allocator : std::allocator<T> {
+	template<class U> struct rebind { typedef counting_allocator<U> other; };
+	counting_allocator() { }
+	template<class U> counting_allocator(const counting_allocator<U>&) { }
+	T* allocate(size_t n) { allocations()++; return std::allocator<T>::allocate(n); }
+	static int& allocations() { static int count = 0; return count; }
+};
+
+bool test_buffer_pool() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(baseDir);
+	std::string smallFile = cx::combine_paths(baseDir, "small.txt");
+	std::string largeFile = cx::combine_paths(baseDir, "large.bin");
+	std::string emptyFile = cx::combine_paths(baseDir, "empty.txt");
+	cx::write_all_bytes(smallFile, std::vector<unsigned char>(100, 's'));
+	cx::write_all_bytes(largeFile, std::vector<unsigned char>(3 * 1024 * 1024, 'l'));
+	CREATE_FILE(emptyFile);
+
+	{
+		cx::buffer_pool pool;
+		cx::pooled_buffer buffer = pool.acquire(5000);
+		ASSERT(buffer.size() == 5000 && buffer.capacity() == 8192);
+		unsigned char* p = buffer.data();
+		buffer.reset();
+		ASSERT(buffer.data() == NULL && pool.cached_bytes() == 8192);
+		buffer = pool.acquire(8000);
+		ASSERT(buffer.data() == p && pool.cached_bytes() == 0);
+		ASSERT_EXCEPTION(buffer.resize(8193), std::invalid_argument);
+
+		cx::pooled_buffer moved(std::move(buffer));
+		ASSERT(buffer.data() == NULL && moved.data() == p);
+
+		// Alternate small and large files, the buffers are reused.
+		cx::pooled_buffer small, large;
+		for (int i = 0; i < 3; i++) {
+			cx::read_all_bytes(smallFile, pool, small);
+			cx::read_all_bytes(largeFile, pool, large);
+			ASSERT(small.size() == 100 && small.data()[99] == 's');
+			ASSERT(large.size() == 3 * 1024 * 1024 && large.data()[large.size() - 1] == 'l');
+			p = large.data();
+			cx::read_all_bytes(emptyFile, pool, large);
+			ASSERT(large.empty() && large.data() == p);
+		}
+		large.reset();
+		ASSERT(pool.cached_bytes() == 4 * 1024 * 1024);
+		large = pool.acquire(4 * 1024 * 1024);
+		ASSERT(large.data() == p);
+		large.reset();
+		pool.trim();
+		ASSERT(pool.cached_bytes() == 0);
+
+		cx::buffer_pool tinyPool(0);
+		cx::pooled_buffer tiny = tinyPool.acquire(1);
+		tiny.reset();
+		ASSERT(tinyPool.cached_bytes() == 0);
+		ASSERT_EXCEPTION(cx::read_all_bytes(cx::combine_paths(baseDir, "none"), pool, tiny), cx::io_exception);
+	}
+
+	{
+		std::vector<unsigned char, counting_allocator<unsigned char> > data;
+		cx::read_all_bytes(largeFile, data);
+		ASSERT(data.size() == 3 * 1024 * 1024 && data[0] == 'l');
+		int allocations = counting_allocator<unsigned char>::allocations();
+		ASSERT(allocations > 0);
+		cx::read_all_bytes(smallFile, data);
+		ASSERT(data.size() == 100 && data[0] == 's');
+		ASSERT(counting_allocator<unsigned char>::allocations() == allocations);
+	}
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_vectored_io() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(baseDir);
+	std::string filename = cx::combine_paths(baseDir, "record.bin");
+
+	std::string header = "HEAD", payload(100000, 'p'), footer = "FOOT";
+	std::vector<cx::const_buffer> buffers;
+	buffers.push_back(cx::const_buffer(header.data(), header.size()));
+	buffers.push_back(cx::const_buffer(NULL, 0));
+	buffers.push_back(cx::const_buffer(payload.data(), payload.size()));
+	buffers.push_back(cx::const_buffer(footer.data(), footer.size()));
+	cx::write_all_bytes(filename, buffers);
+
+	std::vector<unsigned char> data;
+	cx::read_all_bytes(filename, data);
+	ASSERT(std::string(data.begin(), data.end()) == header + payload + footer);
+
+	cx::write_all_bytes(filename, buffers.data() + 3, 1, true);
+	cx::read_all_bytes(filename, data);
+	ASSERT(std::string(data.begin(), data.end()) == header + payload + footer + footer);
+
+	char head[4], body[10], tail[8];
+	std::vector<cx::mutable_buffer> targets;
+	targets.push_back(cx::mutable_buffer(head, sizeof(head)));
+	targets.push_back(cx::mutable_buffer(body, sizeof(body)));
+	ASSERT(cx::read_bytes(filename, targets) == 14);
+	ASSERT(std::string(head, 4) == "HEAD" && std::string(body, 10) == std::string(10, 'p'));
+	targets.clear();
+	targets.push_back(cx::mutable_buffer(tail, sizeof(tail)));
+	targets.push_back(cx::mutable_buffer(body, sizeof(body)));
+	ASSERT(cx::read_bytes(filename, targets, header.size() + payload.size()) == 8);
+	ASSERT(std::string(tail, 8) == "FOOTFOOT");
+
+	// More buffers than one system call takes.
+	std::vector<unsigned char> bytes(5000);
+	for (size_t i = 0; i < bytes.size(); i++) bytes[i] = (unsigned char)(i * 7);
+	buffers.clear();
+	for (size_t i = 0; i < bytes.size(); i++) buffers.push_back(cx::const_buffer(&bytes[i], 1));
+	cx::write_all_bytes(filename, buffers);
+	cx::read_all_bytes(filename, data);
+	ASSERT(data == bytes);
+	std::vector<unsigned char> readBack(bytes.size());
+	targets.clear();
+	for (size_t i = 0; i < readBack.size(); i++) targets.push_back(cx::mutable_buffer(&readBack[i], 1));
+	ASSERT(cx::read_bytes(filename, targets) == bytes.size());
+	ASSERT(readBack == bytes);
+
+	cx::write_all_bytes(filename, std::vector<cx::const_buffer>());
+	cx::read_all_bytes(filename, data);
+	ASSERT(data.empty());
+	ASSERT(cx::read_bytes(filename, targets) == 0);
+
+	ASSERT_EXCEPTION(cx::write_all_bytes(filename, (const cx::const_buffer*)NULL, 1), std::invalid_argument);
+	ASSERT_EXCEPTION(cx::read_bytes(cx::combine_paths(baseDir, "none"), targets), cx::io_exception);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_append_writer() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(baseDir);
+	std::string logFile = cx::combine_paths(baseDir, "audit.log");
+
+	{
+		cx::append_options options;
+		options.ringSize = 64;
+		cx::append_writer writer(logFile, options);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; t++) {
+			threads.push_back(std::thread([&writer, t]() {
+				for (int i = 0; i < 5000; i++) writer.append("record " + std::to_string(t) + " " + std::to_string(i) + "\n");
+			}));
+		}
+		for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+		writer.flush();
+
+		std::vector<unsigned char> data;
+		cx::read_all_bytes(logFile, data);
+		std::vector<int> next(4, 0);
+		size_t lines = 0;
+		std::string content(data.begin(), data.end());
+		for (size_t pos = 0; pos < content.size(); lines++) {
+			size_t end = content.find('\n', pos);
+			ASSERT(end != std::string::npos);
+			int t = 0, i = 0;
+			ASSERT(sscanf(content.c_str() + pos, "record %d %d", &t, &i) == 2);
+			// Records of one thread keep their order.
+			ASSERT(t >= 0 && t < 4 && next[t] == i);
+			next[t]++;
+			pos = end + 1;
+		}
+		ASSERT(lines == 20000);
+		writer.append("tail\n");
+	}
+	std::vector<unsigned char> data;
+	cx::read_all_bytes(logFile, data);
+	ASSERT(std::string(data.end() - 5, data.end()) == "tail\n");
+
+	{
+		// Append to the existing file, rotate by size.
+		cx::write_all_bytes(logFile + ".1", std::vector<unsigned char>(1, 'x'));
+		cx::append_options options;
+		options.syncPolicy = cx::SP_COMMIT;
+		options.rotateSize = 1000;
+		cx::append_writer writer(logFile, options);
+		std::string record(100, 'r');
+		record += '\n';
+		for (int i = 0; i < 32; i++) {
+			writer.append(record);
+			if (i % 5 == 4) writer.flush();
+		}
+		writer.flush();
+		ASSERT(writer.rotation_count() == 3);
+		cx::read_all_bytes(logFile + ".1", data);
+		ASSERT(data.size() == 1);
+		cx::read_all_bytes(logFile + ".2", data);
+		ASSERT(data.size() > 1000 && std::string(data.end() - 5 * record.size() - 5, data.end() - 5 * record.size()) == "tail\n");
+		cx::read_all_bytes(logFile + ".3", data);
+		ASSERT(data.size() == 10 * record.size());
+		cx::read_all_bytes(logFile + ".4", data);
+		ASSERT(data.size() == 10 * record.size());
+		cx::read_all_bytes(logFile, data);
+		ASSERT(data.size() == 7 * record.size());
+	}
+
+	{
+		cx::append_options options;
+		options.syncPolicy = cx::SP_INTERVAL;
+		options.rotateInterval = 1;
+		cx::append_writer writer(logFile, options);
+		writer.append("a\n");
+		writer.flush();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+		writer.append("b\n");
+		writer.flush();
+		ASSERT(writer.rotation_count() == 1);
+		cx::read_all_bytes(logFile, data);
+		ASSERT(std::string(data.begin(), data.end()) == "b\n");
+	}
+
+	ASSERT_EXCEPTION(cx::append_writer(cx::combine_paths(baseDir, "none", "log")), cx::io_exception);
+	ASSERT_EXCEPTION(cx::append_writer(""), std::invalid_argument);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_move_files() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "src"));
+	CREATE_DIR(cx::combine_paths(baseDir, "dst1"));
+	CREATE_DIR(cx::combine_paths(baseDir, "dst2"));
+
+	std::vector<cx::move_request> requests;
+	for (int i = 0; i < 100; i++) {
+		std::string name = std::to_string(i) + ".txt";
+		cx::write_all_bytes(cx::combine_paths(baseDir, "src", name), std::vector<unsigned char>(1, (unsigned char)i));
+		requests.push_back(cx::move_request(cx::combine_paths(baseDir, "src", name), cx::combine_paths(baseDir, i % 2 ? "dst1" : "dst2", name)));
+	}
+	requests.push_back(cx::move_request(cx::combine_paths(baseDir, "src", "none"), cx::combine_paths(baseDir, "dst1", "none")));
+	requests.push_back(cx::move_request(cx::combine_paths(baseDir, "src", "0.txt"), cx::combine_paths(baseDir, "none", "0.txt")));
+
+	std::vector<int> errors;
+	ASSERT(cx::move_files(requests, errors, cx::MF_NONE, 4) == 100);
+	ASSERT(errors.size() == requests.size());
+	for (int i = 0; i < 100; i++) {
+		ASSERT(errors[i] == 0);
+		ASSERT(cx::is_file(requests[i].target) && !cx::is_file(requests[i].source));
+	}
+#ifndef _WIN32
+	ASSERT(errors[100] == ENOENT);
+	ASSERT(errors[101] == ENOENT);
+#else
+	ASSERT(errors[100] != 0 && errors[101] != 0);
+#endif // _WIN32
+
+	// No replace keeps the existing target.
+	std::string a = cx::combine_paths(baseDir, "dst1", "1.txt"), b = cx::combine_paths(baseDir, "dst2", "0.txt");
+	requests.clear();
+	requests.push_back(cx::move_request(a, b));
+	ASSERT(cx::move_files(requests, errors, cx::MF_NOREPLACE) == 0);
+#ifndef _WIN32
+	ASSERT(errors[0] == EEXIST);
+#endif // _WIN32
+	ASSERT(cx::is_file(a) && cx::is_file(b));
+
+	std::vector<unsigned char> data;
+#ifdef __linux__
+	// Exchange swaps the contents.
+	std::vector<int> exchangeErrors;
+	if (cx::move_files(requests, exchangeErrors, cx::MF_EXCHANGE) == 1) {
+		cx::read_all_bytes(a, data);
+		ASSERT(data.size() == 1 && data[0] == 0);
+		cx::read_all_bytes(b, data);
+		ASSERT(data.size() == 1 && data[0] == 1);
+		ASSERT(cx::move_files(requests, exchangeErrors, cx::MF_EXCHANGE) == 1);
+	}
+	else {
+		ASSERT(exchangeErrors[0] == ENOTSUP || exchangeErrors[0] == EINVAL);
+	}
+
+	// Across devices, the file is copied then unlinked.
+	if (cx::is_directory("/dev/shm")) {
+		std::string other = "/dev/shm/fileutils-test-move.txt";
+		requests[0] = cx::move_request(a, other);
+		if (cx::move_files(requests, errors) == 1) {
+			ASSERT(!cx::is_file(a));
+			cx::read_all_bytes(other, data);
+			ASSERT(data.size() == 1 && data[0] == 1);
+			requests[0] = cx::move_request(other, a);
+			ASSERT(cx::move_files(requests, errors, cx::MF_NOCOPY) == 0 && errors[0] == EXDEV);
+			ASSERT(cx::move_files(requests, errors) == 1);
+			ASSERT(cx::is_file(a) && !cx::is_file(other));
+		}
+	}
+#endif // __linux__
+
+	// A directory is moved as a whole.
+	requests.clear();
+	requests.push_back(cx::move_request(cx::combine_paths(baseDir, "dst1"), cx::combine_paths(baseDir, "src", "dst1")));
+	ASSERT(cx::move_files(requests, errors) == 1);
+	ASSERT(cx::is_file(cx::combine_paths(baseDir, "src", "dst1", "1.txt")));
+
+	try {
+		cx::rename(cx::combine_paths(baseDir, "none"), cx::combine_paths(baseDir, "none2"));
+		ASSERT(false);
+	}
+	catch (const cx::io_exception& e) {
+		ASSERT(e.error_code() == ENOENT);
+	}
+
+	ASSERT_EXCEPTION(cx::move_files(requests, errors, cx::MF_NOREPLACE | cx::MF_EXCHANGE), std::invalid_argument);
+	requests[0].target.clear();
+	ASSERT_EXCEPTION(cx::move_files(requests, errors), std::invalid_argument);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_error_codes() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "a", "b"));
+	CREATE_DIR(cx::combine_paths(baseDir, "c"));
+	std::string file1 = cx::combine_paths(baseDir, "a", "file1.txt");
+	std::string none = cx::combine_paths(baseDir, "none");
+
+	std::error_code ec;
+	std::vector<unsigned char> data(3, 'x');
+	cx::write_all_bytes(file1, data, false, ec);
+	ASSERT(!ec);
+	cx::write_all_bytes(file1, data.data(), 2, true, ec);
+	ASSERT(!ec);
+	cx::read_all_bytes(file1, data, ec);
+	ASSERT(!ec && data.size() == 5);
+	cx::read_all_bytes(none, data, ec);
+	ASSERT(ec == std::errc::no_such_file_or_directory);
+	cx::read_all_bytes("", data, ec);
+	ASSERT(ec == std::errc::invalid_argument);
+	cx::write_all_bytes(cx::combine_paths(none, "f"), data, false, ec);
+	ASSERT(ec == std::errc::no_such_file_or_directory);
+
+	std::string file2 = cx::combine_paths(baseDir, "c", "file2.txt");
+	cx::rename(file1, file2, ec);
+	ASSERT(!ec && cx::is_file(file2));
+	cx::rename(file1, file2, ec);
+	ASSERT(ec == std::errc::no_such_file_or_directory);
+
+	ASSERT(!cx::remove_file(none, ec) && !ec);
+	ASSERT(!cx::remove_file(baseDir, ec) && ec == std::errc::is_a_directory);
+	ASSERT(cx::remove_file(file2, ec) && !ec);
+
+	cx::file_enumerator fe;
+	ASSERT(!fe.begin(none, ec) && ec == std::errc::no_such_file_or_directory);
+	ASSERT(fe.begin(baseDir, ec) && !ec);
+	fe.end();
+	try {
+		fe.begin(none);
+		ASSERT(false);
+	}
+	catch (const cx::io_exception& e) {
+		ASSERT(e.error_code() == ENOENT);
+	}
+
+	// Error callback: skip, retry, abort.
+	std::vector<std::string> names;
+	auto collect = [&names](const std::string& filename, cx::EnumFileType, bool&) { names.push_back(filename); };
+	std::vector<std::string> failed;
+	ASSERT(cx::enum_all_files(none, collect, cx::EFT_DIR | cx::EFT_FILE, [&failed](const std::string& path, const std::error_code&) {
+		failed.push_back(path);
+		return cx::EA_SKIP;
+	}));
+	ASSERT(failed.size() == 1 && failed[0] == none && names.empty());
+
+	int retries = 0;
+	ASSERT(!cx::enum_all_files(none, collect, cx::EFT_DIR | cx::EFT_FILE, [&retries](const std::string&, const std::error_code&) {
+		return ++retries < 3 ? cx::EA_RETRY : cx::EA_ABORT;
+	}));
+	ASSERT(retries == 3);
+
+	failed.clear();
+	auto skip = [&failed](const std::string& path, const std::error_code&) {
+		failed.push_back(path);
+		return cx::EA_SKIP;
+	};
+	ASSERT(cx::enum_all_files(baseDir, collect, cx::EFT_DIR | cx::EFT_FILE, skip));
+	std::sort(names.begin(), names.end());
+	ASSERT(names.size() == 3 && failed.empty());
+	names.clear();
+	ASSERT(cx::enum_files(baseDir, collect, cx::EFT_DIR, 1, skip));
+	ASSERT(names.size() == 2);
+
+	// Cancel stops the whole walk.
+	names.clear();
+	ASSERT(cx::enum_all_files(baseDir, [&names](const std::string& filename, cx::EnumFileType, bool& cancelEnum) {
+		names.push_back(filename);
+		cancelEnum = true;
+	}, cx::EFT_DIR | cx::EFT_FILE, skip));
+	ASSERT(names.size() == 1);
+
+#ifndef _WIN32
+	if (geteuid() != 0) {
+		std::string locked = cx::combine_paths(baseDir, "a", "b");
+		chmod(locked.c_str(), 0);
+		failed.clear();
+		names.clear();
+		ASSERT(cx::enum_all_files(baseDir, collect, cx::EFT_DIR | cx::EFT_FILE, skip));
+		ASSERT(failed.size() == 1 && failed[0] == locked && names.size() == 3);
+		chmod(locked.c_str(), 0755);
+	}
+#endif // _WIN32
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_walk_files() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(cx::combine_paths(baseDir, "a", "b"));
+	CREATE_FILE(cx::combine_paths(baseDir, "a", "b", "file1.txt"));
+	CREATE_FILE(cx::combine_paths(baseDir, "file2.txt"));
+
+	std::vector<std::string> names;
+	auto collect = [&names](const cx::directory_entry& entry, bool&) {
+		names.push_back(entry.filename + (entry.type == cx::EFT_DIR ? "/" : "") + (entry.symlink ? "@" : ""));
+	};
+	cx::walk_files(baseDir, collect);
+	std::sort(names.begin(), names.end());
+	std::vector<std::string> expected;
+	expected.push_back(cx::combine_paths(baseDir, "a") + "/");
+	expected.push_back(cx::combine_paths(baseDir, "a", "b") + "/");
+	expected.push_back(cx::combine_paths(baseDir, "a", "b", "file1.txt"));
+	expected.push_back(cx::combine_paths(baseDir, "file2.txt"));
+	ASSERT(names == expected);
+
+#ifndef _WIN32
+	// A link cycle, a link to a directory, a link to a file, a socket and a pipe.
+	ASSERT(symlink("..", cx::combine_paths(baseDir, "a", "b", "loop").c_str()) == 0);
+	ASSERT(symlink("a/b", cx::combine_paths(baseDir, "linkb").c_str()) == 0);
+	ASSERT(symlink("file2.txt", cx::combine_paths(baseDir, "link2").c_str()) == 0);
+	ASSERT(mkfifo(cx::combine_paths(baseDir, "pipe").c_str(), 0644) == 0);
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, "mytestdir/sock");
+	ASSERT(sock != -1 && bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+	// The socket was walked into as a directory before.
+	names.clear();
+	cx::enum_all_files(baseDir, [&names](const std::string& filename, cx::EnumFileType fileType, bool&) {
+		names.push_back(filename + (fileType == cx::EFT_DIR ? "/" : ""));
+	});
+	ASSERT(names.size() == 7);
+	ASSERT(std::find(names.begin(), names.end(), cx::combine_paths(baseDir, "sock")) == names.end());
+	ASSERT(std::find(names.begin(), names.end(), cx::combine_paths(baseDir, "linkb")) != names.end());
+
+	names.clear();
+	cx::walk_files(baseDir, collect);
+	ASSERT(names.size() == 7);
+	ASSERT(std::find(names.begin(), names.end(), cx::combine_paths(baseDir, "linkb") + "@") != names.end());
+
+	cx::walk_options options;
+	options.followSymlinks = true;
+	names.clear();
+	cx::walk_files(baseDir, collect, options);
+	std::sort(names.begin(), names.end());
+	// a/b is walked once, through a/b or linkb whichever comes first, and loop leads back to a.
+	size_t file1Count = 0;
+	for (size_t i = 0; i < names.size(); i++) {
+		if (cx::get_filename(names[i]) == "file1.txt") file1Count++;
+	}
+	ASSERT(file1Count == 1);
+	ASSERT(std::find(names.begin(), names.end(), cx::combine_paths(baseDir, "linkb") + "/@") != names.end());
+	size_t loopCount = 0;
+	for (size_t i = 0; i < names.size(); i++) {
+		if (names[i].size() > 7 && names[i].compare(names[i].size() - 7, 7, "/loop/@") == 0) loopCount++;
+	}
+	ASSERT(loopCount == 1);
+	ASSERT(std::find(names.begin(), names.end(), cx::combine_paths(baseDir, "link2") + "@") != names.end());
+
+	close(sock);
+	ASSERT(unlink(cx::combine_paths(baseDir, "sock").c_str()) == 0);
+	ASSERT(unlink(cx::combine_paths(baseDir, "pipe").c_str()) == 0);
+
+#ifdef __linux__
+	// Stay on the root file system, /proc is output but not walked into.
+	if (cx::is_directory("/proc/self")) {
+		options = cx::walk_options();
+		options.oneFileSystem = true;
+		options.depth = 2;
+		bool procFound = false, procWalked = false;
+		cx::walk_files("/", [&procFound, &procWalked](const cx::directory_entry& entry, bool&) {
+			if (entry.filename == "/proc") procFound = true;
+			if (entry.filename.compare(0, 6, "/proc/") == 0) procWalked = true;
+		}, options);
+		ASSERT(procFound && !procWalked);
+	}
+#endif // __linux__
+#endif // _WIN32
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_traversal_order() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+
+	// A deep chain under "a", shallow files under "b", "c" and "d".
+	std::string deep = cx::combine_paths(baseDir, "a");
+	for (int i = 0; i < 20; i++) deep = cx::combine_paths(deep, "x");
+	CREATE_DIR(deep);
+	CREATE_FILE(cx::combine_paths(deep, "deep.txt"));
+	const char* dirs[] = { "b", "c", "d" };
+	for (int i = 0; i < 3; i++) {
+		CREATE_DIR(cx::combine_paths(baseDir, dirs[i]));
+		CREATE_FILE(cx::combine_paths(baseDir, dirs[i], "target.txt"));
+	}
+
+	std::vector<cx::directory_entry> entries;
+	auto collect = [&entries](const cx::directory_entry& entry, bool&) { entries.push_back(entry); };
+	cx::walk_options options;
+	cx::walk_files(baseDir, collect, options);
+	ASSERT(entries.size() == 28);
+	std::vector<cx::directory_entry> all = entries;
+
+	// Breadth first: depths never go down.
+	options.order = cx::TO_BREADTH_FIRST;
+	entries.clear();
+	cx::walk_files(baseDir, collect, options);
+	ASSERT(entries.size() == all.size());
+	for (size_t i = 1; i < entries.size(); i++) ASSERT(entries[i].depth >= entries[i - 1].depth);
+	for (size_t i = 0; i < entries.size(); i++) {
+		ASSERT(entries[i].depth == (int)std::count(entries[i].filename.begin(), entries[i].filename.end(), '/'));
+	}
+
+	// The first target is found before walking the deep chain.
+	size_t visited = 0;
+	cx::walk_files(baseDir, [&visited](const cx::directory_entry& entry, bool& cancelEnum) {
+		visited++;
+		if (cx::get_filename(entry.filename) == "target.txt") cancelEnum = true;
+	}, options);
+	ASSERT(visited <= 8);
+
+	// A frontier of one still outputs every entry once.
+	options.maxFrontier = 1;
+	entries.clear();
+	cx::walk_files(baseDir, collect, options);
+	ASSERT(entries.size() == all.size());
+	std::vector<std::string> names;
+	for (size_t i = 0; i < entries.size(); i++) names.push_back(entries[i].filename);
+	std::sort(names.begin(), names.end());
+	ASSERT(std::unique(names.begin(), names.end()) == names.end());
+
+	// Priority: higher names first, deep chain last.
+	options.order = cx::TO_PRIORITY;
+	options.maxFrontier = 65536;
+	options.priority = [](const cx::directory_entry& dir) {
+		std::string name = cx::get_filename(dir.filename);
+		return name == "x" || name == "a" ? -1.0 : (double)name[0];
+	};
+	entries.clear();
+	cx::walk_files(baseDir, collect, options);
+	ASSERT(entries.size() == all.size());
+	std::vector<std::string> targets;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (cx::get_filename(entries[i].filename) == "target.txt") targets.push_back(cx::get_filename(cx::get_parent_directory(entries[i].filename)));
+	}
+	ASSERT(targets.size() == 3 && targets[0] == "d" && targets[1] == "c" && targets[2] == "b");
+	ASSERT(cx::get_filename(entries.back().filename) == "deep.txt");
+
+	options.priority = cx::walk_priority_callback();
+	ASSERT_EXCEPTION(cx::walk_files(baseDir, collect, options), std::invalid_argument);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_walk_checkpoint() {
+	const char* baseDir = "mytestdir";
+	std::string checkpoint = "fileutils-test.checkpoint";
+	cx::remove_directories(baseDir);
+	cx::remove_file(checkpoint);
+	for (int i = 0; i < 5; i++) {
+		std::string dir = cx::combine_paths(baseDir, "d" + std::to_string(i), "e");
+		CREATE_DIR(dir);
+		for (int k = 0; k < 8; k++) {
+			CREATE_FILE(cx::combine_paths(dir, std::to_string(k) + ".txt"));
+			CREATE_FILE(cx::combine_paths(cx::get_parent_directory(dir), std::to_string(k) + ".txt"));
+		}
+	}
+	const size_t total = 5 * (2 + 16);
+
+	for (int order = cx::TO_DEPTH_FIRST; order <= cx::TO_BREADTH_FIRST; order++) {
+		cx::walk_options options;
+		options.order = (cx::TraversalOrder)order;
+		options.checkpointFile = checkpoint;
+		options.checkpointInterval = 10;
+
+		// Stop after 25 entries, as if the process died.
+		std::vector<std::string> first;
+		{
+			cx::recursive_directory_range range(baseDir, options);
+			cx::directory_entry entry;
+			while (first.size() < 25 && range.next(entry)) first.push_back(entry.filename);
+		}
+		ASSERT(first.size() == 25);
+		ASSERT(cx::is_file(checkpoint));
+
+		// Resume, the entries after the checkpoint at 20 are output again.
+		std::vector<std::string> second;
+		cx::walk_files(baseDir, [&second](const cx::directory_entry& entry, bool&) { second.push_back(entry.filename); }, options);
+		ASSERT(second.size() == total - 20);
+		ASSERT(std::equal(first.begin() + 20, first.end(), second.begin()));
+		std::vector<std::string> all(first.begin(), first.begin() + 20);
+		all.insert(all.end(), second.begin(), second.end());
+		std::sort(all.begin(), all.end());
+		ASSERT(std::unique(all.begin(), all.end()) == all.end() && all.size() == total);
+		ASSERT(!cx::is_file(checkpoint));
+	}
+
+	// Explicit checkpoint, keeping the entry the iterator refers to.
+	{
+		cx::recursive_directory_range range(baseDir);
+		cx::recursive_directory_range::iterator it = range.begin();
+		++it;
+		std::string second = it->filename;
+		range.save_checkpoint(checkpoint);
+
+		cx::walk_options options;
+		options.checkpointFile = checkpoint;
+		cx::recursive_directory_range resumed(baseDir, options);
+		cx::directory_entry entry;
+		ASSERT(resumed.next(entry) && entry.filename == second);
+		size_t count = 2;
+		while (resumed.next(entry)) count++;
+		ASSERT(count == total);
+
+		range.save_checkpoint(checkpoint);
+		ASSERT_EXCEPTION(cx::recursive_directory_range(cx::combine_paths(baseDir, "d1"), options), std::invalid_argument);
+
+		// A failed save keeps the previous checkpoint.
+		std::vector<unsigned char> saved, kept;
+		cx::read_all_bytes(checkpoint, saved);
+		++it;
+		CREATE_DIR(checkpoint + ".tmp");
+		ASSERT_EXCEPTION(range.save_checkpoint(checkpoint), cx::io_exception);
+		cx::read_all_bytes(checkpoint, kept);
+		ASSERT(kept == saved);
+		ASSERT(cx::remove_directory(checkpoint + ".tmp"));
+
+		cx::write_all_bytes(checkpoint, std::vector<unsigned char>(10, 'x'));
+		ASSERT_EXCEPTION(cx::recursive_directory_range(baseDir, options), cx::io_exception);
+		cx::remove_file(checkpoint);
+	}
+
+#ifndef _WIN32
+	// The visited directories of followSymlinks are appended to a side file.
+	{
+		ASSERT(symlink("..", cx::combine_paths(baseDir, "d0", "e", "up").c_str()) == 0);
+		cx::walk_options options;
+		options.followSymlinks = true;
+		options.checkpointFile = checkpoint;
+		options.checkpointInterval = 5;
+
+		std::vector<std::string> first;
+		{
+			cx::recursive_directory_range range(baseDir, options);
+			cx::directory_entry entry;
+			while (first.size() < 30 && range.next(entry)) first.push_back(entry.filename);
+		}
+		cx::file_status status;
+		ASSERT(cx::get_file_status(checkpoint + ".visited", status) && status.size > 0 && status.size % 16 == 0);
+
+		std::vector<std::string> second;
+		cx::walk_files(baseDir, [&second](const cx::directory_entry& entry, bool&) { second.push_back(entry.filename); }, options);
+		ASSERT(second.size() == total + 1 - 25);
+		std::vector<std::string> all(first.begin(), first.begin() + 25);
+		all.insert(all.end(), second.begin(), second.end());
+		std::sort(all.begin(), all.end());
+		ASSERT(std::unique(all.begin(), all.end()) == all.end() && all.size() == total + 1);
+		ASSERT(!cx::is_file(checkpoint) && !cx::is_file(checkpoint + ".visited"));
+	}
+#endif // _WIN32
+
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_partition_scan() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	for (int i = 0; i < 10; i++) {
+		std::string dir = cx::combine_paths(baseDir, "big", "b" + std::to_string(i));
+		CREATE_DIR(dir);
+		for (int k = 0; k < 5; k++) CREATE_FILE(cx::combine_paths(dir, std::to_string(k) + ".txt"));
+	}
+	for (int i = 0; i < 4; i++) {
+		std::string dir = cx::combine_paths(baseDir, "s" + std::to_string(i));
+		CREATE_DIR(dir);
+		for (int k = 0; k < 3; k++) CREATE_FILE(cx::combine_paths(dir, std::to_string(k) + ".txt"));
+	}
+	CREATE_FILE(cx::combine_paths(baseDir, "top1.txt"));
+	CREATE_FILE(cx::combine_paths(baseDir, "top2.txt"));
+
+	std::vector<cx::scan_shard> shards, again;
+	cx::partition_scan(baseDir, 3, shards);
+	cx::partition_scan(baseDir, 3, again);
+	ASSERT(shards.size() == 3);
+	for (size_t i = 0; i < shards.size(); i++) {
+		ASSERT(shards[i].estimatedEntries == again[i].estimatedEntries);
+		ASSERT(shards[i].subtrees.size() == again[i].subtrees.size());
+		for (size_t k = 0; k < shards[i].subtrees.size(); k++) ASSERT(shards[i].subtrees[k].filename == again[i].subtrees[k].filename);
+		// The big directory is split, so no shard holds most of the tree.
+		ASSERT(shards[i].estimatedEntries > 0 && shards[i].estimatedEntries < 40);
+	}
+
+	// All shards together output the same entries as a single walk, with the same depths.
+	for (int depth = 0; depth <= 2; depth++) {
+		cx::walk_options options;
+		options.depth = depth;
+		std::vector<std::string> expected, actual;
+		cx::walk_files(baseDir, [&expected](const cx::directory_entry& entry, bool&) {
+			expected.push_back(std::to_string(entry.depth) + entry.filename);
+		}, options);
+		for (size_t i = 0; i < shards.size(); i++) {
+			cx::walk_shard(shards[i], [&actual](const cx::directory_entry& entry, bool&) {
+				actual.push_back(std::to_string(entry.depth) + entry.filename);
+			}, options);
+		}
+		std::sort(expected.begin(), expected.end());
+		std::sort(actual.begin(), actual.end());
+		ASSERT(expected.size() == (depth == 0 ? 79 : depth == 1 ? 7 : 29));
+		ASSERT(expected == actual);
+	}
+
+	// Files only, and a single shard.
+	cx::partition_scan(baseDir, 1, shards);
+	ASSERT(shards.size() == 1 && shards[0].estimatedEntries == 29);
+	cx::walk_options options;
+	options.filters = cx::EFT_FILE;
+	size_t files = 0;
+	cx::walk_shard(shards[0], [&files](const cx::directory_entry& entry, bool&) { if (entry.type == cx::EFT_FILE) files++; }, options);
+	ASSERT(files == 64);
+
+	ASSERT_EXCEPTION(cx::partition_scan(baseDir, 0, shards), std::invalid_argument);
+	ASSERT_EXCEPTION(cx::partition_scan("", 2, shards), std::invalid_argument);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_find_files() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	for (int i = 0; i < 3; i++) {
+		std::string dir = cx::combine_paths(baseDir, "d" + std::to_string(i), "sub");
+		CREATE_DIR(dir);
+		for (int k = 0; k < 4; k++) {
+			std::string name = std::to_string(k) + (k % 2 ? ".log" : ".txt");
+			cx::write_all_bytes(cx::combine_paths(dir, name), std::vector<unsigned char>(k * 100, 'x'));
+			cx::write_all_bytes(cx::combine_paths(cx::get_parent_directory(dir), name), std::vector<unsigned char>(k * 1000, 'x'));
+		}
+	}
+	CREATE_FILE(cx::combine_paths(baseDir, "[a].txt"));
+
+	typedef cx::file_query Q;
+	std::vector<cx::directory_entry> matches;
+	for (int threads = 1; threads <= 4; threads += 3) {
+		cx::find_files(baseDir, Q(), matches, threads);
+		ASSERT(matches.size() == 31);
+		for (size_t i = 1; i < matches.size(); i++) ASSERT(matches[i - 1].filename < matches[i].filename);
+
+		cx::find_files(baseDir, Q::type(cx::EFT_FILE) && Q::name("*.log"), matches, threads);
+		ASSERT(matches.size() == 12);
+		cx::find_files(baseDir, Q::name("*.log") && Q::size_at_least(1000), matches, threads);
+		ASSERT(matches.size() == 6);
+		for (size_t i = 0; i < matches.size(); i++) ASSERT(matches[i].depth == 2);
+	}
+
+	// Sizes, times, and or not.
+	cx::find_files(baseDir, Q::type(cx::EFT_FILE) && Q::size_at_most(200), matches);
+	ASSERT(matches.size() == 3 * 3 + 3 + 1);
+	cx::find_files(baseDir, Q::type(cx::EFT_FILE) && !(Q::name("*.txt") || Q::size_at_least(300)), matches);
+	ASSERT(matches.size() == 3);
+	long long now = (long long)time(NULL);
+	cx::find_files(baseDir, Q::type(cx::EFT_FILE) && Q::modified_after(now - 3600) && Q::modified_before(now + 3600), matches);
+	ASSERT(matches.size() == 25);
+	cx::find_files(baseDir, Q::modified_before(now - 3600), matches);
+	ASSERT(matches.empty());
+
+	// Depths and paths, the brackets of "[a].txt" are literal when escaped as a class.
+	cx::find_files(baseDir, Q::depth_at_most(1), matches);
+	ASSERT(matches.size() == 4);
+	cx::find_files(baseDir, Q::depth_at_least(3) && Q::name("[0-1].*"), matches);
+	ASSERT(matches.size() == 6);
+	cx::find_files(baseDir, Q::name("[[]a].txt"), matches);
+	ASSERT(matches.size() == 1 && matches[0].filename == cx::combine_paths(baseDir, "[a].txt"));
+	cx::find_files(baseDir, Q::path(cx::combine_paths(baseDir, "d1", "sub", "*")), matches);
+	ASSERT(matches.size() == 4);
+	cx::find_files(baseDir, Q::path(cx::combine_paths(baseDir, "d*", "?.log")), matches);
+	ASSERT(matches.size() == 12);
+	cx::find_files(baseDir, Q::name("[!0-2].txt") || Q::name("3.log"), matches);
+	ASSERT(matches.size() == 6);
+
+	ASSERT_EXCEPTION(cx::find_files("", Q(), matches), std::invalid_argument);
+	ASSERT_EXCEPTION(cx::find_files(cx::combine_paths(baseDir, "none"), Q(), matches), cx::io_exception);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_static_enum_files() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	for (int i = 0; i < 3; i++) {
+		std::string dir = cx::combine_paths(baseDir, "d" + std::to_string(i), "e");
+		CREATE_DIR(dir);
+		for (int k = 0; k < 4; k++) {
+			CREATE_FILE(cx::combine_paths(dir, std::to_string(k) + (k % 2 ? ".log" : ".txt")));
+			CREATE_FILE(cx::combine_paths(cx::get_parent_directory(dir), std::to_string(k) + ".txt"));
+		}
+	}
+
+	// The same entries as the runtime configured enumeration.
+	std::vector<std::string> expected, actual;
+	auto collect = [](std::vector<std::string>& names) {
+		return [&names](const std::string& filename, cx::EnumFileType, bool&) { names.push_back(filename); };
+	};
+	cx::enum_all_files(baseDir, collect(expected), cx::EFT_FILE);
+	cx::enum_files<cx::EFT_FILE, 0>(baseDir, collect(actual));
+	ASSERT(expected.size() == 24 && expected == actual);
+
+	expected.clear();
+	actual.clear();
+	cx::enum_files(baseDir, collect(expected), cx::EFT_DIR, 2);
+	cx::enum_files<cx::EFT_DIR, 2>(baseDir, collect(actual));
+	ASSERT(expected.size() == 6 && expected == actual);
+
+	expected.clear();
+	actual.clear();
+	cx::enum_files(baseDir, collect(expected));
+	cx::enum_files<cx::EFT_DIR | cx::EFT_FILE, 1>(std::string(baseDir) + "/", collect(actual));
+	ASSERT(expected.size() == 3 && actual.size() == 3);
+	for (size_t i = 0; i < actual.size(); i++) ASSERT(actual[i] == expected[i]);
+
+	// Name predicate, directories are walked into even when rejected.
+	actual.clear();
+	cx::enum_files<cx::EFT_DIR | cx::EFT_FILE, 0>(baseDir, collect(actual), [](const char* name) { return strstr(name, ".log") != NULL; });
+	ASSERT(actual.size() == 6);
+
+	// Cancel from a sub-directory ends the whole enumeration.
+	size_t count = 0;
+	cx::enum_files<cx::EFT_FILE, 0>(baseDir, [&count](const std::string&, cx::EnumFileType, bool& cancelEnum) { cancelEnum = ++count == 5; });
+	ASSERT(count == 5);
+
+	ASSERT_EXCEPTION((cx::enum_files<cx::EFT_FILE, 0>("", collect(actual))), std::invalid_argument);
+	ASSERT_EXCEPTION((cx::enum_files<cx::EFT_FILE, 0>(cx::combine_paths(baseDir, "none"), collect(actual))), cx::io_exception);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_clone_directories() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	std::string src = cx::combine_paths(baseDir, "src");
+	for (int i = 0; i < 4; i++) {
+		std::string dir = cx::combine_paths(src, "d" + std::to_string(i), "e");
+		CREATE_DIR(dir);
+		for (int k = 0; k < 5; k++) {
+			std::vector<unsigned char> data(k * 1000 + i, (unsigned char)('a' + k));
+			cx::write_all_bytes(cx::combine_paths(dir, std::to_string(k) + ".bin"), data);
+		}
+	}
+#ifndef _WIN32
+	std::string readOnly = cx::combine_paths(src, "d0", "e");
+	ASSERT(chmod(readOnly.c_str(), 0555) == 0);
+	ASSERT(chmod(cx::combine_paths(src, "d1").c_str(), 0750) == 0);
+	ASSERT(symlink("d0/e/1.bin", cx::combine_paths(src, "link").c_str()) == 0);
+#endif // _WIN32
+
+	const cx::CloneMode modes[] = { cx::CM_HARDLINK, cx::CM_REFLINK, cx::CM_COPY };
+	for (int m = 0; m < 3; m++) {
+		std::string dst = cx::combine_paths(baseDir, "dst" + std::to_string(m));
+		cx::clone_stats stats = cx::clone_directories(src, dst, modes[m], 3);
+		ASSERT(stats.directories == 9);
+#ifndef _WIN32
+		ASSERT(stats.symlinks == 1);
+#endif // _WIN32
+		ASSERT(stats.linked + stats.reflinked + stats.copied == 20);
+		if (modes[m] == cx::CM_HARDLINK) ASSERT(stats.linked == 20);
+		if (modes[m] == cx::CM_COPY) ASSERT(stats.copied == 20);
+
+		for (int i = 0; i < 4; i++) {
+			for (int k = 0; k < 5; k++) {
+				std::string name = cx::combine_paths("d" + std::to_string(i), "e", std::to_string(k) + ".bin");
+				std::vector<unsigned char> expected, actual;
+				cx::read_all_bytes(cx::combine_paths(src, name), expected);
+				cx::read_all_bytes(cx::combine_paths(dst, name), actual);
+				ASSERT(expected == actual);
+#ifndef _WIN32
+				cx::file_status a, b;
+				ASSERT(cx::get_file_status(cx::combine_paths(src, name), a) && cx::get_file_status(cx::combine_paths(dst, name), b));
+				ASSERT((a.inode == b.inode) == (modes[m] == cx::CM_HARDLINK));
+#endif // _WIN32
+			}
+		}
+#ifndef _WIN32
+		struct stat st;
+		ASSERT(stat(cx::combine_paths(dst, "d0", "e").c_str(), &st) == 0 && (st.st_mode & 07777) == 0555);
+		ASSERT(stat(cx::combine_paths(dst, "d1").c_str(), &st) == 0 && (st.st_mode & 07777) == 0750);
+		char target[64] = { 0 };
+		ASSERT(readlink(cx::combine_paths(dst, "link").c_str(), target, sizeof(target) - 1) == 10 && strcmp(target, "d0/e/1.bin") == 0);
+#endif // _WIN32
+	}
+
+	// The entries already in the destination are not replaced.
+	try {
+		cx::clone_directories(src, cx::combine_paths(baseDir, "dst2"), cx::CM_COPY, 2);
+		ASSERT(false);
+	} catch (const cx::io_exception& e) {
+#ifdef _WIN32
+		ASSERT(e.error_code() == ERROR_FILE_EXISTS);
+#else
+		ASSERT(e.error_code() == EEXIST);
+#endif // _WIN32
+	}
+
+	ASSERT_EXCEPTION(cx::clone_directories("", src), std::invalid_argument);
+	ASSERT_EXCEPTION(cx::clone_directories(src, ""), std::invalid_argument);
+	ASSERT_EXCEPTION(cx::clone_directories(cx::combine_paths(baseDir, "none"), cx::combine_paths(baseDir, "dst")), cx::io_exception);
+#ifndef _WIN32
+	ASSERT(chmod(readOnly.c_str(), 0755) == 0);
+#endif // _WIN32
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_directory_pages() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(baseDir);
+	for (int i = 0; i < 1000; i++) CREATE_FILE(cx::combine_paths(baseDir, "file" + std::to_string(i)));
+	for (int i = 0; i < 50; i++) CREATE_DIR(cx::combine_paths(baseDir, "dir" + std::to_string(i)));
+
+	std::vector<std::string> all;
+	cx::enum_files(baseDir, [&all](const std::string& filename, cx::EnumFileType, bool&) { all.push_back(filename); });
+	ASSERT(all.size() == 1050);
+
+	// Pages in the order of a whole enumeration.
+	std::vector<std::string> paged;
+	std::vector<cx::directory_entry> page;
+	unsigned long long cursor = 0;
+	size_t pages = 0;
+	bool more;
+	do {
+		more = cx::read_directory_page(baseDir, cursor, 64, page);
+		ASSERT(page.size() == (more ? 64 : 1050 % 64));
+		for (size_t i = 0; i < page.size(); i++) {
+			ASSERT(page[i].depth == 1 && !page[i].symlink);
+			paged.push_back(page[i].filename);
+		}
+		pages++;
+	} while (more);
+	ASSERT(pages == 17 && paged == all);
+	ASSERT(!cx::read_directory_page(baseDir, cursor, 64, page) && page.empty());
+
+	// Filtered pages, and a last page which is exactly full.
+	cursor = 0;
+	ASSERT(cx::read_directory_page(baseDir, cursor, 25, page, cx::EFT_DIR) && page.size() == 25);
+	ASSERT(!cx::read_directory_page(baseDir, cursor, 25, page, cx::EFT_DIR) && page.size() == 25);
+	for (size_t i = 0; i < page.size(); i++) ASSERT(page[i].type == cx::EFT_DIR);
+
+	// Resume an enumerator at the cursor of an entry.
+	cx::file_enumerator fe;
+	ASSERT(fe.begin(baseDir));
+	for (int i = 0; i < 500; i++) ASSERT(fe.next());
+	unsigned long long middle = fe.cursor();
+	std::string expected = fe.filename();
+	fe.end();
+	ASSERT(fe.begin(baseDir, middle) && fe.filename() == expected);
+	std::vector<cx::directory_entry> rest;
+	ASSERT(!fe.next_entries(rest, 1000));
+	ASSERT(rest.size() == 550 && rest.back().filename == all.back());
+	ASSERT(!fe.next_entries(rest, 1000) && rest.size() == 550);
+
+	ASSERT_EXCEPTION(cx::read_directory_page("", cursor, 10, page), std::invalid_argument);
+	ASSERT_EXCEPTION(cx::read_directory_page(baseDir, cursor, 0, page), std::invalid_argument);
+	cursor = 0;
+	ASSERT_EXCEPTION(cx::read_directory_page(cx::combine_paths(baseDir, "none"), cursor, 10, page), cx::io_exception);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
+bool test_directory_context() {
+	const char* baseDir = "mytestdir";
+	cx::remove_directories(baseDir);
+	CREATE_DIR(baseDir);
+#ifndef _WIN32
+	std::string cwd = cx::get_current_directory();
+#endif // _WIN32
+
+	{
+		cx::directory_context context(baseDir);
+		ASSERT(context.path() == baseDir);
+		ASSERT(context.resolve("a") == cx::combine_paths(baseDir, "a") && context.resolve("/tmp") == "/tmp");
+#ifndef _WIN32
+		ASSERT(context.native_handle() >= 0);
+#endif // _WIN32
+
+		// Threads work relative to the context while the current directory changes under them.
+		std::atomic<bool> done(false);
+		std::atomic<int> failures(0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; t++) {
+			threads.push_back(std::thread([&context, &failures, t]() {
+				std::string dir = "t" + std::to_string(t);
+				if (!context.create_directory(dir)) failures++;
+				for (int i = 0; i < 50; i++) {
+					std::string name = cx::combine_paths(dir, std::to_string(i));
+					std::vector<unsigned char> data(i + 1, (unsigned char)t), actual;
+					context.write_all_bytes(name + ".tmp", data);
+					context.rename(name + ".tmp", name);
+					context.read_all_bytes(name, actual);
+					if (actual != data || !context.is_file(name) || context.is_file(name + ".tmp")) failures++;
+				}
+			}));
+		}
+#ifndef _WIN32
+		std::thread mover([&done]() {
+			while (!done) {
+				if (chdir("/") != 0) break;
+				if (chdir("/tmp") != 0) break;
+			}
+		});
+#endif // _WIN32
+		for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+		done = true;
+#ifndef _WIN32
+		mover.join();
+		ASSERT(chdir(cwd.c_str()) == 0);
+#endif // _WIN32
+		ASSERT(failures == 0);
+		ASSERT(cx::get_all_file_count(baseDir, cx::EFT_FILE) == 200);
+
+		// Status, sub-contexts and enumeration relative to the context.
+		cx::file_status status;
+		ASSERT(context.get_file_status("t1/9", status) && status.size == 10 && status.type == cx::EFT_FILE && status.filename == "t1/9");
+		ASSERT(!context.get_file_status("none", status));
+		ASSERT(context.is_directory("t2") && !context.is_directory("t2/1"));
+		cx::directory_context sub(context, "t3");
+		ASSERT(sub.path() == cx::combine_paths(baseDir, "t3") && sub.is_file("49"));
+		cx::file_enumerator fe;
+		size_t count = 0;
+		if (fe.begin(context, "t0")) {
+			do {
+				ASSERT(fe.filename().find_first_of("\\/") == 2 && context.is_file(fe.filename()));
+				count++;
+			} while (fe.next());
+		}
+		ASSERT(count == 50);
+		fe.end();
+		count = 0;
+		if (fe.begin(sub, "")) {
+			do {
+				ASSERT(fe.filename().find_first_of("\\/") == std::string::npos);
+				count++;
+			} while (fe.next());
+		}
+		ASSERT(count == 50);
+
+		// The changes are seen by the metadata caches under the resolved names.
+		cx::metadata_cache cache;
+		ASSERT(!cache.is_file(context.resolve("new")));
+		context.write_all_bytes("new", std::vector<unsigned char>(1, 'n'));
+		ASSERT(cache.is_file(context.resolve("new")));
+		context.rename("new", "new2");
+		ASSERT(!cache.is_file(context.resolve("new")) && cache.is_file(context.resolve("new2")));
+		ASSERT(context.remove_file("new2") && !cache.is_file(context.resolve("new2")));
+		ASSERT(!cache.is_directory(context.resolve("empty")));
+		ASSERT(context.create_directory("empty") && cache.is_directory(context.resolve("empty")));
+		ASSERT(context.remove_directory("empty") && !cache.is_directory(context.resolve("empty")));
+
+#ifndef _WIN32
+		// The context follows its directory when it is renamed.
+		std::string renamed = std::string(baseDir) + "-renamed";
+		cx::rename(baseDir, renamed);
+		ASSERT(context.is_file("t0/1"));
+		ASSERT(context.remove_file("t0/1") && !context.remove_file("t0/1"));
+		ASSERT(!context.remove_directory("t0"));
+		ASSERT(context.create_directory("empty") && context.remove_directory("empty"));
+		cx::rename(renamed, baseDir);
+#endif // _WIN32
+
+		std::vector<unsigned char> data;
+		ASSERT_EXCEPTION(context.read_all_bytes("none", data), cx::io_exception);
+		ASSERT_EXCEPTION(context.remove_file("t1"), cx::io_exception);
+		ASSERT_EXCEPTION(context.rename("", "a"), std::invalid_argument);
+		ASSERT_EXCEPTION(cx::directory_context(context, "none"), cx::io_exception);
+	}
+	ASSERT_EXCEPTION(cx::directory_context(""), std::invalid_argument);
+	ASSERT_EXCEPTION(cx::directory_context(cx::combine_paths(baseDir, "none")), cx::io_exception);
+	ASSERT(cx::remove_directories(baseDir));
+	return true;
+}
+
 int main() {
 	if (!test_path()) return 1;
 	if (!test_file()) return 1;
@@ -532,6 +2364,31 @@ int main() {
 	if (!test_directory()) return 1;
 	if (!test_enum_files()) return 1;
 	if (!test_read_write()) return 1;
+	if (!test_file_status()) return 1;
+	if (!test_metadata_cache()) return 1;
+	if (!test_recursive_directory_range()) return 1;
+	if (!test_process_files()) return 1;
+	if (!test_hash()) return 1;
+	if (!test_find_duplicates()) return 1;
+	if (!test_search_tree()) return 1;
+	if (!test_compressed_bytes()) return 1;
+	if (!test_pack()) return 1;
+	if (!test_sparse_files()) return 1;
+	if (!test_file_prefetcher()) return 1;
+	if (!test_buffer_pool()) return 1;
+	if (!test_vectored_io()) return 1;
+	if (!test_append_writer()) return 1;
+	if (!test_move_files()) return 1;
+	if (!test_error_codes()) return 1;
+	if (!test_walk_files()) return 1;
+	if (!test_traversal_order()) return 1;
+	if (!test_walk_checkpoint()) return 1;
+	if (!test_partition_scan()) return 1;
+	if (!test_find_files()) return 1;
+	if (!test_static_enum_files()) return 1;
+	if (!test_clone_directories()) return 1;
+	if (!test_directory_pages()) return 1;
+	if (!test_directory_context()) return 1;
 	
 	printf("All tests passed!\n");
 	return 0;